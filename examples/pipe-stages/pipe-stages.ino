@@ -0,0 +1,47 @@
+#include <StreamableManager.h>
+#include <StringStream.h>
+
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial);
+
+  String testString("a=1\nb=2\nc=3\nd=4\ne=5\nf=6\ng=7\n");
+  StringStream srcStream(testString);
+  StringStream destStream;
+
+  StreamableManager streamableMgr;
+
+  /*
+   * Plain local variables can be captured by the stages, so no state
+   * object is needed
+   */
+  String valueRemoved;
+
+  Serial.println("Streaming from srcStream:");
+  Serial.println(testString);
+
+  streamableMgr.pipeThrough(&srcStream, &destStream, false,
+
+    // Remove the line with the key "c", but keep its value
+    [&](StreamableManager::PipeLine& line) {
+      if (line.keyIs("c")) {
+        valueRemoved = line.value();
+        return false; // drop the line
+      }
+      return true;
+    },
+
+    // Rename the key "e"
+    [](StreamableManager::PipeLine& line) {
+      if (line.keyIs("e")) line.setKey("eee");
+      return true;
+    });
+
+  Serial.println("Received by destStream:");
+  Serial.println(destStream.getString());
+
+  Serial.println("\nRemoved key 'c' and captured value '" + valueRemoved + "'");
+}
+
+void loop() {}
@@ -0,0 +1,83 @@
+/*
+
+  ByteStorage.h
+
+  Byte-addressable storage for StreamableStore
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_ByteStorage_h
+#define _strdto_ByteStorage_h
+
+
+#include <Arduino.h>
+
+/*
+ * Storage that can read and write single bytes at any address, such as an
+ * EEPROM. Erased storage reads as 0xFF.
+ */
+class ByteStorage {
+
+  public:
+    virtual ~ByteStorage() {};
+    virtual uint32_t size() = 0;
+    virtual uint8_t read(uint32_t address) = 0;
+    virtual void write(uint32_t address, uint8_t value) = 0;
+
+    /*
+     * Called after each save. Override this for storage that buffers writes,
+     * such as the EEPROM emulation on ESP boards (which needs EEPROM.commit())
+     */
+    virtual void flush() {};
+
+};
+
+/*
+ * ByteStorage in RAM, for testing
+ */
+template <uint32_t Size>
+class MemoryStorage: public ByteStorage {
+
+  public:
+    MemoryStorage() { memset(_bytes, 0xFF, Size); };
+
+    uint32_t size() override { return Size; };
+    uint8_t read(uint32_t address) override { return address < Size ? _bytes[address] : 0xFF; };
+    void write(uint32_t address, uint8_t value) override {
+      if (address < Size) _bytes[address] = value;
+    };
+
+  private:
+    uint8_t _bytes[Size];
+
+};
+
+/*
+ * Wraps an EEPROM class with read(), write() and length() methods, like
+ * Arduino's EEPROM. Bytes are only written if they change.
+ *
+ *   #include <EEPROM.h>
+ *   EEPROMStorage<EEPROMClass> storage(EEPROM);
+ */
+template <typename T>
+class EEPROMStorage: public ByteStorage {
+
+  public:
+    EEPROMStorage(T& eeprom): _eeprom(eeprom) {};
+
+    uint32_t size() override { return _eeprom.length(); };
+    uint8_t read(uint32_t address) override { return _eeprom.read(address); };
+    void write(uint32_t address, uint8_t value) override {
+      if (_eeprom.read(address) != value) _eeprom.write(address, value);
+    };
+
+  private:
+    T& _eeprom;
+
+};
+
+
+#endif
@@ -0,0 +1,238 @@
+/*
+
+  CompressedStream.h
+
+  LZSS compression for any Stream
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_CompressedStream_h
+#define _strdto_CompressedStream_h
+
+
+#include <Arduino.h>
+
+/*
+ * A Stream that compresses everything written to it into the wrapped stream,
+ * and decompresses everything read from the wrapped stream. Since it is just
+ * a Stream, it plugs into StreamableManager::send, load and pipe without any
+ * changes to DTO code:
+ *
+ *   CompressedStream<> radioOut(&radio);
+ *   mgr.send(&radioOut, &dto);
+ *   radioOut.finish();             // ends the compressed block
+ *
+ *   CompressedStream<> radioIn(&radio);
+ *   mgr.load(&radioIn, &received);
+ *
+ * The encoding is LZSS (heatshrink-style). Each token starts with a tag bit:
+ *   1 + 8 bits                       a literal byte
+ *   0 + WindowBits + LengthBits      copy (length + MIN_MATCH) bytes from
+ *                                    offset bytes back (offset 1..2^WindowBits-1)
+ * A copy with offset 0 marks the end of a block, after which the encoder pads
+ * to a byte boundary and both sides start over with an empty window.
+ *
+ * Each object holds a 2^WindowBits byte window for each direction, even if
+ * it's only used one way, so RAM use is about twice that, plus the lookahead
+ * buffer for compressing. The defaults (256 byte windows, copies
+ * of up to 17 bytes) suit AVR boards. Larger windows compress better but
+ * searching for matches takes longer.
+ */
+template <uint8_t WindowBits = 8, uint8_t LengthBits = 4>
+class CompressedStream: public Stream {
+
+  static_assert(WindowBits >= 4 && WindowBits <= 15, "WindowBits must be 4..15");
+  static_assert(LengthBits >= 2 && LengthBits <= 8, "LengthBits must be 2..8");
+
+  public:
+    CompressedStream(Stream* inner): _inner(inner) {};
+
+    /*
+     * Compressing side
+     */
+    size_t write(uint8_t b) override {
+      _lookahead[_lookLen++] = b;
+      if (_lookLen == MAX_MATCH) {
+        encodeToken();
+      }
+      return 1;
+    };
+
+    int availableForWrite() override {
+      return _inner->availableForWrite();
+    };
+
+    /*
+     * Compresses whatever is still buffered, then writes the end of block
+     * marker so the receiver gets every byte written so far. Call this after
+     * each send or pipe.
+     */
+    void finish() {
+      while (_lookLen > 0) {
+        encodeToken();
+      }
+      writeBits(0, 1 + WindowBits + LengthBits); // end of block
+      if (_outBits > 0) {
+        writeBits(0, 8 - _outBits);
+      }
+      _encHistory = 0;
+      _encPos = 0;
+    };
+
+    void flush() override {
+      finish();
+      _inner->flush();
+    };
+
+    /*
+     * Decompressing side
+     */
+    int available() override {
+      return stage() ? 1 : 0;
+    };
+
+    int read() override {
+      if (!stage()) return -1;
+      int b = _staged;
+      _staged = -1;
+      return b;
+    };
+
+    int peek() override {
+      return stage() ? _staged : -1;
+    };
+
+
+  private:
+    static const uint16_t WINDOW_SIZE = 1 << WindowBits;
+    static const uint16_t WINDOW_MASK = WINDOW_SIZE - 1;
+    static const uint8_t MIN_MATCH = 2; // a copy costs less than two literals
+    static const uint16_t MAX_MATCH = MIN_MATCH + (1 << LengthBits) - 1;
+
+    Stream* _inner;
+
+    // Compressor state
+    uint8_t _encWindow[WINDOW_SIZE];
+    uint16_t _encPos = 0;          // where the next byte goes in _encWindow
+    uint16_t _encHistory = 0;      // how many bytes of _encWindow are valid
+    uint8_t _lookahead[MAX_MATCH];
+    uint16_t _lookLen = 0;
+    uint32_t _outAcc = 0;
+    uint8_t _outBits = 0;
+
+    // Decompressor state
+    uint8_t _decWindow[WINDOW_SIZE];
+    uint16_t _decPos = 0;
+    uint32_t _inAcc = 0;
+    uint8_t _inBits = 0;
+    uint16_t _copyOffset = 0;
+    uint16_t _copyRemaining = 0;
+    int _staged = -1;
+
+    void writeBits(uint32_t value, uint8_t count) {
+      _outAcc = (_outAcc << count) | value;
+      _outBits += count;
+      while (_outBits >= 8) {
+        _inner->write(static_cast<uint8_t>(_outAcc >> (_outBits - 8)));
+        _outBits -= 8;
+      }
+    };
+
+    /*
+     * Byte k of a copy starting offset bytes back. Copies may run on into
+     * the lookahead, which is how runs of repeated bytes are encoded.
+     */
+    uint8_t matchByte(uint16_t offset, uint16_t k) const {
+      if (k < offset) {
+        return _encWindow[(_encPos - offset + k) & WINDOW_MASK];
+      }
+      return _lookahead[k - offset];
+    };
+
+    void encodeToken() {
+      uint16_t bestLen = 0;
+      uint16_t bestOffset = 0;
+      uint16_t maxOffset = _encHistory < WINDOW_MASK ? _encHistory : WINDOW_MASK;
+      for (uint16_t offset = 1; offset <= maxOffset && bestLen < _lookLen; offset++) {
+        uint16_t len = 0;
+        while (len < _lookLen && matchByte(offset, len) == _lookahead[len]) len++;
+        if (len > bestLen) {
+          bestLen = len;
+          bestOffset = offset;
+        }
+      }
+      uint16_t consumed;
+      if (bestLen >= MIN_MATCH) {
+        writeBits(0, 1);
+        writeBits(bestOffset, WindowBits);
+        writeBits(bestLen - MIN_MATCH, LengthBits);
+        consumed = bestLen;
+      } else {
+        writeBits(0x100 | _lookahead[0], 9);
+        consumed = 1;
+      }
+      for (uint16_t i = 0; i < consumed; i++) {
+        _encWindow[_encPos] = _lookahead[i];
+        _encPos = (_encPos + 1) & WINDOW_MASK;
+      }
+      _encHistory = (_encHistory + consumed < WINDOW_SIZE) ? _encHistory + consumed : WINDOW_SIZE;
+      _lookLen -= consumed;
+      memmove(_lookahead, _lookahead + consumed, _lookLen);
+    };
+
+    uint32_t takeBits(uint8_t count) {
+      _inBits -= count;
+      return (_inAcc >> _inBits) & ((1UL << count) - 1);
+    };
+
+    void emit(uint8_t b) {
+      _decWindow[_decPos] = b;
+      _decPos = (_decPos + 1) & WINDOW_MASK;
+      _staged = b;
+    };
+
+    /*
+     * Makes sure the next decompressed byte is in _staged. Returns false if
+     * the wrapped stream doesn't have enough data for it yet.
+     */
+    bool stage() {
+      while (_staged < 0) {
+        if (_copyRemaining > 0) {
+          _copyRemaining--;
+          emit(_decWindow[(_decPos - _copyOffset) & WINDOW_MASK]);
+          return true;
+        }
+        while (_inBits <= 24 && _inner->available()) {
+          _inAcc = (_inAcc << 8) | static_cast<uint8_t>(_inner->read());
+          _inBits += 8;
+        }
+        if (_inBits < 1) return false;
+        bool literal = (_inAcc >> (_inBits - 1)) & 1;
+        uint8_t needed = literal ? 9 : 1 + WindowBits + LengthBits;
+        if (_inBits < needed) return false;
+        takeBits(1);
+        if (literal) {
+          emit(takeBits(8));
+          return true;
+        }
+        uint16_t offset = takeBits(WindowBits);
+        uint16_t length = takeBits(LengthBits) + MIN_MATCH;
+        if (offset == 0) {
+          // End of block: skip the padding and start over
+          takeBits(_inBits % 8);
+          _decPos = 0;
+          continue;
+        }
+        _copyOffset = offset;
+        _copyRemaining = length;
+      }
+      return true;
+    };
+
+};
+
+
+#endif
@@ -0,0 +1,76 @@
+#include "PipeSink.h"
+
+PipeSink::PipeSink(Stream* dest, size_t bufferBytes, bool flowControl, bool dropWhenFull):
+    _dest(dest), _flowControl(flowControl), _dropWhenFull(dropWhenFull) {
+  _buffer = new uint8_t[bufferBytes];
+  _size = _buffer ? bufferBytes : 0;
+}
+
+PipeSink::~PipeSink() {
+  delete[] _buffer;
+}
+
+void PipeSink::setKeys(const char* const* keys, uint8_t keyCount, bool exclude = false) {
+  _keys = keys;
+  _keyCount = keyCount;
+  _exclude = exclude;
+}
+
+bool PipeSink::routes(const char* line) const {
+  if (!_keys || (line[0] == '_' && line[1] == '_')) return true;
+  const char* sep = strchr(line, '=');
+  size_t keyLen = sep ? sep - line : strlen(line);
+  while (keyLen > 0 && isspace(line[keyLen - 1])) keyLen--;
+  for (uint8_t i = 0; i < _keyCount; i++) {
+    if (strncmp(line, _keys[i], keyLen) == 0 && _keys[i][keyLen] == '\0') {
+      return !_exclude;
+    }
+  }
+  return _exclude;
+}
+
+bool PipeSink::enqueue(const char* line, size_t len) {
+  if (len + 1 > _size - _count) return false;
+  size_t tail = (_head + _count) % _size;
+  for (size_t i = 0; i <= len; i++) {
+    _buffer[tail] = (i < len) ? line[i] : '\n';
+    if (++tail == _size) tail = 0;
+  }
+  _count += len + 1;
+  return true;
+}
+
+size_t PipeSink::room(size_t n) const {
+  if (!_flowControl) return n;
+  int room = _dest->availableForWrite();
+  if (room <= 0) return 0;
+  return (static_cast<size_t>(room) < n) ? room : n;
+}
+
+size_t PipeSink::drain() {
+  size_t n = room(_count);
+  size_t written = 0;
+  while (written < n) {
+    // The buffered bytes may wrap around the end of the buffer
+    size_t chunk = n - written;
+    if (chunk > _size - _head) chunk = _size - _head;
+    size_t w = _dest->write(_buffer + _head, chunk);
+    _head = (_head + w) % _size;
+    _count -= w;
+    written += w;
+    if (w < chunk) break;
+  }
+  return written;
+}
+
+size_t PipeSink::drainLine(const char* line, size_t len, size_t offset) {
+  size_t n = room(len + 1 - offset);
+  size_t written = 0;
+  if (offset < len) {
+    size_t chunk = (n < len - offset) ? n : len - offset;
+    written = _dest->write(reinterpret_cast<const uint8_t*>(line + offset), chunk);
+    if (written < chunk) return written;
+  }
+  if (written < n) written += _dest->write('\n');
+  return written;
+}
@@ -0,0 +1,101 @@
+/*
+
+  PipeSink.h
+
+  A buffered destination for StreamableManager::pipe to many streams
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_PipeSink_h
+#define _strdto_PipeSink_h
+
+
+#include <Arduino.h>
+
+/*
+ * One destination of a fan-out pipe. Lines routed to the sink are queued in
+ * a ring buffer of bufferBytes, and written out as fast as the destination
+ * takes them, so a slow sink doesn't hold up the others until its buffer
+ * fills. With flowControl, only as many bytes as availableForWrite() reports
+ * are written at a time, otherwise the buffer is written out in full.
+ *
+ * When the buffer is full, the pipe either waits for room (still feeding the
+ * other sinks meanwhile), or with dropWhenFull, drops the line for this sink
+ * only and counts it. A line longer than the buffer is written directly once
+ * the buffer is empty (or dropped), in the same way as the buffer.
+ *
+ * Waiting holds up the whole pipe: no more lines are read until the sink has
+ * room, so the other sinks only write out what they already have. Give a
+ * sink that may stall dropWhenFull if it mustn't hold up the others.
+ */
+class PipeSink {
+
+  public:
+    PipeSink(Stream* dest, size_t bufferBytes = 64, bool flowControl = true, bool dropWhenFull = false);
+    ~PipeSink();
+
+    /*
+     * Only routes "key=value" lines with one of these keys to the sink (or,
+     * with exclude, every line except those). The array isn't copied, so it
+     * must outlive the sink. Lines starting with "__" (meta lines and
+     * checksum trailers) always go to every sink, but a checksum no longer
+     * matches once any line was left out.
+     */
+    void setKeys(const char* const* keys, uint8_t keyCount, bool exclude = false);
+
+    uint32_t getDropped() const { return _dropped; };
+    size_t getBuffered() const { return _count; };
+
+    // Disable moving and copying
+    PipeSink(PipeSink&& other) = delete;
+    PipeSink& operator=(PipeSink&& other) = delete;
+    PipeSink(const PipeSink&) = delete;
+    PipeSink& operator=(const PipeSink&) = delete;
+
+  private:
+    friend class StreamableManager;
+
+    Stream* _dest;
+    uint8_t* _buffer;
+    size_t _size;
+    size_t _head = 0;       // next byte to write out
+    size_t _count = 0;      // bytes queued
+    bool _flowControl;
+    bool _dropWhenFull;
+    const char* const* _keys = nullptr;
+    uint8_t _keyCount = 0;
+    bool _exclude = false;
+    uint32_t _dropped = 0;
+
+    bool routes(const char* line) const;
+
+    /*
+     * Queues the line and a newline. Returns false if there isn't room.
+     */
+    bool enqueue(const char* line, size_t len);
+
+    /*
+     * Writes out as much of the buffer as the destination takes, and returns
+     * the number of bytes written
+     */
+    size_t drain();
+
+    /*
+     * Writes out as much of a line (and its newline) that's too long to
+     * buffer as the destination takes, from offset on, and returns the number
+     * of bytes written
+     */
+    size_t drainLine(const char* line, size_t len, size_t offset);
+
+    /*
+     * How many of n bytes the destination takes now
+     */
+    size_t room(size_t n) const;
+
+};
+
+
+#endif
@@ -0,0 +1,109 @@
+/*
+
+  SeekableStream.h
+
+  Random access to Streams such as files
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_SeekableStream_h
+#define _strdto_SeekableStream_h
+
+
+#include <Arduino.h>
+
+/*
+ * A Stream that can be repositioned. Arduino has no common interface for
+ * this, so file classes are wrapped with SeekableStreamAdapter.
+ */
+class SeekableStream: public Stream {
+
+  public:
+    virtual bool seek(uint32_t pos) = 0;
+    virtual uint32_t position() = 0;
+    virtual uint32_t size() = 0;
+
+    /*
+     * Cuts the stream down to size bytes. Returns false if that isn't
+     * supported, which is the default.
+     */
+    virtual bool truncate(uint32_t) { return false; };
+
+};
+
+/*
+ * Makes any Stream with seek(), position() and size() methods, such as the
+ * File classes of the SD and LittleFS libraries, a SeekableStream:
+ *
+ *   File file = SD.open("log.txt");
+ *   SeekableStreamAdapter<File> data(file);
+ */
+template <typename T>
+class SeekableStreamAdapter: public SeekableStream {
+
+  public:
+    SeekableStreamAdapter(T& inner): _inner(inner) {};
+
+    bool seek(uint32_t pos) override { return _inner.seek(pos); };
+    uint32_t position() override { return _inner.position(); };
+    uint32_t size() override { return _inner.size(); };
+    bool truncate(uint32_t size) override { return truncateInner(_inner, size, 0); };
+
+    size_t write(uint8_t b) override { return _inner.write(b); };
+    int availableForWrite() override { return _inner.availableForWrite(); };
+    int available() override { return _inner.available(); };
+    int read() override { return _inner.read(); };
+    int peek() override { return _inner.peek(); };
+    void flush() override { _inner.flush(); };
+
+  private:
+    T& _inner;
+
+    /*
+     * Calls T::truncate if it has one (such as the File classes of SdFat
+     * and the ESP8266 LittleFS), otherwise returns false
+     */
+    template <typename U>
+    static auto truncateInner(U& inner, uint32_t size, int) -> decltype(inner.truncate(size), bool()) {
+      return inner.truncate(size);
+    };
+    template <typename U>
+    static bool truncateInner(U&, uint32_t, long) { return false; };
+
+};
+
+/*
+ * A read-only view of length bytes of a SeekableStream, starting at offset.
+ * Since available() drops to 0 at the end of the range, StreamableManager::load
+ * stops there instead of reading on into the next record.
+ */
+class BoundedStream: public Stream {
+
+  public:
+    BoundedStream(SeekableStream* src, uint32_t offset, uint32_t length): _src(src) {
+      _remaining = src->seek(offset) ? length : 0;
+    };
+
+    size_t write(uint8_t) override { return 0; }; // read-only
+    int available() override {
+      int n = _src->available();
+      return (static_cast<uint32_t>(n) < _remaining) ? n : _remaining;
+    };
+    int read() override {
+      if (_remaining == 0) return -1;
+      _remaining--;
+      return _src->read();
+    };
+    int peek() override { return _remaining > 0 ? _src->peek() : -1; };
+
+  private:
+    SeekableStream* _src;
+    uint32_t _remaining;
+
+};
+
+
+#endif
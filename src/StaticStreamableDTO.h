@@ -0,0 +1,177 @@
+/*
+
+  StaticStreamableDTO.h
+
+  Fixed-capacity StreamableDTO that never allocates from the heap
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StaticStreamableDTO_h
+#define _strdto_StaticStreamableDTO_h
+
+
+#include <Arduino.h>
+#include "StreamableDTO.h"
+
+/*
+ * A StreamableDTO whose buckets, entries and RAM strings all live inside the
+ * object itself, so memory use is fixed at compile time and the heap is never
+ * touched. It has the same API as StreamableDTO and works with
+ * StreamableManager unchanged.
+ *
+ * Instead of allocating, put() returns false once MaxEntries entries exist or
+ * there is no room left in the PoolBytes string pool. Strings released by an
+ * update or remove() leave holes in the pool, which are reclaimed by
+ * compacting the pool the next time it fills up.
+ *
+ * Keys and values in PROGMEM don't use any pool space. Lazy loading is not
+ * supported, since it needs a growable raw buffer.
+ *
+ * Subclass it the same way as StreamableDTO to create a typed DTO:
+ *
+ *   class Book: public StaticStreamableDTO<8, 128> { ... };
+ */
+template <uint16_t MaxEntries, uint16_t PoolBytes>
+class StaticStreamableDTO: public StreamableDTO {
+
+  public:
+    StaticStreamableDTO(): StreamableDTO(_buckets, MaxEntries) {
+      for (int i = MaxEntries - 1; i >= 0; i--) {
+        _entries[i].next = _freeEntries;
+        _freeEntries = &_entries[i];
+      }
+    };
+
+    virtual ~StaticStreamableDTO() {
+      clear(); // release entries while the storage hooks below still apply
+    };
+
+    /*
+     * Bytes of the string pool in use, including holes that have not been
+     * compacted yet
+     */
+    const uint16_t getPoolBytesUsed() const { return _poolUsed; };
+
+    void setLazyLoad(bool lazyLoad) = delete;
+
+    // Disable moving and copying, since the table lives inside the object
+    StaticStreamableDTO(StaticStreamableDTO&& other) = delete;
+    StaticStreamableDTO& operator=(StaticStreamableDTO&& other) = delete;
+    StaticStreamableDTO(const StaticStreamableDTO&) = delete;
+    StaticStreamableDTO& operator=(const StaticStreamableDTO&) = delete;
+
+
+  protected:
+    Entry* newEntry() override {
+      Entry* entry = _freeEntries;
+      if (entry) {
+        _freeEntries = entry->next;
+        entry->next = nullptr;
+      }
+      return entry;
+    };
+
+    void deleteEntry(Entry* entry) override {
+      entry->next = _freeEntries;
+      _freeEntries = entry;
+    };
+
+    char* newString(const char* str) override {
+      return newBytes(str, strlen(str));
+    };
+
+    char* newBytes(const char* data, size_t length) override {
+      // put() never passes a string from the pool (see ownsString), so data
+      // doesn't move if the pool is compacted
+      if (_poolUsed + length + 1 > PoolBytes) compact();
+      return append(data, length);
+    };
+
+    void deleteString(char* str) override {
+      deleteBytes(str, strlen(str));
+    };
+
+    void deleteBytes(char* data, size_t length) override {
+      if (data + length + 1 == _pool + _poolUsed) {
+        _poolUsed -= length + 1; // most recent allocation, so reclaim it right away
+      }
+    };
+
+    bool ownsString(const char* str) const override {
+      return inPool(str);
+    };
+
+
+  private:
+    Entry* _buckets[MaxEntries];
+    Entry _entries[MaxEntries];
+    Entry* _freeEntries = nullptr;
+    char _pool[PoolBytes];
+    uint16_t _poolUsed = 0;
+
+    bool inPool(const char* str) const {
+      return str >= _pool && str < _pool + PoolBytes;
+    };
+
+    /*
+     * Copies length bytes and a null terminator into the pool
+     */
+    char* append(const char* data, size_t length) {
+      if (_poolUsed + length + 1 > PoolBytes) {
+#if defined(DEBUG)
+        Serial.println(F("StaticStreamableDTO: string pool full"));
+#endif
+        return nullptr;
+      }
+      char* out = _pool + _poolUsed;
+      memcpy(out, data, length);
+      out[length] = '\0';
+      _poolUsed += length + 1;
+      return out;
+    };
+
+    /*
+     * Slides all the live strings down to the start of the pool, closing the
+     * holes left by deleteString. Live strings are found by walking the entry
+     * array (which also covers an entry that is still being built by put), and
+     * their owners are repointed as they move. Values are moved by their
+     * stored length, since they may contain null bytes.
+     */
+    void compact() {
+      struct Live {
+        char** str;
+        size_t bytes;
+      };
+      Live live[MaxEntries * 2];
+      uint16_t n = 0;
+      for (uint16_t i = 0; i < MaxEntries; i++) {
+        Entry& e = _entries[i];
+        if (e.key && !e.keyPmem && inPool(e.key)) live[n++] = { const_cast<char**>(&e.key), strlen(e.key) + 1 };
+        if (e.value && !e.valPmem && inPool(e.value)) live[n++] = { &e.value, e.valueLength + 1 };
+      }
+      // Sort by address so that moving a string never overwrites one not yet moved
+      for (uint16_t i = 1; i < n; i++) {
+        Live s = live[i];
+        uint16_t j = i;
+        while (j > 0 && *live[j - 1].str > *s.str) {
+          live[j] = live[j - 1];
+          j--;
+        }
+        live[j] = s;
+      }
+      uint16_t used = 0;
+      for (uint16_t i = 0; i < n; i++) {
+        memmove(_pool + used, *live[i].str, live[i].bytes);
+        *live[i].str = _pool + used;
+        used += live[i].bytes;
+      }
+      _poolUsed = used;
+    };
+
+};
+
+
+#endif
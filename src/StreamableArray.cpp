@@ -0,0 +1,134 @@
+#include "StreamableArray.h"
+
+StreamableArrayBase::~StreamableArrayBase() {
+  if (_data) free(_data);
+}
+
+bool StreamableArrayBase::reserve(uint16_t n) {
+  if (n <= _capacity) return true;
+  uint8_t* newData = static_cast<uint8_t*>(realloc(_data, static_cast<size_t>(n) * _elementBytes));
+  if (!newData) return false;
+  _data = newData;
+  _capacity = n;
+  return true;
+}
+
+size_t StreamableArrayBase::writeTo(Print* dest) const {
+  size_t written = dest->write(static_cast<uint8_t>(_size & 0xFF));
+  written += dest->write(static_cast<uint8_t>(_size >> 8));
+  return written + dest->write(_data, static_cast<size_t>(_size) * _elementBytes);
+}
+
+bool StreamableArrayBase::readFrom(Stream* src) {
+  _size = 0;
+  int lo = src->read();
+  int hi = src->read();
+  if (lo < 0 || hi < 0) return false;
+  uint16_t count = lo | (hi << 8);
+  if (!reserve(count)) return false;
+  size_t bytes = static_cast<size_t>(count) * _elementBytes;
+  for (size_t i = 0; i < bytes; i++) {
+    int c = src->read();
+    if (c < 0) return false;
+    _data[i] = c;
+  }
+  _size = count;
+  return true;
+}
+
+bool StreamableArrayBase::appendText(const char* text) {
+  if (_size == _capacity && !reserve(_capacity ? _capacity * 2 : 8)) return false;
+  uint8_t* element = _data + static_cast<size_t>(_size) * _elementBytes;
+  if (_kind == FLOAT) {
+    float value = strtod(text, nullptr);
+    memcpy(element, &value, sizeof(value));
+  } else {
+    // Narrowed to the element size, keeping the low bytes (little-endian)
+    uint32_t value = (_kind == SIGNED) ? static_cast<uint32_t>(strtol(text, nullptr, 10))
+                                       : strtoul(text, nullptr, 10);
+    memcpy(element, &value, _elementBytes);
+  }
+  _size++;
+  return true;
+}
+
+uint32_t StreamableArrayBase::fingerprint() const {
+  // FNV-1a over "key[]=" and the raw elements
+  uint32_t h = 2166136261UL;
+  for (const char* p = _key; *p; p++) {
+    h = (h ^ static_cast<uint8_t>(*p)) * 16777619UL;
+  }
+  h = (h ^ '[') * 16777619UL;
+  h = (h ^ ']') * 16777619UL;
+  h = (h ^ '=') * 16777619UL;
+  size_t bytes = static_cast<size_t>(_size) * _elementBytes;
+  for (size_t i = 0; i < bytes; i++) {
+    h = (h ^ _data[i]) * 16777619UL;
+  }
+  return h;
+}
+
+void StreamableArrayBase::elementText(uint16_t i, char* buffer) const {
+  const uint8_t* element = _data + static_cast<size_t>(i) * _elementBytes;
+  if (_kind == FLOAT) {
+    float value;
+    memcpy(&value, element, sizeof(value));
+#if defined(__AVR__)
+    dtostre(value, buffer, 8, 0); // AVR's snprintf has no %g
+#else
+    // The shortest of these that reads back as the same float
+    snprintf(buffer, MAX_ELEMENT_CHARS, "%.7g", value);
+    if (static_cast<float>(strtod(buffer, nullptr)) != value) {
+      snprintf(buffer, MAX_ELEMENT_CHARS, "%.9g", value);
+    }
+#endif
+    return;
+  }
+  uint32_t value = 0;
+  memcpy(&value, element, _elementBytes);
+  if (_kind == SIGNED) {
+    // Sign-extend from the element size
+    uint8_t shift = 32 - 8 * _elementBytes;
+    int32_t signedValue = static_cast<int32_t>(value << shift) >> shift;
+    if (signedValue < 0) {
+      *buffer++ = '-';
+      value = 0 - static_cast<uint32_t>(signedValue);
+    } else {
+      value = signedValue;
+    }
+  }
+  // Digits are generated backwards, which is cheaper than snprintf per element
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (n > 0) *buffer++ = digits[--n];
+  *buffer = '\0';
+}
+
+bool StreamableArrayBase::matches(const StreamableArrayBase& other) const {
+  return _elementBytes == other._elementBytes && _kind == other._kind && strcmp(_key, other._key) == 0;
+}
+
+bool StreamableArrayBase::copyFrom(const StreamableArrayBase& other) {
+  _size = 0;
+  if (other._size == 0) return true;
+  if (!reserve(other._size)) return false;
+  memcpy(_data, other._data, static_cast<size_t>(other._size) * _elementBytes);
+  _size = other._size;
+  return true;
+}
+
+void StreamableArrayBase::swapElements(StreamableArrayBase& other) {
+  uint8_t* data = _data;
+  uint16_t size = _size;
+  uint16_t capacity = _capacity;
+  _data = other._data;
+  _size = other._size;
+  _capacity = other._capacity;
+  other._data = data;
+  other._size = size;
+  other._capacity = capacity;
+}
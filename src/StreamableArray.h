@@ -0,0 +1,169 @@
+/*
+
+  StreamableArray.h
+
+  Repeated numeric fields for StreamableDTOs
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableArray_h
+#define _strdto_StreamableArray_h
+
+
+#include <Arduino.h>
+
+/*
+ * The untyped part of a StreamableArray: a growable, contiguous buffer of
+ * fixed-size elements, and the text and binary forms of the elements.
+ */
+class StreamableArrayBase {
+
+  public:
+    enum ElementKind : uint8_t { SIGNED, UNSIGNED, FLOAT };
+
+    /*
+     * Longest text form of an element, including the null terminator
+     */
+    static const uint8_t MAX_ELEMENT_CHARS = 16;
+
+    const char* getKey() const { return _key; };
+    uint16_t size() const { return _size; };
+    void clear() { _size = 0; };
+
+    /*
+     * Makes room for n elements without growing again. Returns false if out
+     * of memory.
+     */
+    bool reserve(uint16_t n);
+
+    /*
+     * Binary form: the element count (2 bytes), then the elements as stored,
+     * in the board's byte order (little-endian on Arduino boards). Both sides
+     * must use the same element type. readFrom returns false if the stream
+     * ended early or there's not enough memory, and leaves the array empty.
+     */
+    size_t writeTo(Print* dest) const;
+    bool readFrom(Stream* src);
+
+    virtual ~StreamableArrayBase();
+
+    // Disable moving and copying
+    StreamableArrayBase(StreamableArrayBase&& other) = delete;
+    StreamableArrayBase& operator=(StreamableArrayBase&& other) = delete;
+    StreamableArrayBase(const StreamableArrayBase&) = delete;
+    StreamableArrayBase& operator=(const StreamableArrayBase&) = delete;
+
+  protected:
+    StreamableArrayBase(const char* key, uint8_t elementBytes, ElementKind kind):
+          _key(key), _elementBytes(elementBytes), _kind(kind) {};
+
+    uint8_t* _data = nullptr;
+    uint16_t _size = 0;
+    uint16_t _capacity = 0;
+
+  private:
+    friend class StreamableDTO;
+    friend class StreamableManager;
+
+    const char* _key;
+    uint8_t _elementBytes;
+    ElementKind _kind;
+    StreamableArrayBase* _next = nullptr; // next array of the same DTO
+
+    /*
+     * Parses the text form of one element and appends it. Returns false if
+     * out of memory.
+     */
+    bool appendText(const char* text);
+
+    /*
+     * Writes the text form of element i into buffer, which must hold
+     * MAX_ELEMENT_CHARS
+     */
+    void elementText(uint16_t i, char* buffer) const;
+
+    /*
+     * A hash of the key and the elements as stored, for
+     * StreamableDTO::getFingerprint
+     */
+    uint32_t fingerprint() const;
+
+    /*
+     * Whether other has the same key and element type, so its elements can
+     * be copied or swapped in
+     */
+    bool matches(const StreamableArrayBase& other) const;
+
+    /*
+     * Replaces the elements with a copy of other's. Returns false if out of
+     * memory, and leaves the array empty.
+     */
+    bool copyFrom(const StreamableArrayBase& other);
+
+    /*
+     * Trades elements with other, without copying them
+     */
+    void swapElements(StreamableArrayBase& other);
+
+};
+
+template <typename T> struct StreamableArrayKind;
+template <> struct StreamableArrayKind<int8_t>   { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::SIGNED; };
+template <> struct StreamableArrayKind<int16_t>  { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::SIGNED; };
+template <> struct StreamableArrayKind<int32_t>  { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::SIGNED; };
+template <> struct StreamableArrayKind<uint8_t>  { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::UNSIGNED; };
+template <> struct StreamableArrayKind<uint16_t> { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::UNSIGNED; };
+template <> struct StreamableArrayKind<uint32_t> { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::UNSIGNED; };
+template <> struct StreamableArrayKind<float>    { static const StreamableArrayBase::ElementKind KIND = StreamableArrayBase::FLOAT; };
+
+/*
+ * A repeated field, such as a buffer of samples or per-channel
+ * calibrations, kept as a contiguous array of T (a fixed-width integer
+ * type, or float) instead of one delimited string. Attach it to a DTO
+ * with StreamableDTO::addArray, and StreamableManager sends it as a
+ * "key[]=1,2,3" line, writing and reading one element at a time, so the
+ * array isn't limited by the manager's buffer size.
+ *
+ *   StreamableArray<int16_t> samples("samples");
+ *   dto.addArray(&samples);
+ *   samples.append(512);
+ *   int16_t first = samples[0];
+ */
+template <typename T>
+class StreamableArray: public StreamableArrayBase {
+
+  public:
+    StreamableArray(const char* key): StreamableArrayBase(key, sizeof(T), StreamableArrayKind<T>::KIND) {};
+
+    T& operator[](uint16_t i) { return data()[i]; };
+    const T& operator[](uint16_t i) const { return data()[i]; };
+    T* data() { return reinterpret_cast<T*>(_data); };
+    const T* data() const { return reinterpret_cast<const T*>(_data); };
+
+    /*
+     * Returns false if out of memory
+     */
+    bool append(T value) {
+      if (_size == _capacity && !reserve(_capacity ? _capacity * 2 : 8)) return false;
+      data()[_size++] = value;
+      return true;
+    };
+
+    /*
+     * Replaces the elements with a copy of count values. Returns false if out
+     * of memory.
+     */
+    bool set(const T* values, uint16_t count) {
+      if (!reserve(count)) return false;
+      memcpy(_data, values, count * sizeof(T));
+      _size = count;
+      return true;
+    };
+
+};
+
+
+#endif
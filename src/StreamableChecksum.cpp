@@ -0,0 +1,38 @@
+#include "StreamableChecksum.h"
+
+void StreamableChecksum::reset() {
+  _crc = (_type == CRC16) ? 0xFFFF : 0xFFFFFFFF;
+}
+
+void StreamableChecksum::update(uint8_t b) {
+  if (_type == CRC16) {
+    uint16_t crc = _crc ^ (static_cast<uint16_t>(b) << 8);
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    _crc = crc;
+  } else if (_type == CRC32) {
+    uint32_t crc = _crc ^ b;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+    }
+    _crc = crc;
+  }
+}
+
+uint32_t StreamableChecksum::value() const {
+  switch (_type) {
+    case CRC16: return _crc & 0xFFFF;
+    case CRC32: return _crc ^ 0xFFFFFFFF;
+    default:    return 0;
+  }
+}
+
+void StreamableChecksum::toHex(uint32_t value, char* buffer) {
+  static const char format[] PROGMEM = "%lx";
+  snprintf_P(buffer, 9, format, static_cast<unsigned long>(value));
+}
+
+uint32_t StreamableChecksum::fromHex(const char* hex) {
+  return strtoul(hex, nullptr, 16);
+}
@@ -0,0 +1,56 @@
+/*
+
+  StreamableChecksum.h
+
+  Running CRC-16 or CRC-32 over the bytes of a serialized DTO
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableChecksum_h
+#define _strdto_StreamableChecksum_h
+
+
+#include <Arduino.h>
+
+/*
+ * A checksum that is updated one byte at a time as data is written or read,
+ * so it never needs a second pass over the data. StreamableManager uses it to
+ * append and verify a "__crc=<hex>" trailer line (see setChecksum).
+ *
+ *   CRC16 is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+ *   CRC32 is the standard reflected CRC-32 (poly 0xEDB88320) used by zip/ethernet
+ */
+class StreamableChecksum {
+
+  public:
+    enum Type : uint8_t {
+      NONE = 0,
+      CRC16,
+      CRC32
+    };
+
+    StreamableChecksum(Type type = NONE): _type(type) { reset(); };
+
+    void reset();
+    void update(uint8_t b);
+    uint32_t value() const;
+    Type getType() const { return _type; };
+
+    /*
+     * Formats/parses the value as lowercase hex, as used in the trailer line.
+     * The buffer must hold at least 9 chars.
+     */
+    static void toHex(uint32_t value, char* buffer);
+    static uint32_t fromHex(const char* hex);
+
+  private:
+    Type _type;
+    uint32_t _crc;
+
+};
+
+
+#endif
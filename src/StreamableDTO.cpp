@@ -1,4 +1,7 @@
 #include "StreamableDTO.h"
+#include "StreamableArray.h"
+#include "StreamableKeyPool.h"
+#include "StreamableScanner.h"
 
 StreamableDTO::StreamableDTO() : _tableSize(INITIAL_TABLE_SIZE), _count(0) {
   _table = new Entry*[_tableSize]();
@@ -9,30 +12,256 @@ StreamableDTO::StreamableDTO(size_t initialCapacity, float loadFactor = 0.7)
   _table = new Entry*[_tableSize]();
 }
 
+StreamableDTO::StreamableDTO(Entry** buckets, int tableSize)
+    : _table(buckets), _tableSize(tableSize), _count(0), _fixedTable(true) {
+  for (int i = 0; i < _tableSize; i++) _table[i] = nullptr;
+}
+
  StreamableDTO::~StreamableDTO() {
-  clear();
-  delete[] _table;
+  if (_shared && *_shared > 1) {
+    (*_shared)--; // the entries still belong to the other DTOs sharing them
+    clearRaw();
+  } else {
+    clear();
+    if (!_fixedTable) delete[] _table;
+    if (_oldTable) delete[] _oldTable;
+  }
+  if (_sortedEntries) free(_sortedEntries);
 }
 
-StreamableDTO::Entry::Entry(const char* k, const char* v, bool keyPmem, bool valPmem):
-    key(nullptr), value(nullptr), next(nullptr), keyPmem(keyPmem), valPmem(valPmem) {
-  key = keyPmem ? k : strdup(k);
-  value = valPmem ? v : strdup(v);
+StreamableDTO::StreamableDTO(StreamableDTO&& other): _table(nullptr), _tableSize(0), _count(0) {
+  *this = static_cast<StreamableDTO&&>(other);
 }
 
-StreamableDTO::Entry::~Entry() {
-  if (key && !keyPmem) free(key); // strdup'ed char* requires free, not delete
-  if (value && !valPmem) free(value);
-};
+StreamableDTO& StreamableDTO::operator=(StreamableDTO&& other) {
+  if (this == &other) return *this;
+  if (_fixedTable || other._fixedTable) {
+    other.cloneEntriesInto(this);
+  } else {
+    clearRaw();
+    releaseTable();
+    swapWith(other);
+  }
+  // Each DTO keeps its own arrays, so their elements are traded instead
+  bool match = arraysMatch(other);
+  StreamableArrayBase* from = other._arrays;
+  for (StreamableArrayBase* array = _arrays; array; array = array->_next) {
+    if (match) {
+      array->swapElements(*from);
+      from = from->_next;
+    } else {
+      array->clear();
+    }
+  }
+  other.clear(); // other has no table now, unless it's fixed, so this only empties its arrays
+  return *this;
+}
 
-int StreamableDTO::hash(const char* key, bool pmem = false) {
+bool StreamableDTO::arraysMatch(const StreamableDTO& other) const {
+  const StreamableArrayBase* a = _arrays;
+  const StreamableArrayBase* b = other._arrays;
+  for (; a && b; a = a->_next, b = b->_next) {
+    if (!a->matches(*b)) return false;
+  }
+  return !a && !b;
+}
+
+template <typename T>
+static void swapValues(T& a, T& b) {
+  T t = a;
+  a = b;
+  b = t;
+}
+
+void StreamableDTO::swapWith(StreamableDTO& other) {
+  swapValues(_table, other._table);
+  swapValues(_tableSize, other._tableSize);
+  swapValues(_count, other._count);
+  swapValues(_loadFactorThreshold, other._loadFactorThreshold);
+  swapValues(_deserializedVer, other._deserializedVer);
+  swapValues(_internKeys, other._internKeys);
+  swapValues(_fingerprint, other._fingerprint);
+  swapValues(_oldTable, other._oldTable);
+  swapValues(_oldTableSize, other._oldTableSize);
+  swapValues(_rehashIndex, other._rehashIndex);
+  swapValues(_autoShrink, other._autoShrink);
+#if defined(STRDTO_STATS)
+  swapValues(_resizeCount, other._resizeCount);
+#endif
+  swapValues(_lazyLoad, other._lazyLoad);
+  swapValues(_rawBuffer, other._rawBuffer);
+  swapValues(_rawBytes, other._rawBytes);
+  swapValues(_rawCapacity, other._rawCapacity);
+  swapValues(_rawOffsets, other._rawOffsets);
+  swapValues(_rawLineCount, other._rawLineCount);
+  swapValues(_rawLineCapacity, other._rawLineCapacity);
+  swapValues(_rawFirstLineNumber, other._rawFirstLineNumber);
+  swapValues(_rawPending, other._rawPending);
+  swapValues(_sortedEntries, other._sortedEntries);
+  swapValues(_sortedCapacity, other._sortedCapacity);
+  swapValues(_sortedValid, other._sortedValid);
+  swapValues(_shared, other._shared);
+}
+
+bool StreamableDTO::cloneInto(StreamableDTO* target) {
+  if (target == this) return true;
+  if (!arraysMatch(*target)) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: cloneInto target doesn't have the same arrays"));
+#endif
+    return false;
+  }
+  if (!cloneEntriesInto(target)) return false;
+  StreamableArrayBase* to = target->_arrays;
+  for (StreamableArrayBase* array = _arrays; array; array = array->_next, to = to->_next) {
+    if (!to->copyFrom(*array)) return false;
+  }
+  return true;
+}
+
+bool StreamableDTO::cloneEntriesInto(StreamableDTO* target) {
+  if (!target->clear()) return false;
+  if (_rawPending > 0) {
+    materializeAll();
+  }
+  rehashStep(_oldTableSize); // so nothing moves while shared
+  target->_deserializedVer = _deserializedVer;
+  if (!_table) return true; // nothing to share
+  if (!_fixedTable && !target->_fixedTable && !_shared) {
+    _shared = new uint16_t(1);
+  }
+  if (_fixedTable || target->_fixedTable || !_shared || *_shared == 0xFFFF) {
+    return forEachTableEntry([&](const EntryView& e) -> bool {
+      return target->putCopy(e);
+    });
+  }
+  delete[] target->_table;
+  target->_table = _table;
+  target->_tableSize = _tableSize;
+  target->_count = _count;
+  target->_fingerprint = _fingerprint;
+  target->_shared = _shared;
+  (*_shared)++;
+  return true;
+}
+
+bool StreamableDTO::unshare() {
+  if (!_shared) return true;
+  if (*_shared == 1) {
+    // The others are gone, so the entries are all ours
+    delete _shared;
+    _shared = nullptr;
+    return true;
+  }
+  Entry** shared = _table;
+  int sharedSize = _tableSize;
+  Entry** own = new Entry*[sharedSize]();
+  if (!own) return false;
+  (*_shared)--;
+  _shared = nullptr;
+  _table = own;
+  _count = 0;
+  _fingerprint = 0;
+  _sortedValid = false;
+  for (int i = 0; i < sharedSize; i++) {
+    for (Entry* entry = shared[i]; entry != nullptr; entry = entry->next) {
+      if (!putCopy(EntryView(entry->key, entry->value, entry->keyPmem, entry->valPmem, entry->valueLength))) return false;
+    }
+  }
+  return true;
+}
+
+StreamableDTO::Entry::Entry(const char* k = nullptr, const char* v = nullptr, bool keyPmem = false, bool valPmem = false):
+    key(k), value(const_cast<char*>(v)), next(nullptr), keyPmem(keyPmem), valPmem(valPmem) {}
+
+StreamableDTO::Entry* StreamableDTO::newEntry() {
+  return new Entry();
+}
+
+void StreamableDTO::deleteEntry(Entry* entry) {
+  delete entry;
+}
+
+char* StreamableDTO::newString(const char* str) {
+  return strdup(str);
+}
+
+char* StreamableDTO::newBytes(const char* data, size_t length) {
+  char* copy = static_cast<char*>(malloc(length + 1));
+  if (copy) {
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+void StreamableDTO::deleteString(char* str) {
+  free(str); // strdup'ed char* requires free, not delete
+}
+
+void StreamableDTO::deleteBytes(char* data, size_t) {
+  deleteString(data);
+}
+
+void StreamableDTO::releaseEntry(Entry* entry) {
+  if (entry->key && !entry->keyPmem) {
+    if (entry->keyInterned) {
+      StreamableKeyPool::shared().release(entry->key);
+    } else {
+      deleteString(const_cast<char*>(entry->key));
+    }
+  }
+  if (entry->value && !entry->valPmem) deleteBytes(entry->value, entry->valueLength);
+  entry->key = nullptr;
+  entry->value = nullptr;
+  deleteEntry(entry);
+}
+
+unsigned long StreamableDTO::hashCode(const char* key, bool pmem = false) const {
   unsigned long h = 0;
   size_t length = pmem ? strlen_P(key) : strlen(key);
   for (size_t i = 0; i < length; i++) {
     char c = pmem ? pgm_read_byte(key + i) : key[i];
     h = 31 * h + c;
   }
-  return h % _tableSize;
+  return h;
+}
+
+uint32_t StreamableDTO::entryFingerprint(const char* key, bool keyPmem, const char* value, size_t valueLength, bool valPmem) {
+  // FNV-1a over "key=value"
+  uint32_t h = 2166136261UL;
+  for (const char* p = key; ; p++) {
+    char c = keyPmem ? pgm_read_byte(p) : *p;
+    if (!c) break;
+    h = (h ^ static_cast<uint8_t>(c)) * 16777619UL;
+  }
+  h = (h ^ '=') * 16777619UL;
+  for (const char* p = value; p < value + valueLength; p++) {
+    char c = valPmem ? pgm_read_byte(p) : *p;
+    h = (h ^ static_cast<uint8_t>(c)) * 16777619UL;
+  }
+  return h;
+}
+
+uint32_t StreamableDTO::getFingerprint() const {
+  uint32_t fingerprint = _fingerprint;
+  for (uint16_t i = 0; i < _rawLineCount && _rawPending > 0; i++) {
+    if (_rawOffsets[i] == RAW_CONSUMED) continue;
+    const char* line = _rawBuffer + _rawOffsets[i];
+    char buf[strlen(line) + 1];
+    strcpy(buf, line);
+    const char* value = splitRawLine(buf);
+    fingerprint += entryFingerprint(buf, false, value, strlen(value), false);
+  }
+  // Arrays are changed in place, so they're hashed when this is called
+  for (StreamableArrayBase* array = _arrays; array; array = array->_next) {
+    fingerprint += array->fingerprint();
+  }
+  return fingerprint;
+}
+
+int StreamableDTO::hash(const char* key, bool pmem = false) {
+  return _tableSize ? hashCode(key, pmem) % _tableSize : 0;
 }
 
 int StreamableDTO::hash(const __FlashStringHelper* key) {
@@ -68,8 +297,9 @@ bool StreamableDTO::keyMatches(const char* key, const Entry* entry, bool keyPmem
       // key in regular memory, entry->key in PROGMEM
       keysMatch = (strcmp_P(key, entry->key) == 0);
     } else {
-      // key and entry->key are both in regular memory
-      keysMatch = (strcmp(entry->key, key) == 0);
+      // key and entry->key are both in regular memory. The same pointer is
+      // common with interned keys (see setInternKeys).
+      keysMatch = (entry->key == key) || (strcmp(entry->key, key) == 0);
     }
   }
   return keysMatch;
@@ -80,42 +310,163 @@ bool StreamableDTO::keyMatches(const __FlashStringHelper* key, const Entry* entr
 }
 
 bool StreamableDTO::resize(int newSize) {
+  if (_oldTable) {
+    rehashStep(_oldTableSize); // finish the rehash already in progress
+  }
   Entry** newTable = new Entry*[newSize]();
   if (!newTable) {
     return false;
   }
-  for (int i = 0; i < _tableSize; ++i) {
-    Entry* entry = _table[i];
+#if defined(STRDTO_STATS)
+  _resizeCount++;
+#endif
+  _oldTable = _table;
+  _oldTableSize = _tableSize;
+  _rehashIndex = 0;
+  _table = newTable;
+  _tableSize = newSize;
+  return true;
+}
+
+void StreamableDTO::rehashStep(int buckets) {
+  while (_oldTable && buckets-- > 0) {
+    Entry* entry = _oldTable[_rehashIndex];
     while (entry) {
       Entry* next = entry->next;
-      int index = hash(entry->key, entry->keyPmem) % newSize;
-      entry->next = newTable[index];
-      newTable[index] = entry;
+      int index = hashCode(entry->key, entry->keyPmem) % _tableSize;
+      entry->next = _table[index];
+      _table[index] = entry;
       entry = next;
     }
+    _oldTable[_rehashIndex++] = nullptr;
+    if (_rehashIndex >= _oldTableSize) {
+      delete[] _oldTable;
+      _oldTable = nullptr;
+      _oldTableSize = 0;
+      _rehashIndex = 0;
+    }
   }
-  delete[] _table;
-  _table = newTable;
-  _tableSize = newSize;
+}
+
+bool StreamableDTO::ensureTable() {
+  if (_table) return true;
+  _table = new Entry*[INITIAL_TABLE_SIZE]();
+  if (!_table) return false;
+  _tableSize = INITIAL_TABLE_SIZE;
   return true;
 }
 
-bool StreamableDTO::isCompatibleTypeAndVersion(MetaInfo* meta) {
-  if (getTypeId() != meta->typeId) {
+void StreamableDTO::releaseTable() {
+  if (_shared && *_shared > 1) {
+    (*_shared)--; // the entries still belong to the other DTOs sharing them
+  } else {
+    unshare();
+    for (int t = 0; t < 2; t++) {
+      Entry** table = t ? _oldTable : _table;
+      int tableSize = t ? _oldTableSize : _tableSize;
+      for (int i = 0; table && i < tableSize; ++i) {
+        Entry* entry = table[i];
+        while (entry != nullptr) {
+          Entry* toDelete = entry;
+          entry = entry->next;
+          releaseEntry(toDelete);
+        }
+      }
+    }
+    if (_table) delete[] _table;
+    if (_oldTable) delete[] _oldTable;
+    _oldTable = nullptr;
+    _oldTableSize = 0;
+    _rehashIndex = 0;
+  }
+  _shared = nullptr;
+  _table = nullptr;
+  _tableSize = 0;
+  _count = 0;
+  _sortedValid = false;
+  _fingerprint = 0;
+}
+
+StreamableDTO::Entry** StreamableDTO::findLink(const char* key, bool keyPmem, unsigned long h) {
+  if (!_table) return nullptr;
+  Entry** link = &_table[h % _tableSize];
+  for (; *link != nullptr; link = &(*link)->next) {
+    if (keyMatches(key, *link, keyPmem)) return link;
+  }
+  if (_oldTable) {
+    link = &_oldTable[h % _oldTableSize];
+    for (; *link != nullptr; link = &(*link)->next) {
+      if (keyMatches(key, *link, keyPmem)) return link;
+    }
+  }
+  return nullptr;
+}
+
+bool StreamableDTO::reserve(size_t n) {
+  if (_fixedTable) return false;
+  if (_shared && !unshare()) return false;
+  if (!ensureTable()) return false;
+  int newSize = _tableSize;
+  while (static_cast<float>(n) / newSize > _loadFactorThreshold) newSize *= 2;
+  if (newSize == _tableSize) return true;
+  if (!resize(newSize)) return false;
+  rehashStep(_oldTableSize); // explicit request, so don't spread the work out
+  return true;
+}
+
+#if defined(STRDTO_STATS)
+void StreamableDTO::getStats(HashtableStats& stats) const {
+  memset(&stats, 0, sizeof(stats));
+  stats.entryCount = _count;
+  stats.bucketCount = _tableSize;
+  stats.resizeCount = _resizeCount;
+  stats.rehashing = (_oldTable != nullptr);
+  stats.rawBytes = _rawCapacity + _rawLineCapacity * sizeof(uint16_t);
+  stats.entryBytes = _count * sizeof(Entry) + (_tableSize + _oldTableSize) * sizeof(Entry*);
+  for (int t = 0; t < 2; t++) {
+    Entry** table = t ? _oldTable : _table;
+    int tableSize = t ? _oldTableSize : _tableSize;
+    for (int i = 0; table && i < tableSize; i++) {
+      uint16_t chain = 0;
+      for (Entry* entry = table[i]; entry != nullptr; entry = entry->next) {
+        chain++;
+        if (entry->keyPmem) {
+          stats.pmemKeys++;
+        } else if (entry->keyInterned) {
+          stats.internedKeys++;
+        } else {
+          stats.keyBytes += strlen(entry->key) + 1;
+        }
+        if (entry->valPmem) {
+          stats.pmemValues++;
+        } else {
+          stats.valueBytes += entry->valueLength + 1;
+        }
+      }
+      if (chain > stats.longestChain) stats.longestChain = chain;
+      uint8_t bin = chain < HashtableStats::CHAIN_HISTOGRAM_BINS ? chain : HashtableStats::CHAIN_HISTOGRAM_BINS - 1;
+      stats.chainLengths[bin]++;
+    }
+  }
+}
+#endif
+
+bool StreamableDTO::isCompatibleTypeAndVersion(const MetaInfo& meta) {
+  if (getTypeId() != meta.typeId) {
 #if defined(DEBUG)
     Serial.print(F("ERROR: Type mismatch! Can't load DTO typeId="));
-    Serial.print(meta->typeId);
+    Serial.print(meta.typeId);
     Serial.print(F(" into typeId="));
     Serial.println(getTypeId());
 #endif
     return false;
   }
-  if (getMinCompatVersion() > meta->serialVersion) {
+  if (getMinCompatVersion() > meta.serialVersion) {
 #if defined(DEBUG)
     Serial.print(F("ERROR: Incompatible version for DTO typeId="));
     Serial.print(getTypeId());
     Serial.print(F(", have DTO v"));
-    Serial.print(meta->serialVersion);
+    Serial.print(meta.serialVersion);
     Serial.print(F(" but require >=v"));
     Serial.println(getMinCompatVersion());
 #endif
@@ -125,27 +476,90 @@ bool StreamableDTO::isCompatibleTypeAndVersion(MetaInfo* meta) {
 }
 
 bool StreamableDTO::put(const char* key, const char* value, bool keyPmem = false, bool valPmem = false) {
-  int index = hash(key, keyPmem);
-  Entry* entry = _table[index];
-  while (entry != nullptr) {
-    if (keyMatches(key, entry, keyPmem)) {
-      if (!entry->valPmem) free(entry->value); // strdup'ed char* requires free not delete
-      if (valPmem) {
-        entry->value = value;
-      } else {
-        entry->value = strdup(value);
-      }
-      entry->valPmem = valPmem;
-      return true;
-    }
-    entry = entry->next;
+  return putValue(key, value, valPmem ? strlen_P(value) : strlen(value), keyPmem, valPmem, true);
+}
+
+bool StreamableDTO::putBytes(const char* key, const char* value, size_t length, bool keyPmem = false, bool valPmem = false) {
+  return putValue(key, value, length, keyPmem, valPmem, false);
+}
+
+bool StreamableDTO::putBytes(const __FlashStringHelper* key, const char* value, size_t length, bool valPmem = false) {
+  return putValue(reinterpret_cast<const char*>(key), value, length, true, valPmem, false);
+}
+
+bool StreamableDTO::putCopy(const EntryView& e) {
+  // Only values with null bytes in them need newBytes
+  bool terminated = e.valPmem || !memchr(e.value, '\0', e.valueLength);
+  return putValue(e.key, e.value, e.valueLength, e.keyPmem, e.valPmem, terminated);
+}
+
+bool StreamableDTO::putValue(const char* key, const char* value, size_t length, bool keyPmem, bool valPmem, bool terminated) {
+  if (_shared && !unshare()) return false;
+  if (!ensureTable()) return false;
+  // Strings owned by the storage may move while allocating (see
+  // StaticStreamableDTO), so put copies of any that are passed back in
+  size_t keyCopyBytes = (!keyPmem && ownsString(key)) ? strlen(key) + 1 : 0;
+  char keyCopy[keyCopyBytes + 1];
+  if (keyCopyBytes) {
+    memcpy(keyCopy, key, keyCopyBytes);
+    key = keyCopy;
+  }
+  size_t valCopyBytes = (!valPmem && ownsString(value)) ? length + 1 : 0;
+  char valCopy[valCopyBytes + 1];
+  if (valCopyBytes) {
+    memcpy(valCopy, value, length);
+    valCopy[length] = '\0';
+    value = valCopy;
+  }
+  if (_rawPending > 0) {
+    materialize(key, keyPmem, false); // the new value supersedes any unparsed line
+  }
+  if (_oldTable) {
+    rehashStep(REHASH_BUCKETS_PER_OP);
+  }
+  unsigned long h = hashCode(key, keyPmem);
+  Entry** link = findLink(key, keyPmem, h);
+  if (link) {
+    Entry* entry = *link;
+    char* newValue = valPmem ? const_cast<char*>(value) : terminated ? newString(value) : newBytes(value, length);
+    if (!newValue) return false;
+    _fingerprint -= entryFingerprint(entry->key, entry->keyPmem, entry->value, entry->valueLength, entry->valPmem);
+    _fingerprint += entryFingerprint(key, keyPmem, value, length, valPmem);
+    if (!entry->valPmem) deleteBytes(entry->value, entry->valueLength);
+    entry->value = newValue;
+    entry->valueLength = length;
+    entry->valPmem = valPmem;
+    return true;
+  }
+  Entry* added = newEntry();
+  if (!added) return false;
+  added->keyPmem = keyPmem;
+  added->valPmem = valPmem;
+  added->keyInterned = !keyPmem && _internKeys;
+  added->valueLength = length;
+  if (keyPmem) {
+    added->key = key;
+  } else if (added->keyInterned) {
+    added->key = StreamableKeyPool::shared().intern(key, h);
+  } else {
+    added->key = newString(key);
+  }
+  added->value = nullptr;
+  if (added->key) {
+    added->value = valPmem ? const_cast<char*>(value) : terminated ? newString(value) : newBytes(value, length);
+  }
+  if (!added->key || !added->value) {
+    releaseEntry(added);
+    return false;
   }
-  Entry* newEntry = new Entry(key, value, keyPmem, valPmem);
-  newEntry->next = _table[index];
-  _table[index] = newEntry;
+  int index = h % _tableSize;
+  added->next = _table[index];
+  _table[index] = added;
   _count++;
+  _sortedValid = false;
+  _fingerprint += entryFingerprint(key, keyPmem, value, length, valPmem);
 
-  if (static_cast<float>(_count) / _tableSize > _loadFactorThreshold) {
+  if (!_fixedTable && static_cast<float>(_count) / _tableSize > _loadFactorThreshold) {
     if (!resize(_tableSize * 2)) {
 #if defined(DEBUG)
       Serial.println(F("Hashtable resize failed!"));
@@ -189,15 +603,7 @@ bool StreamableDTO::putEmpty_P(const char* key) {
 }
 
 bool StreamableDTO::exists(const char* key, bool keyPmem = false) const {
-  int index = hash(key, keyPmem);
-  Entry* entry = _table[index];
-  while (entry != nullptr) {
-    if (keyMatches(key, entry, keyPmem)) {
-      return true;
-    }
-    entry = entry->next;
-  }
-  return false;
+  return get(key, keyPmem) != nullptr;
 }
 
 bool StreamableDTO::exists(const __FlashStringHelper* key) const {
@@ -208,16 +614,21 @@ bool StreamableDTO::exists_P(const char* key) const {
   return exists(key, true);
 }
 
-char* StreamableDTO::get(const char* key, bool keyPmem = false) const {
-  int index = hash(key, keyPmem);
-  Entry* entry = _table[index];
-  while (entry != nullptr) {
-    if (keyMatches(key, entry, keyPmem)) {
-      return entry->value;
-    }
-    entry = entry->next;
+StreamableDTO::Entry* StreamableDTO::lookup(const char* key, bool keyPmem) const {
+  StreamableDTO* self = const_cast<StreamableDTO*>(this);
+  if (_rawPending > 0) {
+    self->materialize(key, keyPmem, true);
   }
-  return nullptr;
+  if (_oldTable) {
+    self->rehashStep(REHASH_BUCKETS_PER_OP);
+  }
+  Entry** link = self->findLink(key, keyPmem, hashCode(key, keyPmem));
+  return link ? *link : nullptr;
+}
+
+char* StreamableDTO::get(const char* key, bool keyPmem = false) const {
+  Entry* entry = lookup(key, keyPmem);
+  return entry ? entry->value : nullptr;
 }
 
 char* StreamableDTO::get(const __FlashStringHelper* key) const {
@@ -228,25 +639,41 @@ char* StreamableDTO::get_P(const char* key) const {
   return get(key, true);
 }
 
+StreamableDTO::EntryView StreamableDTO::getView(const char* key, bool keyPmem = false) const {
+  Entry* entry = lookup(key, keyPmem);
+  if (!entry) return EntryView();
+  return EntryView(entry->key, entry->value, entry->keyPmem, entry->valPmem, entry->valueLength);
+}
+
+StreamableDTO::EntryView StreamableDTO::getView(const __FlashStringHelper* key) const {
+  return getView(reinterpret_cast<const char*>(key), true);
+}
+
+StreamableDTO::EntryView StreamableDTO::getView_P(const char* key) const {
+  return getView(key, true);
+}
+
 bool StreamableDTO::remove(const char* key, bool keyPmem = false) {
-  int index = hash(key, keyPmem);
-  Entry* current = _table[index];
-  Entry* prev = nullptr;
-  while (current != nullptr) {
-    if (keyMatches(key, current, keyPmem)) {
-      if (prev != nullptr) {
-        prev->next = current->next;
-      } else {
-        _table[index] = current->next;
-      }
-      delete current;
-      _count--;
-      return true;
-    }
-    prev = current;
-    current = current->next;
+  if (_shared && !unshare()) return false;
+  bool removedRaw = (_rawPending > 0) && materialize(key, keyPmem, false);
+  if (_oldTable) {
+    rehashStep(REHASH_BUCKETS_PER_OP);
+  }
+  Entry** link = findLink(key, keyPmem, hashCode(key, keyPmem));
+  if (!link) {
+    return removedRaw;
   }
-  return false;
+  Entry* removed = *link;
+  *link = removed->next;
+  _fingerprint -= entryFingerprint(removed->key, removed->keyPmem, removed->value, removed->valueLength, removed->valPmem);
+  releaseEntry(removed);
+  _count--;
+  _sortedValid = false;
+  if (_autoShrink && !_fixedTable && !_oldTable && _tableSize > INITIAL_TABLE_SIZE
+      && static_cast<float>(_count) / _tableSize < _loadFactorThreshold / 4) {
+    resize(_tableSize / 2); // if this fails, just stay at the current size
+  }
+  return true;
 }
 
 bool StreamableDTO::remove(const __FlashStringHelper* key) {
@@ -258,105 +685,457 @@ bool StreamableDTO::remove_P(const char* key) {
 }
 
 bool StreamableDTO::clear() {
-  for (int i = 0; i < _tableSize; ++i) {
-    Entry* entry = _table[i];
-    while (entry != nullptr) {
-      Entry* toDelete = entry;
-      entry = entry->next;
-      delete toDelete;
+  clearRaw();
+  for (StreamableArrayBase* array = _arrays; array; array = array->_next) {
+    array->clear();
+  }
+  _deserializedVer = 0;
+  if (_shared && *_shared > 1) {
+    // Leave the shared entries to the other DTOs, and start over empty
+    releaseTable();
+    return true;
+  }
+  unshare();
+  for (int t = 0; t < 2; t++) {
+    Entry** table = t ? _oldTable : _table;
+    int tableSize = t ? _oldTableSize : _tableSize;
+    for (int i = 0; table && i < tableSize; ++i) {
+      Entry* entry = table[i];
+      while (entry != nullptr) {
+        Entry* toDelete = entry;
+        entry = entry->next;
+        releaseEntry(toDelete);
+      }
+      table[i] = nullptr;
     }
-    _table[i] = nullptr;
   }
   _count = 0;
-  if (_tableSize > INITIAL_TABLE_SIZE) {
-    return resize(INITIAL_TABLE_SIZE);
+  _sortedValid = false;
+  _fingerprint = 0;
+  if (_oldTable) {
+    rehashStep(_oldTableSize); // nothing left to move, so this just frees it
+  }
+  if (!_fixedTable && _tableSize > INITIAL_TABLE_SIZE) {
+    if (!resize(INITIAL_TABLE_SIZE)) return false;
+    rehashStep(_oldTableSize);
   }
   return true;
 }
 
 bool StreamableDTO::processEntries(EntryProcessor entryProcessor, void* capture = nullptr) {
-  for (int i = 0; i < _tableSize; ++i) {
-    Entry* entry = _table[i];
-    while (entry != nullptr) {
-      bool result = entryProcessor(entry->key, entry->value, entry->keyPmem, entry->valPmem, capture);
-      if (!result) {
+  return forEach([&](const EntryView& e) -> bool {
+    return entryProcessor(e.key, e.value, e.keyPmem, e.valPmem, capture);
+  });
+}
+
+bool StreamableDTO::processTableEntries(EntryProcessor entryProcessor, void* capture = nullptr) {
+  return forEachTableEntry([&](const EntryView& e) -> bool {
+    return entryProcessor(e.key, e.value, e.keyPmem, e.valPmem, capture);
+  });
+}
+
+bool StreamableDTO::processRawLines(RawLineProcessor rawLineProcessor, void* capture = nullptr) {
+  return forEachRawLine([&](const char* line) -> bool {
+    return rawLineProcessor(line, capture);
+  });
+}
+
+StreamableDTO::Iterator StreamableDTO::begin() {
+  if (_rawPending > 0) {
+    materializeAll();
+  }
+  rehashStep(_oldTableSize);
+  return Iterator(_table, _tableSize, false);
+}
+
+bool StreamableDTO::appendRawLine(uint16_t lineNumber, const char* line) {
+  if (_fixedTable) {
+    return false; // the raw buffer would need the heap
+  }
+  size_t lineLen = strlen(line) + 1;
+  {
+    // A repeated key supersedes the earlier line (or entry), as in a regular
+    // load, so the DTO sends and fingerprints the same as if loaded eagerly
+    char key[lineLen];
+    memcpy(key, line, lineLen);
+    splitRawLine(key);
+    remove(key);
+  }
+  if (_rawBytes + lineLen >= RAW_CONSUMED) {
+#if defined(DEBUG)
+    Serial.println(F("appendRawLine: raw buffer full"));
+#endif
+    return false;
+  }
+  if (_rawBytes + lineLen > _rawCapacity) {
+    uint32_t newCapacity = _rawCapacity ? _rawCapacity : 64;
+    while (newCapacity < _rawBytes + lineLen) newCapacity *= 2;
+    if (newCapacity > RAW_CONSUMED) newCapacity = RAW_CONSUMED;
+    char* newBuffer = static_cast<char*>(realloc(_rawBuffer, newCapacity));
+    if (!newBuffer) return false;
+    _rawBuffer = newBuffer;
+    _rawCapacity = newCapacity;
+  }
+  if (_rawLineCount == _rawLineCapacity) {
+    uint16_t newCapacity = _rawLineCapacity ? _rawLineCapacity * 2 : 8;
+    uint16_t* newOffsets = static_cast<uint16_t*>(realloc(_rawOffsets, newCapacity * sizeof(uint16_t)));
+    if (!newOffsets) return false;
+    _rawOffsets = newOffsets;
+    _rawLineCapacity = newCapacity;
+  }
+  if (_rawLineCount == 0) {
+    _rawFirstLineNumber = lineNumber;
+  }
+  memcpy(_rawBuffer + _rawBytes, line, lineLen);
+  _rawOffsets[_rawLineCount++] = _rawBytes;
+  _rawBytes += lineLen;
+  _rawPending++;
+  return true;
+}
+
+const char* StreamableDTO::splitRawLine(char* line) {
+  char* sep = strchr(line, '=');
+  if (!sep) return "";
+  *sep = '\0';
+  for (char* end = sep - 1; end >= line && isspace(*end); --end) *end = '\0';
+  char* value = sep + 1;
+  while (isspace(*value)) value++;
+  return value;
+}
+
+bool StreamableDTO::rawKeyMatches(const char* line, const char* key, bool keyPmem) {
+  const char* sep = strchr(line, '=');
+  size_t lineKeyLen = sep ? sep - line : strlen(line);
+  while (lineKeyLen > 0 && isspace(line[lineKeyLen - 1])) lineKeyLen--;
+  size_t keyLen = keyPmem ? strlen_P(key) : strlen(key);
+  if (lineKeyLen != keyLen) return false;
+  return keyPmem ? (strncmp_P(line, key, keyLen) == 0) : (strncmp(line, key, keyLen) == 0);
+}
+
+bool StreamableDTO::materialize(const char* key, bool keyPmem, bool parse) {
+  int lastMatch = -1;
+  for (uint16_t i = 0; i < _rawLineCount; i++) {
+    if (_rawOffsets[i] == RAW_CONSUMED) continue;
+    if (rawKeyMatches(_rawBuffer + _rawOffsets[i], key, keyPmem)) {
+      // Duplicate keys resolve the same way as a regular load: last one wins
+      if (lastMatch >= 0) _rawOffsets[lastMatch] = RAW_CONSUMED;
+      lastMatch = i;
+      _rawPending--;
+    }
+  }
+  if (lastMatch < 0) return false;
+  uint16_t offset = _rawOffsets[lastMatch];
+  _rawOffsets[lastMatch] = RAW_CONSUMED; // before parsing, since parseLine calls put()
+  if (parse) {
+    parseLine(_rawFirstLineNumber + lastMatch, _rawBuffer + offset);
+  }
+  if (_rawPending == 0) {
+    clearRaw(); // everything has been parsed, so the raw buffer is no longer needed
+  }
+  return true;
+}
+
+void StreamableDTO::addArray(StreamableArrayBase* array) {
+  array->_next = _arrays;
+  _arrays = array;
+}
+
+StreamableArrayBase* StreamableDTO::getArray(const char* key) const {
+  for (StreamableArrayBase* array = _arrays; array; array = array->_next) {
+    if (strcmp(array->_key, key) == 0) return array;
+  }
+  return nullptr;
+}
+
+bool StreamableDTO::putAll(const EntryView* entries, uint16_t count) {
+  reserve(_count + count); // if this fails, the table just grows as usual
+  bool result = true;
+  for (uint16_t i = 0; i < count; i++) {
+    const EntryView& e = entries[i];
+    result = putBytes(e.key, e.value, e.valueLength, e.keyPmem, e.valPmem) && result;
+  }
+  return result;
+}
+
+bool StreamableDTO::merge(const StreamableDTO& other, MergePolicy policy = OVERWRITE) {
+  if (&other == this) return true;
+  // Overlays mostly replace existing keys, so only make room for new ones
+  size_t added = 0;
+  if (_count == 0 && _rawPending == 0) {
+    added = other._count + other._rawPending;
+  } else {
+    other.forEach([&](const EntryView& e) -> bool {
+      if (!exists(e.key, e.keyPmem)) added++;
+      return true;
+    });
+  }
+  reserve(_count + added);
+  bool result = true;
+  other.forEach([&](const EntryView& e) -> bool {
+    if (policy == KEEP_EXISTING && exists(e.key, e.keyPmem)) return true;
+    result = putCopy(e) && result;
+    return true;
+  });
+  return result;
+}
+
+bool StreamableDTO::putChild(const char* name, StreamableDTO* child) {
+  removeChild(name);
+  size_t nameLen = strlen(name);
+  return child->forEach([&](const EntryView& e) -> bool {
+    size_t keyLen = e.keyPmem ? strlen_P(e.key) : strlen(e.key);
+    char key[nameLen + keyLen + 2];
+    memcpy(key, name, nameLen);
+    key[nameLen] = SCOPE_SEPARATOR;
+    if (e.keyPmem) {
+      strcpy_P(key + nameLen + 1, e.key);
+    } else {
+      strcpy(key + nameLen + 1, e.key);
+    }
+    return putCopy(EntryView(key, e.value, false, e.valPmem, e.valueLength));
+  });
+}
+
+bool StreamableDTO::getChild(const char* name, StreamableDTO* child) {
+  size_t scopeLen = strlen(name) + 1;
+  bool found = false;
+  bool result = forEachInScope(name, [&](const EntryView& e) -> bool {
+    found = true;
+    // A PROGMEM key stays in PROGMEM, just past the scope
+    return child->putCopy(EntryView(e.key + scopeLen, e.value, e.keyPmem, e.valPmem, e.valueLength));
+  });
+  return found && result;
+}
+
+uint16_t StreamableDTO::removeChild(const char* name) {
+  int first, last;
+  if (!findScope(name, first, last)) {
+    uint16_t removed = 0;
+    bool more = true;
+    while (more) {
+      // Without an index, find one key at a time, since removing invalidates iteration
+      const char* key = nullptr;
+      bool keyPmem = false;
+      forEachInScope(name, [&](const EntryView& e) -> bool {
+        key = e.key;
+        keyPmem = e.keyPmem;
         return false;
+      });
+      more = key && remove(key, keyPmem);
+      if (more) removed++;
+    }
+    return removed;
+  }
+  // Removing only frees the removed entry, so the rest of the range stays valid
+  for (int i = last - 1; i >= first; i--) {
+    remove(_sortedEntries[i]->key, _sortedEntries[i]->keyPmem);
+  }
+  return last - first;
+}
+
+int StreamableDTO::compareEntries(const void* a, const void* b) {
+  const Entry* e1 = *static_cast<Entry* const*>(a);
+  const Entry* e2 = *static_cast<Entry* const*>(b);
+  for (size_t i = 0; ; i++) {
+    uint8_t c1 = e1->keyPmem ? pgm_read_byte(e1->key + i) : e1->key[i];
+    uint8_t c2 = e2->keyPmem ? pgm_read_byte(e2->key + i) : e2->key[i];
+    if (c1 != c2 || c1 == '\0') return c1 - c2;
+  }
+}
+
+bool StreamableDTO::buildSortedIndex() {
+  if (_fixedTable) return false;
+  if (_rawPending > 0) {
+    materializeAll();
+  }
+  if (_sortedValid) return true;
+  if (_count > _sortedCapacity) {
+    Entry** newEntries = static_cast<Entry**>(realloc(_sortedEntries, _count * sizeof(Entry*)));
+    if (!newEntries) return false;
+    _sortedEntries = newEntries;
+    _sortedCapacity = _count;
+  }
+  int n = 0;
+  for (int t = 0; t < 2; t++) {
+    Entry** table = t ? _table : _oldTable;
+    int tableSize = t ? _tableSize : _oldTableSize;
+    for (int i = 0; table && i < tableSize; ++i) {
+      for (Entry* entry = table[i]; entry != nullptr; entry = entry->next) {
+        _sortedEntries[n++] = entry;
       }
-      entry = entry->next;
     }
   }
+  qsort(_sortedEntries, n, sizeof(Entry*), compareEntries);
+  _sortedValid = true;
+  return true;
+}
+
+bool StreamableDTO::inScope(const char* key, bool keyPmem, const char* scope) {
+  size_t i = 0;
+  for (; scope[i] != '\0'; i++) {
+    char c = keyPmem ? pgm_read_byte(key + i) : key[i];
+    if (c != scope[i]) return false;
+  }
+  return (keyPmem ? pgm_read_byte(key + i) : key[i]) == SCOPE_SEPARATOR;
+}
+
+bool StreamableDTO::findScope(const char* scope, int& first, int& last) {
+  if (!buildSortedIndex()) {
+    return false;
+  }
+  // Binary search for the first key at or after "scope."
+  size_t scopeLen = strlen(scope);
+  char prefix[scopeLen + 2];
+  memcpy(prefix, scope, scopeLen);
+  prefix[scopeLen] = SCOPE_SEPARATOR;
+  prefix[scopeLen + 1] = '\0';
+  Entry probe(prefix);
+  Entry* probePtr = &probe;
+  int lo = 0, hi = _count;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (compareEntries(&_sortedEntries[mid], &probePtr) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  first = lo;
+  last = lo;
+  while (last < _count && inScope(_sortedEntries[last]->key, _sortedEntries[last]->keyPmem, scope)) {
+    last++;
+  }
   return true;
 }
 
-StreamableDTO::MetaInfo* StreamableDTO::parseMetaLine(const char* metaLine) {
+void StreamableDTO::materializeAll() {
+  // Last line first, so that put() drops any earlier line with the same key
+  for (int i = _rawLineCount - 1; i >= 0 && _rawPending > 0; i--) {
+    if (_rawOffsets[i] == RAW_CONSUMED) continue;
+    const char* raw = _rawBuffer + _rawOffsets[i];
+    char line[strlen(raw) + 1];
+    strcpy(line, raw); // put() frees the raw buffer once nothing is pending
+    _rawOffsets[i] = RAW_CONSUMED;
+    _rawPending--;
+    parseLine(_rawFirstLineNumber + i, line);
+  }
+  clearRaw();
+}
+
+void StreamableDTO::clearRaw() {
+  if (_rawBuffer) free(_rawBuffer);
+  if (_rawOffsets) free(_rawOffsets);
+  _rawBuffer = nullptr;
+  _rawOffsets = nullptr;
+  _rawBytes = 0;
+  _rawCapacity = 0;
+  _rawLineCount = 0;
+  _rawLineCapacity = 0;
+  _rawPending = 0;
+}
+
+bool StreamableDTO::parseMetaLine(const char* metaLine, MetaInfo& meta) {
   static const char typeIdKey[] PROGMEM = "__tvid=";
+  if (!metaLine) return false;
   const char* typeIdStart = strstr_P(metaLine, typeIdKey);
-  if (!typeIdStart) return nullptr;
+  if (!typeIdStart) return false;
   typeIdStart += strlen_P(typeIdKey);
   const char* sep = strchr(typeIdStart, '|');
-  if (!sep) return nullptr;
+  if (!sep) return false;
   char typeIdStr[8] = {0}; // fits int16_t
+  if (sep - typeIdStart >= static_cast<int>(sizeof(typeIdStr))) return false;
   strncpy(typeIdStr, typeIdStart, sep - typeIdStart);
-  int16_t typeId = atoi(typeIdStr);
-  uint8_t serialVersion = atoi(sep + 1);
-  return new MetaInfo(typeId, serialVersion);
+  meta.typeId = atoi(typeIdStr);
+  meta.serialVersion = atoi(sep + 1);
+  return true;
 }
 
 bool StreamableDTO::parseLine(uint16_t lineNumber, const char* line) {
-  const char* sep = strchr(line, '=');
-  if (!sep) {
-    parseValue(lineNumber, line, "");
-    return true;
-  }
-  size_t keyLen = sep - line;
-  size_t valLen = strlen(sep + 1);
-  char key[keyLen + 1];
-  char val[valLen + 1];
-  strncpy(key, line, keyLen); key[keyLen] = '\0';
-  strncpy(val, sep + 1, valLen); val[valLen] = '\0';
-
-  // Trim leading
-  char* k = key; while (isspace(*k)) k++;
-  char* v = val; while (isspace(*v)) v++;
-
-  // Trim trailing
-  for (char* end = k + strlen(k) - 1; end >= k && isspace(*end); --end) *end = '\0';
-  for (char* end = v + strlen(v) - 1; end >= v && isspace(*end); --end) *end = '\0';
+  StreamableScanner::Line split;
+  StreamableScanner::split(line, strlen(line), split);
+  return parseFields(lineNumber, split.key, split.keyLength, split.value, split.valueLength);
+}
 
+bool StreamableDTO::parseFields(uint16_t lineNumber, const char* key, size_t keyLength,
+      const char* value, size_t valueLength) {
+  char k[keyLength + 1];
+  char v[valueLength + 1];
+  memcpy(k, key, keyLength);
+  k[keyLength] = '\0';
+  if (memchr(value, '\0', valueLength)) {
+    return putBytes(k, value, valueLength);
+  }
+  memcpy(v, value, valueLength);
+  v[valueLength] = '\0';
   parseValue(lineNumber, k, v);
   return true;
 }
 
-void StreamableDTO::parseValue(uint16_t lineNumber, const char* key, const char* value) {
+void StreamableDTO::parseValue(uint16_t, const char* key, const char* value) {
   put(key, value);
 }
 
 bool StreamableDTO::toLine(const char* key, const char* value, bool keyPmem, bool valPmem, char* buffer, size_t bufferSize) {
-  if (!key || !value || !buffer || bufferSize == 0) return false;
+  if (!key || !value) return false;
+  return writeLine(EntryView(key, value, keyPmem, valPmem), buffer, bufferSize) > 0;
+}
 
-  size_t keyLen = keyPmem ? strlen_P(key) : strlen(key);
-  size_t valLen = valPmem ? strlen_P(value) : strlen(value);
-  size_t needed = keyLen + 1 + valLen + 1; // '=' + '\0'
+size_t StreamableDTO::toLine(const EntryView& e, char* buffer, size_t bufferSize) {
+  if (overridesStringToLine()) {
+    return toLine(e.key, e.value, e.keyPmem, e.valPmem, buffer, bufferSize) ? strlen(buffer) : 0;
+  }
+  return writeLine(e, buffer, bufferSize);
+}
+
+size_t StreamableDTO::writeLine(const EntryView& e, char* buffer, size_t bufferSize) {
+  if (!e.key || !e.value || !buffer || bufferSize == 0) return 0;
 
-  if (needed > bufferSize) {
+  size_t keyLen = e.keyPmem ? strlen_P(e.key) : strlen(e.key);
+  size_t len = keyLen + 1 + e.valueLength; // with the '='
+
+  if (len + 1 > bufferSize) {
 #if defined(DEBUG)
     Serial.println(F("toLine: buffer too small"));
 #endif
-    return false;
+    return 0;
   }
 
-  char* p = buffer;
-  if (keyPmem) {
-    strcpy_P(p, key);
+  if (e.keyPmem) {
+    memcpy_P(buffer, e.key, keyLen);
   } else {
-    strcpy(p, key);
+    memcpy(buffer, e.key, keyLen);
   }
-  p += keyLen;
-  *p++ = '=';
-  if (valPmem) {
-    strcpy_P(p, value);
+  buffer[keyLen] = '=';
+  if (e.valPmem) {
+    memcpy_P(buffer + keyLen + 1, e.value, e.valueLength);
   } else {
-    strcpy(p, value);
+    memcpy(buffer + keyLen + 1, e.value, e.valueLength);
   }
-  return true;
+  buffer[len] = '\0';
+  return len;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpmf-conversions"
+#endif
+bool StreamableDTO::overridesStringToLine() {
+#if defined(__GNUC__) && !defined(__clang__)
+  // GCC can turn a virtual member function, bound to an object, into the
+  // address of the function a call would reach. A plain DTO, made once on
+  // the stack, gives the address of the default.
+  bool (StreamableDTO::*stringToLine)(const char*, const char*, bool, bool, char*, size_t) = &StreamableDTO::toLine;
+  static void* defaultToLine = nullptr;
+  if (!defaultToLine) {
+    Entry* bucket[1];
+    StreamableDTO plain(bucket, 1);
+    defaultToLine = (void*)(plain.*stringToLine);
+  }
+  return (void*)(this->*stringToLine) != defaultToLine;
+#else
+  return true; // other compilers always go through it
+#endif
 }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
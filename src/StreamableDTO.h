@@ -15,6 +15,8 @@
 
 #include <Arduino.h>
 
+class StreamableArrayBase;
+
 /*
  * A collection of arbitrary key-value pairs that is accessible with
  * hashtable semantics, but can also be serialized/deserialized from 
@@ -27,22 +29,33 @@
 
 class StreamableDTO {
 
-  private:
+  protected:
 
+    /*
+     * An Entry only holds pointers. The key and value strings (if not in
+     * PROGMEM) are owned by the table and are allocated and released through
+     * the newString/deleteString hooks, so that subclasses can provide their
+     * own storage (see StaticStreamableDTO).
+     */
     struct Entry {
       const char* key;
       char* value;
       Entry* next;
       bool keyPmem;
       bool valPmem;
-      Entry(const char* k, const char* v, bool keyPmem, bool valPmem);
-      ~Entry();
+      bool keyInterned = false; // key belongs to StreamableKeyPool
+      size_t valueLength = 0;   // not counting the null terminator
+      Entry(const char* k = nullptr, const char* v = nullptr, bool keyPmem = false, bool valPmem = false);
     };
 
+  private:
+
     /*
      * Instance vars - note that _tableSize indicates the number of buckets
      * in the table, whether or not they are used/overloaded. _count indicates
-     * the actual number of Entry's in the table.
+     * the actual number of Entry's in the table. A DTO that was moved from,
+     * or cleared while sharing its entries, has no table (_table is nullptr)
+     * until the next put allocates one.
      */
     static const int INITIAL_TABLE_SIZE = 8;
     Entry** _table;
@@ -50,12 +63,45 @@ class StreamableDTO {
     int _count;
     float _loadFactorThreshold = 0.7;
     uint8_t _deserializedVer = 0;
+    bool _fixedTable = false; // _table is owned by a subclass and never resized
+    bool _internKeys = false;
+
+    /*
+     * Sum of entryFingerprint over every entry in the table, kept up to date
+     * by put, remove and clear. Addition doesn't depend on order, so the sum
+     * only depends on the content, not on the insertion order or table size.
+     */
+    uint32_t _fingerprint = 0;
+    static uint32_t entryFingerprint(const char* key, bool keyPmem, const char* value, size_t valueLength, bool valPmem);
+
+    /*
+     * Frees the Entry and whichever of its key and value are in regular memory
+     */
+    void releaseEntry(Entry* entry);
+
+    /*
+     * Incremental rehashing state. When the table grows or shrinks, the
+     * current table becomes _oldTable and a few of its buckets are moved
+     * into the new _table on every put/get/remove, so no single call pays
+     * for rehashing every entry. _rehashIndex is the next bucket of
+     * _oldTable to move. Lookups check both tables until it is drained.
+     */
+    static const int REHASH_BUCKETS_PER_OP = 2;
+    Entry** _oldTable = nullptr;
+    int _oldTableSize = 0;
+    int _rehashIndex = 0;
+    bool _autoShrink = false;
+#if defined(STRDTO_STATS)
+    uint16_t _resizeCount = 0;
+#endif
 
     /*
      * The hash is based on the _content_ that the char* points to, but the
      * caller must indicate whether the key is a pointer to PROGMEM or
-     * regular memory
+     * regular memory. hashCode is the raw hash and hash() is the bucket
+     * index in _table.
      */
+    unsigned long hashCode(const char* key, bool pmem = false) const;
     int hash(const char* key, bool pmem = false);
     int hash(const __FlashStringHelper* key);
 
@@ -73,18 +119,134 @@ class StreamableDTO {
     bool keyMatches(const __FlashStringHelper* key, const Entry* entry);
 
     /*
-     * Resize the table, rehashing all keys to redistribute entries.
+     * Starts resizing the table. Entries are moved over by rehashStep, a few
+     * buckets at a time. If a resize is already in progress, it is finished
+     * first.
      */
     bool resize(int newSize);
+    void rehashStep(int buckets);
+
+    /*
+     * Allocates the initial table if there is none. Returns false if out of
+     * memory.
+     */
+    bool ensureTable();
+
+    /*
+     * Frees the entries and the table (or leaves them to the other DTOs
+     * sharing them), leaving no table. Not for fixed-capacity tables.
+     */
+    void releaseTable();
+
+    /*
+     * Returns the link (bucket head or previous entry's next pointer) that
+     * points to the entry for the key, searching both tables while a rehash
+     * is in progress. Returns nullptr if the key is not found.
+     */
+    Entry** findLink(const char* key, bool keyPmem, unsigned long h);
+
+    /*
+     * The entry for the key, after parsing its pending raw line (if any) and
+     * moving a few buckets of a resize in progress, or nullptr
+     */
+    Entry* lookup(const char* key, bool keyPmem) const;
+
+    /*
+     * Shared by put and putBytes. terminated says whether value is a plain
+     * string (stored with newString) rather than bytes (newBytes).
+     */
+    bool putValue(const char* key, const char* value, size_t length, bool keyPmem, bool valPmem, bool terminated);
 
     struct MetaInfo {
       int16_t typeId;
       uint8_t serialVersion;
+      MetaInfo(): typeId(-1), serialVersion(0) {};
       MetaInfo(int16_t typeId, uint8_t serialVersion): 
             typeId(typeId), serialVersion(serialVersion) {};
     };
 
-    bool isCompatibleTypeAndVersion(MetaInfo* meta);
+    bool isCompatibleTypeAndVersion(const MetaInfo& meta);
+
+    /*
+     * Lazy load state. When _lazyLoad is set, StreamableManager::load appends
+     * each received line to _rawBuffer instead of parsing it, and _rawOffsets
+     * records where each line starts. A raw line is only parsed the first
+     * time its key is looked up, after which its offset is set to RAW_CONSUMED
+     * so it is never parsed or re-emitted again.
+     */
+    static const uint16_t RAW_CONSUMED = 0xFFFF;
+    bool _lazyLoad = false;
+    char* _rawBuffer = nullptr;
+    uint16_t _rawBytes = 0;
+    uint16_t _rawCapacity = 0;
+    uint16_t* _rawOffsets = nullptr;
+    uint16_t _rawLineCount = 0;
+    uint16_t _rawLineCapacity = 0;
+    uint16_t _rawFirstLineNumber = 0;
+    uint16_t _rawPending = 0;
+
+    /*
+     * Appends a trimmed line to the raw buffer without parsing it. An earlier
+     * pending line or entry with the same key is dropped. Returns false if
+     * the buffer could not be grown.
+     */
+    bool appendRawLine(uint16_t lineNumber, const char* line);
+
+    /*
+     * Splits a copy of a raw line into its key and value, trimmed the same
+     * way as parseLine does it
+     */
+    static const char* splitRawLine(char* line);
+
+    /*
+     * Finds the pending raw line(s) for the given key and removes them from
+     * the raw buffer. If parse is true, the last matching line is handed to
+     * parseLine so that it lands in the table. Returns true if a matching raw
+     * line was found.
+     */
+    bool materialize(const char* key, bool keyPmem, bool parse);
+
+    /*
+     * Parses every pending raw line into the table
+     */
+    void materializeAll();
+    static bool rawKeyMatches(const char* line, const char* key, bool keyPmem);
+    void clearRaw();
+
+    /*
+     * Sorted key index for scoped lookups. _sortedEntries holds every entry
+     * ordered by key, and is rebuilt the next time it's needed once
+     * _sortedValid is cleared by adding or removing an entry.
+     */
+    Entry** _sortedEntries = nullptr;
+    int _sortedCapacity = 0;
+    bool _sortedValid = false;
+
+    /*
+     * Sorts the entries into _sortedEntries if needed. Returns false if
+     * there's no index (fixed-capacity table, or out of memory).
+     */
+    bool buildSortedIndex();
+    static int compareEntries(const void* a, const void* b);
+
+    /*
+     * Finds the range [first, last) of _sortedEntries under scope. Returns
+     * false if there's no index.
+     */
+    bool findScope(const char* scope, int& first, int& last);
+    static bool inScope(const char* key, bool keyPmem, const char* scope);
+
+    StreamableArrayBase* _arrays = nullptr;
+
+    /*
+     * Copy-on-write state (see cloneInto). When set, _table, its entries and
+     * their strings are shared by *_shared DTOs, and must be left alone.
+     * unshare() gives this DTO its own copy before any change, or takes
+     * over the entries if it is the last one sharing them.
+     */
+    uint16_t* _shared = nullptr;
+    bool unshare();
+    void swapWith(StreamableDTO& other);
 
     friend class HashtableTestHelper; // test/test-suite/HashtableTestHelper.h
 
@@ -94,6 +256,26 @@ class StreamableDTO {
     StreamableDTO(size_t initialCapacity, float loadFactor = 0.7) ;
     virtual ~StreamableDTO();
 
+    /*
+     * A key and value visited by forEach or a range-based for loop, or
+     * returned by getView, with flags saying whether each is in PROGMEM or
+     * regular memory. valueLength doesn't count the null terminator. When
+     * it isn't given, it is measured with strlen.
+     */
+    struct EntryView {
+      const char* key;
+      const char* value;
+      bool keyPmem;
+      bool valPmem;
+      size_t valueLength;
+      EntryView(): key(nullptr), value(nullptr), keyPmem(false), valPmem(false), valueLength(0) {};
+      EntryView(const char* key, const char* value, bool keyPmem, bool valPmem):
+            key(key), value(value), keyPmem(keyPmem), valPmem(valPmem),
+            valueLength(!value ? 0 : valPmem ? strlen_P(value) : strlen(value)) {};
+      EntryView(const char* key, const char* value, bool keyPmem, bool valPmem, size_t valueLength):
+            key(key), value(value), keyPmem(keyPmem), valPmem(valPmem), valueLength(valueLength) {};
+    };
+
     /*
      * Puts a key-value pair in the table. If the key already exists,
      * update the value. Resize the table if necessary.
@@ -108,6 +290,22 @@ class StreamableDTO {
     bool putEmpty(const __FlashStringHelper* key);
     bool putEmpty_P(const char* key);
 
+    /*
+     * Puts a value of the given length, which may contain null bytes, such as
+     * a packed struct or a sensor frame. The value is copied as is (unless
+     * valPmem) and followed by a null terminator, so get() still returns a
+     * usable string when there aren't any null bytes in it. Use getView() to
+     * get the whole value back.
+     *
+     * StreamableManager::send() and StreamableStore keep the whole value,
+     * null bytes and all, and loadBuffer() reads it back. But load() from a
+     * Stream reads lines as text and cuts the value off at its first null
+     * byte, so send() followed by load() over a Stream loses the rest of it
+     * unless the value is encoded (as hex, for example).
+     */
+    bool putBytes(const char* key, const char* value, size_t length, bool keyPmem = false, bool valPmem = false);
+    bool putBytes(const __FlashStringHelper* key, const char* value, size_t length, bool valPmem = false);
+
     /*
      * Checks if a key exists in the table.
      */
@@ -126,6 +324,18 @@ class StreamableDTO {
     char* get(const __FlashStringHelper* key) const;
     char* get_P(const char* key) const;
 
+    /*
+     * Like get, but returns the value with its length, which the table
+     * keeps, so it doesn't need a strlen, along with whether it is in
+     * PROGMEM. The value is nullptr if the key is not found.
+     *
+     *   StreamableDTO::EntryView v = dto.getView("name");
+     *   if (v.value) dest->write(v.value, v.valueLength);
+     */
+    EntryView getView(const char* key, bool keyPmem = false) const;
+    EntryView getView(const __FlashStringHelper* key) const;
+    EntryView getView_P(const char* key) const;
+
     /*
      * Removes the entry with the given key if it exists. Returns
      * true if an entry was removed, otherwise false.
@@ -136,14 +346,245 @@ class StreamableDTO {
 
     /*
      * Removes all the entries from the table and resets it to its
-     * initial size.
+     * initial size. The deserialized version is also reset.
      */
     bool clear();
 
+    /*
+     * Grows the table up front so it can hold n entries without exceeding
+     * the load factor, so that no resizing happens while they are put.
+     * Returns false if the table could not be grown.
+     */
+    bool reserve(size_t n);
+
+    /*
+     * When enabled, remove() starts shrinking the table by half (incrementally,
+     * like growing) once it is less than a quarter of the load factor full.
+     * Otherwise, clear() is the only way to shrink the table. Off by default.
+     */
+    void setAutoShrink(bool autoShrink) { _autoShrink = autoShrink; };
+
+#if defined(STRDTO_STATS)
+    /*
+     * A snapshot of how the hashtable is behaving, for tuning initialCapacity
+     * and the load factor, and spotting keys that hash poorly. Only available
+     * when compiled with STRDTO_STATS defined.
+     *
+     * While a resize is in progress, the chain statistics cover the buckets of
+     * both the old and new tables.
+     */
+    struct HashtableStats {
+      static const uint8_t CHAIN_HISTOGRAM_BINS = 8;
+      uint16_t entryCount;
+      uint16_t bucketCount;
+      uint16_t longestChain;
+      uint16_t chainLengths[CHAIN_HISTOGRAM_BINS]; // buckets with 0, 1, ... 6, and 7 or more entries
+      uint16_t resizeCount;   // since construction or resetStats()
+      bool rehashing;
+      size_t keyBytes;        // RAM held by keys not in PROGMEM
+      size_t valueBytes;      // RAM held by values not in PROGMEM
+      size_t entryBytes;      // RAM held by Entry's and bucket arrays
+      size_t rawBytes;        // RAM held by unparsed lines (see setLazyLoad)
+      uint16_t pmemKeys;
+      uint16_t internedKeys;  // shared through StreamableKeyPool, so not in keyBytes
+      uint16_t pmemValues;
+      float pmemKeyRatio() const   { return entryCount ? static_cast<float>(pmemKeys) / entryCount : 0; };
+      float pmemValueRatio() const { return entryCount ? static_cast<float>(pmemValues) / entryCount : 0; };
+    };
+
+    void getStats(HashtableStats& stats) const;
+    void resetStats() { _resizeCount = 0; };
+#endif
+
+    /*
+     * A hash of the keys and values in the DTO that doesn't depend on the
+     * order they were put in or the size of the table, so two DTOs with the
+     * same content have the same fingerprint. It is kept up to date as
+     * entries are put and removed. Lines of a lazy loaded DTO that haven't
+     * been parsed yet, and attached arrays, are hashed when this is called.
+     * Anything a subclass keeps in its own fields is not covered.
+     */
+    uint32_t getFingerprint() const;
+
+    /*
+     * Enables lazy loading. Lines received by StreamableManager::load are kept
+     * in their raw form and only parsed the first time their key is looked up
+     * with get() or exists(). Untouched lines are re-sent verbatim.
+     *
+     * Only use this for DTOs whose parseValue stores each value under the key
+     * it was received with, since lookups are matched against the raw key.
+     */
+    void setLazyLoad(bool lazyLoad) { _lazyLoad = lazyLoad; };
+    bool isLazyLoad() const { return _lazyLoad; };
+
+    /*
+     * Stores RAM keys put from now on in StreamableKeyPool::shared(), so
+     * that every DTO doing this shares one copy of each distinct key instead
+     * of holding its own. Looking up a key with the pointer that's stored
+     * (say, one from forEach) then skips comparing the strings. Has no effect
+     * on a DTO with a fixed-capacity table, which doesn't use the heap.
+     */
+    void setInternKeys(bool internKeys) { _internKeys = internKeys && !_fixedTable; };
+    bool isInternKeys() const { return _internKeys; };
+
+    /*
+     * Calls fn(const EntryView&) for every key and value, stopping early and
+     * returning false as soon as fn returns false. Any callable works, and
+     * since fn is a template parameter, a lambda is inlined into the loop
+     * instead of being called through a function pointer:
+     *
+     *   dto.forEach([&](const StreamableDTO::EntryView& e) {
+     *     total += strlen(e.value);
+     *     return true;
+     *   });
+     *
+     * Like processEntries, lines of a lazy loaded DTO that haven't been
+     * parsed yet are split on the fly (and passed as regular memory) without
+     * parsing them. Don't put or remove entries from fn.
+     */
+    template <typename Fn>
+    bool forEach(Fn&& fn) const {
+      return forEachTableEntry(fn) && forEachRawLine([&](const char* line) -> bool {
+        char buf[strlen(line) + 1];
+        strcpy(buf, line);
+        const char* value = splitRawLine(buf);
+        return fn(EntryView(buf, value, false, false));
+      });
+    }
+
+    /*
+     * Iterates the entries for a range-based for loop:
+     *
+     *   for (StreamableDTO::EntryView e : dto) { ... }
+     *
+     * begin() first parses any lines of a lazy loaded DTO that are still
+     * pending, and finishes a resize that is in progress, so the loop only
+     * walks the one table. Putting or removing entries invalidates the
+     * iterator.
+     */
+    class Iterator {
+      public:
+        EntryView operator*() const {
+          return EntryView(_entry->key, _entry->value, _entry->keyPmem, _entry->valPmem, _entry->valueLength);
+        };
+        Iterator& operator++() {
+          _entry = _entry->next;
+          skipEmptyBuckets();
+          return *this;
+        };
+        bool operator!=(const Iterator& other) const { return _entry != other._entry; };
+      private:
+        friend class StreamableDTO;
+        Entry** _table;
+        int _tableSize;
+        int _bucket;
+        Entry* _entry;
+        Iterator(Entry** table, int tableSize, bool end):
+              _table(table), _tableSize(tableSize), _bucket(0), _entry(nullptr) {
+          if (!end && _tableSize > 0) {
+            _entry = _table[0];
+            skipEmptyBuckets();
+          }
+        };
+        void skipEmptyBuckets() {
+          while (!_entry && ++_bucket < _tableSize) _entry = _table[_bucket];
+        };
+    };
+
+    Iterator begin();
+    Iterator end() { return Iterator(_table, _tableSize, true); };
+
+    /*
+     * Puts count key-value pairs, growing the table once up front instead of
+     * doubling it as they go. Keys and values flagged as PROGMEM are stored
+     * as pointers, like put(). Returns false if any pair couldn't be put.
+     *
+     *   static const StreamableDTO::EntryView defaults[] = {
+     *     { "mode", "auto", false, false },
+     *     { "rate", "9600", false, false }
+     *   };
+     *   dto.putAll(defaults, 2);
+     */
+    bool putAll(const EntryView* entries, uint16_t count);
+
+    /*
+     * Puts every key and value of other into this DTO, growing the table
+     * once up front. With KEEP_EXISTING, keys already here keep their value.
+     * PROGMEM keys and values of other are stored as the same pointers
+     * rather than copied. Returns false if any key couldn't be put.
+     */
+    enum MergePolicy : uint8_t { OVERWRITE, KEEP_EXISTING };
+    bool merge(const StreamableDTO& other, MergePolicy policy = OVERWRITE);
+
+    /*
+     * Nested DTOs. A child is stored flattened, with each of its keys scoped
+     * under the child's name, so putChild("motor.1", &motor) stores motor's
+     * "current" field as "motor.1.current", and it is sent as a line like any
+     * other field. A child's own children nest the same way.
+     *
+     * Scoped lookups use a key index that is sorted the first time it's
+     * needed after entries were added or removed, so finding the fields
+     * under a scope only costs a binary search plus the matches instead of
+     * comparing every key. Any lines still pending from a lazy load are
+     * parsed first. A DTO with a fixed-capacity table has no index and checks
+     * every key instead.
+     */
+    static const char SCOPE_SEPARATOR = '.';
+
+    /*
+     * Replaces the fields under name with the child's fields. Returns false
+     * if any field couldn't be put.
+     */
+    bool putChild(const char* name, StreamableDTO* child);
+
+    /*
+     * Puts the fields under name into child, without the scope. Returns false
+     * if there are none, or any field couldn't be put.
+     */
+    bool getChild(const char* name, StreamableDTO* child);
+
+    /*
+     * Removes the fields under name, and returns how many there were
+     */
+    uint16_t removeChild(const char* name);
+
+    /*
+     * Calls fn(const EntryView&) for each field under scope (with the full
+     * key), in key order, stopping early and returning false as soon as fn
+     * returns false. Don't put or remove entries from fn.
+     */
+    template <typename Fn>
+    bool forEachInScope(const char* scope, Fn&& fn) {
+      int first, last;
+      if (!findScope(scope, first, last)) {
+        return forEachTableEntry([&](const EntryView& e) -> bool {
+          return !inScope(e.key, e.keyPmem, scope) || fn(e);
+        });
+      }
+      for (int i = first; i < last; i++) {
+        Entry* entry = _sortedEntries[i];
+        if (!fn(EntryView(entry->key, entry->value, entry->keyPmem, entry->valPmem, entry->valueLength))) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /*
+     * Attaches a repeated field (see StreamableArray), which is sent and
+     * loaded along with the table's fields. The array isn't copied, so it
+     * must outlive the DTO, and a typed DTO usually attaches its arrays in
+     * its constructor. clear() empties attached arrays too. Arrays are
+     * covered by getFingerprint, but aren't included in batches, scoped
+     * sends or StreamableStore saves.
+     */
+    void addArray(StreamableArrayBase* array);
+    StreamableArrayBase* getArray(const char* key) const;
+
     /*
      * The serial version of the loaded DTO, if it was typed
      */
-    const uint8_t getDeserializedVersion() {
+    uint8_t getDeserializedVersion() {
       return _deserializedVer;
     }
 
@@ -157,15 +598,75 @@ class StreamableDTO {
      */
     virtual int16_t getTypeId()           {  return -1; };
 
-    // Disable moving and copying
-    StreamableDTO(StreamableDTO&& other) = delete;
-    StreamableDTO& operator=(StreamableDTO&& other) = delete;
+    /*
+     * Moving transfers the table and settings without copying any entries
+     * or allocating, and leaves other empty, without a table until it's put
+     * to again. Attached arrays stay attached to their own DTO, since they
+     * usually belong to it, but when both DTOs have the same arrays (the
+     * same keys and element types, attached in the same order) their
+     * elements are moved too. Otherwise the moved-to DTO's arrays are
+     * emptied. A DTO with a fixed-capacity table can't give up its table,
+     * so moving from one copies its entries instead.
+     *
+     * Subclasses that declare a destructor must declare their own move
+     * constructor, even if it's just "= default". One that attaches arrays
+     * in its constructor should attach them in its move constructor too.
+     */
+    StreamableDTO(StreamableDTO&& other);
+    StreamableDTO& operator=(StreamableDTO&& other);
+
+    /*
+     * Makes target a copy of this DTO that shares the entries and their
+     * strings until either DTO changes, at which point the changed one takes
+     * its own copy first. Cloning itself only finishes a resize in progress
+     * and parses any pending lazy loaded lines. This makes it cheap to take
+     * a snapshot to send while the original keeps being updated, especially
+     * if the snapshot is deleted before the next change. target can be a
+     * typed subclass, which keeps its own type. target must have the same
+     * arrays attached (the same keys and element types, in the same order),
+     * and their elements are copied. Returns false if they don't match, or
+     * if out of memory.
+     *
+     * DTOs with a fixed-capacity table are copied entry by entry instead.
+     */
+    bool cloneInto(StreamableDTO* target);
+
+    // Disable copying (use cloneInto)
     StreamableDTO(const StreamableDTO&) = delete;
     StreamableDTO& operator=(const StreamableDTO&) = delete;
 
 
   protected:
     friend class StreamableManager;
+    friend class StreamableIndex;
+    friend class StreamableStore;
+
+    /*
+     * Constructor for subclasses that provide their own bucket array. The table
+     * is never resized or deleted, so chains simply grow if the number of
+     * entries exceeds the number of buckets.
+     */
+    StreamableDTO(Entry** buckets, int tableSize);
+
+    /*
+     * Storage hooks. The defaults use the heap. A nullptr return is reported
+     * by put() returning false. newString must copy the null-terminated str.
+     * newBytes (used by putBytes) must copy length bytes of data, which may
+     * include null bytes, and add a null terminator. Values are released
+     * with deleteBytes, which gets the stored length and calls deleteString
+     * by default. A subclass that overrides newString should override
+     * newBytes too.
+     *
+     * If the storage may move its strings, ownsString must say which
+     * pointers are its own, so put() copies them before allocating.
+     */
+    virtual Entry* newEntry();
+    virtual void deleteEntry(Entry* entry);
+    virtual char* newString(const char* str);
+    virtual char* newBytes(const char* data, size_t length);
+    virtual void deleteString(char* str);
+    virtual void deleteBytes(char* data, size_t length);
+    virtual bool ownsString(const char*) const { return false; };
 
     virtual uint8_t getMinCompatVersion() {  return 0;  };
 
@@ -183,9 +684,60 @@ class StreamableDTO {
      * to the entryProcessor as raw char[]s with booleans indicating whether 
      * they are stored in PROGMEM or regular memory. Returns true if all the 
      * Entry's were successfully handled.
+     *
+     * Raw lines that have not been parsed yet (see setLazyLoad) are split into
+     * key and value on the fly and passed along as regular memory.
      */
     bool processEntries(EntryProcessor entryProcessor, void* state = nullptr);
 
+    /*
+     * Same as processEntries, but skips any raw lines that have not been
+     * parsed yet
+     */
+    bool processTableEntries(EntryProcessor entryProcessor, void* state = nullptr);
+
+    /*
+     * Inlinable versions of processTableEntries and processRawLines. fn is
+     * called with an EntryView or a raw line, respectively.
+     */
+    template <typename Fn>
+    bool forEachTableEntry(Fn&& fn) const {
+      for (int t = 0; t < 2; t++) {
+        Entry** table = t ? _table : _oldTable;
+        int tableSize = t ? _tableSize : _oldTableSize;
+        for (int i = 0; table && i < tableSize; ++i) {
+          for (Entry* entry = table[i]; entry != nullptr; entry = entry->next) {
+            if (!fn(EntryView(entry->key, entry->value, entry->keyPmem, entry->valPmem, entry->valueLength))) {
+              return false;
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+    template <typename Fn>
+    bool forEachRawLine(Fn&& fn) const {
+      for (uint16_t i = 0; i < _rawLineCount && _rawPending > 0; i++) {
+        if (_rawOffsets[i] == RAW_CONSUMED) continue;
+        if (!fn(static_cast<const char*>(_rawBuffer + _rawOffsets[i]))) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /*
+     * Do something with an unparsed line held by a lazy loaded DTO
+     */
+    typedef bool (*RawLineProcessor)(const char* line, void* state);
+
+    /*
+     * Iterate through the raw lines that have not been parsed yet, exactly as
+     * they were received. Returns true if all lines were successfully handled.
+     */
+    bool processRawLines(RawLineProcessor rawLineProcessor, void* state = nullptr);
+
     /*
      * Default implementation parses a key=value format line. 
      * If there is no =, value is an empty string. Returns false if
@@ -193,11 +745,19 @@ class StreamableDTO {
      */
     virtual bool parseLine(uint16_t lineNumber, const char* line);
 
+    /*
+     * Passes an already split and trimmed key and value (which aren't
+     * null-terminated) to parseValue. StreamableManager::loadBuffer calls
+     * this directly instead of parseLine. A value with null bytes in it
+     * can't be passed along as a string, so it's stored as is with putBytes.
+     */
+    bool parseFields(uint16_t lineNumber, const char* key, size_t keyLength, const char* value, size_t valueLength);
+
     /* 
-     * Parses the special meta line containing typeId and serialVersion, verifying
-     * compatibility. Returns false of the provided line is not a meta line
+     * Parses the special meta line containing typeId and serialVersion into the
+     * provided MetaInfo. Returns false if the provided line is not a meta line
      */
-    static MetaInfo* parseMetaLine(const char* metaLine);
+    static bool parseMetaLine(const char* metaLine, MetaInfo& meta);
 
     /*
      * Default implementation simply puts the value in _table under "key". You may want
@@ -210,6 +770,45 @@ class StreamableDTO {
      */
     virtual bool toLine(const char* key, const char* value, bool keyPmem, bool valPmem, char* buffer, size_t bufferSize);
 
+    /*
+     * Writes an entry as "key=value" and returns the length of the line, or 0
+     * if it doesn't fit. The default copies the entry's stored value length,
+     * null bytes and all, so only the key is measured. StreamableManager and
+     * StreamableStore write entries with this one. If a subclass overrides
+     * the toLine above instead, that one is called, and the line ends at its
+     * first null byte.
+     */
+    virtual size_t toLine(const EntryView& e, char* buffer, size_t bufferSize);
+
+    /*
+     * Puts a copy of a value taken from a table (this one or another DTO's),
+     * keeping its length
+     */
+    bool putCopy(const EntryView& e);
+
+  private:
+    /*
+     * The default toLine, given the value's length
+     */
+    static size_t writeLine(const EntryView& e, char* buffer, size_t bufferSize);
+
+    /*
+     * Whether a subclass overrides toLine(key, value, ...), which the default
+     * toLine(EntryView) then has to go through
+     */
+    bool overridesStringToLine();
+
+    /*
+     * Whether other has arrays with the same keys and element types, in the
+     * same order
+     */
+    bool arraysMatch(const StreamableDTO& other) const;
+
+    /*
+     * cloneInto without the arrays
+     */
+    bool cloneEntriesInto(StreamableDTO* target);
+
 };
  
 
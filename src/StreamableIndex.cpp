@@ -0,0 +1,198 @@
+#include "StreamableIndex.h"
+
+static const char INDEX_MAGIC[] PROGMEM = "SDX";
+static const size_t INDEX_MAGIC_LEN = 3;
+static const uint8_t INDEX_VERSION = 1;
+static const char META_KEY[] PROGMEM = "__tvid=";
+static const size_t META_KEY_LEN = 7;
+static const size_t META_LINE_LEN = 17; // "__tvid=-32768|255"
+static const char CHECKSUM_KEY[] PROGMEM = "__crc=";
+static const size_t CHECKSUM_KEY_LEN = 6;
+
+/*
+ * Index integers are little-endian, whatever the board
+ */
+static void writeUint(Print* out, uint32_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; i++) {
+    out->write(static_cast<uint8_t>(value & 0xFF));
+    value >>= 8;
+  }
+}
+
+static bool readUint(Stream* in, uint32_t& value, uint8_t bytes) {
+  value = 0;
+  for (uint8_t i = 0; i < bytes; i++) {
+    int b = in->read();
+    if (b < 0) return false;
+    value |= static_cast<uint32_t>(b & 0xFF) << (8 * i);
+  }
+  return true;
+}
+
+void StreamableIndex::writeEntry(Print* index, const Entry& entry, uint8_t keyBytes) {
+  writeUint(index, entry.offset, 4);
+  writeUint(index, entry.length, 4);
+  writeUint(index, static_cast<uint16_t>(entry.typeId), 2);
+  bool padding = false;
+  for (uint8_t i = 0; i < keyBytes; i++) {
+    if (entry.key[i] == '\0') padding = true;
+    index->write(padding ? 0 : entry.key[i]);
+  }
+}
+
+uint32_t StreamableIndex::build(Stream* data, Print* index, const char* keyField = nullptr, uint8_t keyBytes = 0) {
+  if (!keyField) keyBytes = 0;
+  if (keyBytes > MAX_KEY_BYTES) keyBytes = MAX_KEY_BYTES;
+  for (size_t i = 0; i < INDEX_MAGIC_LEN; i++) {
+    index->write(pgm_read_byte(INDEX_MAGIC + i));
+  }
+  index->write(INDEX_VERSION);
+  index->write(keyBytes);
+
+  struct Capture {
+    Print* index;
+    uint8_t keyBytes;
+    Capture(Print* index, uint8_t keyBytes): index(index), keyBytes(keyBytes) {};
+  };
+  auto writer = [](const Entry& entry, void* capture) -> bool {
+    Capture* c = static_cast<Capture*>(capture);
+    writeEntry(c->index, entry, c->keyBytes);
+    return true;
+  };
+  Capture capture(index, keyBytes);
+  return scan(data, writer, &capture, keyField, keyBytes);
+}
+
+uint32_t StreamableIndex::scan(Stream* data, RecordVisitor visitor, void* state,
+    const char* keyField = nullptr, uint8_t keyBytes = 0) {
+  if (!keyField) keyBytes = 0;
+  if (keyBytes > MAX_KEY_BYTES) keyBytes = MAX_KEY_BYTES;
+
+  // Only the start of each line is kept: enough for a meta line, or for the
+  // key field and as much of its value as is indexed
+  size_t keyFieldLen = keyField ? strlen(keyField) : 0;
+  size_t prefixBytes = keyFieldLen + 1 + keyBytes;
+  if (prefixBytes < META_LINE_LEN) prefixBytes = META_LINE_LEN;
+  char prefix[prefixBytes + 1];
+  size_t prefixLen = 0;
+
+  uint32_t pos = 0;
+  uint32_t lineStart = 0;
+  uint32_t count = 0;
+  bool inRecord = false;
+  bool keyFound = false;
+  Entry entry;
+  while (true) {
+    int c = data->available() ? data->read() : -1;
+    if (c >= 0) {
+      pos++;
+      if (c != '\n') {
+        if (prefixLen < prefixBytes && c != '\r') prefix[prefixLen++] = c;
+        continue;
+      }
+    } else if (pos == lineStart) {
+      break;
+    }
+    prefix[prefixLen] = '\0';
+
+    StreamableDTO::MetaInfo meta;
+    if (strncmp_P(prefix, META_KEY, META_KEY_LEN) == 0 && StreamableDTO::parseMetaLine(prefix, meta)) {
+      if (inRecord) {
+        entry.length = lineStart - entry.offset;
+        count++;
+        if (!visitor(entry, state)) return count;
+      }
+      entry = Entry();
+      entry.offset = lineStart;
+      entry.typeId = meta.typeId;
+      inRecord = true;
+      keyFound = false;
+    } else if (!inRecord && prefixLen > 0) {
+      // Untyped record
+      entry = Entry();
+      entry.offset = lineStart;
+      inRecord = true;
+      keyFound = false;
+    }
+    if (inRecord && keyBytes > 0 && !keyFound
+        && strncmp(prefix, keyField, keyFieldLen) == 0 && prefix[keyFieldLen] == '=') {
+      strncpy(entry.key, prefix + keyFieldLen + 1, keyBytes);
+      entry.key[keyBytes] = '\0';
+      keyFound = true;
+    }
+    if (inRecord && strncmp_P(prefix, CHECKSUM_KEY, CHECKSUM_KEY_LEN) == 0) {
+      entry.length = pos - entry.offset;
+      inRecord = false;
+      count++;
+      if (!visitor(entry, state)) return count;
+    }
+    prefixLen = 0;
+    lineStart = pos;
+    if (c < 0) break;
+  }
+  if (inRecord) {
+    entry.length = pos - entry.offset;
+    count++;
+    visitor(entry, state);
+  }
+  return count;
+}
+
+StreamableIndex::StreamableIndex(SeekableStream* index): _index(index) {
+  uint32_t size = index->size();
+  if (size < HEADER_BYTES || !index->seek(0)) return;
+  for (size_t i = 0; i < INDEX_MAGIC_LEN; i++) {
+    if (index->read() != pgm_read_byte(INDEX_MAGIC + i)) return;
+  }
+  if (index->read() != INDEX_VERSION) return;
+  int keyBytes = index->read();
+  if (keyBytes < 0 || keyBytes > MAX_KEY_BYTES) return;
+  _keyBytes = keyBytes;
+  _recordCount = (size - HEADER_BYTES) / (FIXED_ENTRY_BYTES + _keyBytes);
+  _valid = true;
+}
+
+bool StreamableIndex::getEntry(uint32_t recordNumber, Entry& entry) {
+  if (!_valid || recordNumber >= _recordCount) return false;
+  if (!_index->seek(HEADER_BYTES + recordNumber * (FIXED_ENTRY_BYTES + _keyBytes))) return false;
+  uint32_t typeId;
+  if (!readUint(_index, entry.offset, 4) || !readUint(_index, entry.length, 4) || !readUint(_index, typeId, 2)) {
+    return false;
+  }
+  entry.typeId = static_cast<int16_t>(typeId);
+  for (uint8_t i = 0; i < _keyBytes; i++) {
+    int c = _index->read();
+    if (c < 0) return false;
+    entry.key[i] = c;
+  }
+  entry.key[_keyBytes] = '\0';
+  return true;
+}
+
+int StreamableIndex::compareKeys(const char* a, const char* b) {
+  char* aEnd;
+  char* bEnd;
+  long aNum = strtol(a, &aEnd, 10);
+  long bNum = strtol(b, &bEnd, 10);
+  if (*a && *b && *aEnd == '\0' && *bEnd == '\0') {
+    return (aNum < bNum) ? -1 : (aNum > bNum);
+  }
+  return strcmp(a, b);
+}
+
+int32_t StreamableIndex::findKey(const char* key, Entry& entry) {
+  if (!_valid || _keyBytes == 0) return -1;
+  uint32_t low = 0;
+  uint32_t high = _recordCount;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (!getEntry(mid, entry)) return -1;
+    if (compareKeys(entry.key, key) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (!getEntry(low, entry)) return -1;
+  return low;
+}
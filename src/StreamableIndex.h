@@ -0,0 +1,110 @@
+/*
+
+  StreamableIndex.h
+
+  Sidecar index for random access to a stream of serialized DTOs
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableIndex_h
+#define _strdto_StreamableIndex_h
+
+
+#include <Arduino.h>
+#include "SeekableStream.h"
+#include "StreamableDTO.h"
+
+/*
+ * An index of the records in a stream of DTOs written one after another by
+ * StreamableManager::send, so a single record can be loaded without reading
+ * everything before it.
+ *
+ * A record starts at a meta line ("__tvid=...") and ends where the next one
+ * starts. If checksums are enabled, the "__crc=" trailer also ends a record,
+ * so untyped DTOs can be indexed too.
+ *
+ * build() scans the data once and writes a compact binary index: a 5 byte
+ * header, then a fixed-size entry per record with its byte offset, length,
+ * typeId and (optionally) the value of one key field. Entries are in record
+ * order, so the record number is just the entry's position, and can be
+ * found with a single seek. If the key field's values only increase (like a
+ * timestamp or sequence number), findKey() binary searches them.
+ */
+class StreamableIndex {
+
+  public:
+    static const uint8_t MAX_KEY_BYTES = 16;
+
+    struct Entry {
+      uint32_t offset = 0;
+      uint32_t length = 0;
+      int16_t typeId = -1;
+      char key[MAX_KEY_BYTES + 1] = {0};  // empty if the record has no key field
+    };
+
+    /*
+     * Indexes the records in data, writing the index to index. If keyField
+     * is provided, the first keyBytes chars (up to MAX_KEY_BYTES) of its
+     * value are stored in each entry. Returns the number of records indexed.
+     */
+    static uint32_t build(Stream* data, Print* index, const char* keyField = nullptr, uint8_t keyBytes = 0);
+
+    /*
+     * Finds the records in data like build(), but passes each entry to the
+     * visitor instead of writing an index. Offsets are from where data was
+     * when scan() was called. The visitor returns false to stop scanning.
+     * Returns the number of records visited.
+     */
+    typedef bool (*RecordVisitor)(const Entry& entry, void* state);
+    static uint32_t scan(Stream* data, RecordVisitor visitor, void* state,
+        const char* keyField = nullptr, uint8_t keyBytes = 0);
+
+    /*
+     * Opens an index written by build()
+     */
+    StreamableIndex(SeekableStream* index);
+
+    bool isValid() const { return _valid; };
+    uint32_t getRecordCount() const { return _recordCount; };
+    uint8_t getKeyBytes() const { return _keyBytes; };
+
+    /*
+     * Reads the entry for a record. Load the record with a BoundedStream:
+     *
+     *   BoundedStream record(&data, entry.offset, entry.length);
+     *   manager.load(&record, &dto);
+     */
+    bool getEntry(uint32_t recordNumber, Entry& entry);
+
+    /*
+     * Finds the first record whose key is equal to or after the provided
+     * key, and returns its record number, or -1 if there is none. Keys that
+     * are both integers are compared as numbers, otherwise as strings.
+     */
+    int32_t findKey(const char* key, Entry& entry);
+
+    // Disable moving and copying
+    StreamableIndex(StreamableIndex&& other) = delete;
+    StreamableIndex& operator=(StreamableIndex&& other) = delete;
+    StreamableIndex(const StreamableIndex&) = delete;
+    StreamableIndex& operator=(const StreamableIndex&) = delete;
+
+  private:
+    static const uint8_t HEADER_BYTES = 5;
+    static const uint8_t FIXED_ENTRY_BYTES = 10;
+
+    SeekableStream* _index;
+    bool _valid = false;
+    uint8_t _keyBytes = 0;
+    uint32_t _recordCount = 0;
+
+    static int compareKeys(const char* a, const char* b);
+    static void writeEntry(Print* index, const Entry& entry, uint8_t keyBytes);
+
+};
+
+
+#endif
@@ -0,0 +1,73 @@
+#include "StreamableKeyPool.h"
+
+static const uint16_t INITIAL_BUCKETS = 16;
+
+StreamableKeyPool& StreamableKeyPool::shared() {
+  static StreamableKeyPool pool;
+  return pool;
+}
+
+StreamableKeyPool::Node* StreamableKeyPool::nodeOf(const char* key) {
+  return reinterpret_cast<Node*>(const_cast<char*>(key) - offsetof(Node, key));
+}
+
+bool StreamableKeyPool::grow() {
+  if (_bucketCount >= MAX_BUCKETS) return false;
+  uint16_t newCount = _bucketCount ? _bucketCount * 2 : INITIAL_BUCKETS;
+  Node** newBuckets = new Node*[newCount]();
+  if (!newBuckets) return false;
+  for (uint16_t i = 0; i < _bucketCount; i++) {
+    Node* node = _buckets[i];
+    while (node) {
+      Node* next = node->next;
+      uint16_t index = node->hash % newCount;
+      node->next = newBuckets[index];
+      newBuckets[index] = node;
+      node = next;
+    }
+  }
+  delete[] _buckets;
+  _buckets = newBuckets;
+  _bucketCount = newCount;
+  return true;
+}
+
+const char* StreamableKeyPool::intern(const char* key, unsigned long hash) {
+  if (_count >= _bucketCount && !grow() && !_buckets) {
+    return nullptr; // keep going with longer chains if growing fails
+  }
+  Node** bucket = &_buckets[hash % _bucketCount];
+  for (Node* node = *bucket; node; node = node->next) {
+    if (node->key == key || (node->hash == hash && strcmp(node->key, key) == 0)) {
+      if (node->refs != IMMORTAL) node->refs++;
+      return node->key;
+    }
+  }
+  if (_count == MAX_KEYS) return nullptr;
+  size_t len = strlen(key);
+  size_t nodeBytes = offsetof(Node, key) + len + 1;
+  Node* node = static_cast<Node*>(malloc(nodeBytes));
+  if (!node) return nullptr;
+  memcpy(node->key, key, len + 1);
+  node->hash = hash;
+  node->refs = 1;
+  node->next = *bucket;
+  *bucket = node;
+  _count++;
+  _bytes += nodeBytes;
+  return node->key;
+}
+
+void StreamableKeyPool::release(const char* key) {
+  Node* node = nodeOf(key);
+  if (node->refs == IMMORTAL || --node->refs > 0) return;
+  for (Node** link = &_buckets[node->hash % _bucketCount]; *link; link = &(*link)->next) {
+    if (*link == node) {
+      *link = node->next;
+      break;
+    }
+  }
+  _count--;
+  _bytes -= offsetof(Node, key) + strlen(node->key) + 1;
+  free(node);
+}
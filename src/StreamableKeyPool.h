@@ -0,0 +1,95 @@
+/*
+
+  StreamableKeyPool.h
+
+  Shared copies of the keys of many StreamableDTOs
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableKeyPool_h
+#define _strdto_StreamableKeyPool_h
+
+
+#include <Arduino.h>
+
+/*
+ * Interns RAM keys, so that DTOs with the same fields (a cache of loaded
+ * DTOs of one type, for example) share one copy of each key instead of each
+ * holding its own. Each key is reference counted and freed when the last
+ * DTO using it lets go of it. A key used by more than 65534 entries at once
+ * is never freed.
+ *
+ * Finding a key that's already pooled costs its hash (which the DTO has
+ * anyway) and one strcmp, since the hash rules out every other key. The
+ * strcmp is skipped when the key is the pool's own copy, as when a pooled
+ * DTO is copied into another. Nodes don't store the key length: it would
+ * cost RAM for every key, and only save that one strcmp. The buckets stop
+ * doubling at 32768, after which chains just get longer, and the pool holds
+ * at most 65535 keys.
+ *
+ * DTOs only use the pool after StreamableDTO::setInternKeys(true).
+ */
+class StreamableKeyPool {
+
+  public:
+    /*
+     * The pool shared by every DTO
+     */
+    static StreamableKeyPool& shared();
+
+    uint16_t getKeyCount() const { return _count; };
+
+    /*
+     * RAM held by the pool, including its buckets
+     */
+    size_t getBytes() const { return _bytes + _bucketCount * sizeof(Node*); };
+
+    // Disable moving and copying
+    StreamableKeyPool(StreamableKeyPool&& other) = delete;
+    StreamableKeyPool& operator=(StreamableKeyPool&& other) = delete;
+    StreamableKeyPool(const StreamableKeyPool&) = delete;
+    StreamableKeyPool& operator=(const StreamableKeyPool&) = delete;
+
+  private:
+    friend class StreamableDTO;
+
+    static const uint16_t IMMORTAL = 0xFFFF;
+    static const uint16_t MAX_BUCKETS = 0x8000;  // doubling it again overflows _bucketCount
+    static const uint16_t MAX_KEYS = 0xFFFF;
+
+    struct Node {
+      Node* next;
+      unsigned long hash;
+      uint16_t refs;
+      char key[1];  // allocated to fit the whole key
+    };
+
+    Node** _buckets = nullptr;
+    uint16_t _bucketCount = 0;
+    uint16_t _count = 0;
+    size_t _bytes = 0;
+
+    StreamableKeyPool() {};
+
+    /*
+     * Returns the pool's copy of key, adding it if needed, and counts one
+     * more reference to it. hash is StreamableDTO::hashCode of the key.
+     * Returns nullptr if out of memory, or if the pool is full.
+     */
+    const char* intern(const char* key, unsigned long hash);
+
+    /*
+     * Drops a reference to a key returned by intern
+     */
+    void release(const char* key);
+
+    static Node* nodeOf(const char* key);
+    bool grow();
+
+};
+
+
+#endif
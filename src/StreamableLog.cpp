@@ -0,0 +1,229 @@
+#include "StreamableLog.h"
+
+static const size_t LOCATION_LEN = 21; // "4294967295:4294967295"
+
+StreamableLog::StreamableLog(StreamableManager* manager, const char* keyField, uint8_t keyBytes):
+    _manager(manager), _keyField(keyField) {
+  _keyBytes = (keyBytes > StreamableIndex::MAX_KEY_BYTES) ? StreamableIndex::MAX_KEY_BYTES : keyBytes;
+  _latest = new StreamableDTO();
+}
+
+StreamableLog::~StreamableLog() {
+  delete _latest;
+  if (_compacted) delete _compacted;
+}
+
+bool StreamableLog::putLocation(StreamableDTO* lookup, const char* key, uint32_t offset, uint32_t length) {
+  static const char format[] PROGMEM = "%lu:%lu";
+  char location[LOCATION_LEN + 1];
+  snprintf_P(location, sizeof(location), format, static_cast<unsigned long>(offset),
+      static_cast<unsigned long>(length));
+  bool existed = lookup->exists(key);
+  lookup->put(key, location);
+  return !existed;
+}
+
+bool StreamableLog::getLocation(StreamableDTO* lookup, const char* key, uint32_t& offset, uint32_t& length) {
+  const char* location = lookup->get(key);
+  if (!location) return false;
+  char* sep;
+  offset = strtoul(location, &sep, 10);
+  length = strtoul(sep + 1, nullptr, 10);
+  return true;
+}
+
+uint32_t StreamableLog::open(SeekableStream* segment) {
+  _segment = segment;
+  _latest->clear();
+  _superseded = 0;
+  uint32_t count = 0;
+  uint32_t pos = 0;
+  uint32_t size = _segment->size();
+  char key[_manager->getBufferSize()];
+  while (pos < size) {
+    // Entries are collected first, since reading a long key moves the segment's position
+    StreamableIndex::Entry entries[SCAN_BATCH];
+    uint32_t n = scanRecords(pos, size - pos, entries, SCAN_BATCH);
+    if (n == 0) break;
+    for (uint32_t i = 0; i < n; i++) {
+      if (recordKey(entries[i], key, sizeof(key))
+          && !putLocation(_latest, key, entries[i].offset, entries[i].length)) {
+        _superseded++;
+      }
+    }
+    count += n;
+    pos = entries[n - 1].offset + entries[n - 1].length;
+  }
+  return count;
+}
+
+bool StreamableLog::recordKey(const StreamableIndex::Entry& entry, char* key, size_t size) {
+  if (!entry.key[0]) return false;
+  size_t scanned = strlen(entry.key);
+  if (scanned < _keyBytes) {
+    // The scan got the whole value
+    memcpy(key, entry.key, scanned + 1);
+    return true;
+  }
+
+  // The value may go on past what the scan kept, so read its line again
+  if (!_segment->seek(entry.offset)) return false;
+  size_t fieldLen = strlen(_keyField);
+  size_t col = 0;        // chars of the current line so far
+  size_t len = 0;        // chars of the value so far
+  bool matching = true;  // whether the line so far could be "keyField=..."
+  for (uint32_t i = 0; i <= entry.length; i++) {
+    int c = (i < entry.length) ? _segment->read() : '\n';
+    if (c < 0) return false;
+    if (c == '\n') {
+      if (matching && col > fieldLen) {
+        key[len] = '\0';
+        return true;
+      }
+      col = 0;
+      len = 0;
+      matching = true;
+      continue;
+    }
+    if (!matching || c == '\r') continue;
+    if (col < fieldLen) {
+      matching = (c == _keyField[col]);
+    } else if (col == fieldLen) {
+      matching = (c == '=');
+    } else if (len < size - 1) {
+      key[len++] = c;
+    }
+    col++;
+  }
+  return false;
+}
+
+uint32_t StreamableLog::scanRecords(uint32_t offset, uint32_t length, StreamableIndex::Entry* entries, uint32_t maxEntries) {
+  struct Capture {
+    StreamableIndex::Entry* entries;
+    uint32_t maxEntries;
+    uint32_t offset;
+    uint32_t count;
+    Capture(StreamableIndex::Entry* entries, uint32_t maxEntries, uint32_t offset):
+        entries(entries), maxEntries(maxEntries), offset(offset), count(0) {};
+  };
+  auto visitor = [](const StreamableIndex::Entry& entry, void* capture) -> bool {
+    Capture* c = static_cast<Capture*>(capture);
+    c->entries[c->count] = entry;
+    c->entries[c->count].offset += c->offset;
+    return ++c->count < c->maxEntries;
+  };
+  Capture capture(entries, maxEntries, offset);
+  BoundedStream records(_segment, offset, length);
+  StreamableIndex::scan(&records, visitor, &capture, _keyField, _keyBytes);
+  return capture.count;
+}
+
+bool StreamableLog::append(StreamableDTO* dto) {
+  if (!_segment) return false;
+  if (dto->getTypeId() == -1 && _manager->getChecksum() == StreamableChecksum::NONE) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: StreamableLog records must be typed or checksummed"));
+#endif
+    return false;
+  }
+  uint32_t offset = _segment->size();
+  if (!_segment->seek(offset)) return false;
+  _writer.segment = _segment;
+  _writer.failed = false;
+  if (!_manager->send(&_writer, dto)) return false;
+  if (_writer.failed) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: StreamableLog could not write the whole record"));
+#endif
+    _segment->truncate(offset);
+    return false;
+  }
+  uint32_t length = _segment->size() - offset;
+
+  // The key is read back from the record, so it's exactly what open() would find
+  StreamableIndex::Entry entry;
+  char key[_manager->getBufferSize()];
+  if (scanRecords(offset, length, &entry, 1) == 1 && recordKey(entry, key, sizeof(key))) {
+    if (!putLocation(_latest, key, offset, length)) {
+      _superseded++;
+    }
+  }
+  return true;
+}
+
+bool StreamableLog::get(const char* key, StreamableDTO* dto) {
+  if (!_segment) return false;
+  uint32_t offset, length;
+  if (!getLocation(_latest, key, offset, length)) return false;
+  BoundedStream record(_segment, offset, length);
+  return _manager->load(&record, dto);
+}
+
+bool StreamableLog::beginCompaction(SeekableStream* target) {
+  if (!_segment || _target) return false;
+  _target = target;
+  _compacted = new StreamableDTO();
+  _compactPos = 0;
+  _compactSuperseded = 0;
+  return true;
+}
+
+bool StreamableLog::copyRecord(const StreamableIndex::Entry& entry, const char* key) {
+  uint32_t offset = _target->size();
+  if (!_segment->seek(entry.offset) || !_target->seek(offset)) return false;
+  size_t bufferSize = _manager->getBufferSize();
+  uint8_t buffer[bufferSize];
+  uint32_t remaining = entry.length;
+  while (remaining > 0) {
+    size_t n = (remaining < bufferSize) ? remaining : bufferSize;
+    for (size_t i = 0; i < n; i++) {
+      int c = _segment->read();
+      if (c < 0) return false;
+      buffer[i] = c;
+    }
+    if (_target->write(buffer, n) != n) return false;
+    remaining -= n;
+  }
+  if (key && !putLocation(_compacted, key, offset, entry.length)) {
+    _compactSuperseded++;
+  }
+  return true;
+}
+
+bool StreamableLog::compactStep(uint8_t maxRecords = 4) {
+  if (!_target) return false;
+  if (maxRecords == 0) maxRecords = 1;
+  uint32_t size = _segment->size();
+  if (_compactPos < size) {
+    // Entries are collected first, since copying moves the segment's position
+    StreamableIndex::Entry entries[maxRecords];
+    uint32_t count = scanRecords(_compactPos, size - _compactPos, entries, maxRecords);
+    char key[_manager->getBufferSize()];
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t offset, length;
+      bool hasKey = recordKey(entries[i], key, sizeof(key));
+      bool latest = !hasKey || (getLocation(_latest, key, offset, length) && offset == entries[i].offset);
+      if (latest && !copyRecord(entries[i], hasKey ? key : nullptr)) {
+#if defined(DEBUG)
+        Serial.println(F("ERROR: StreamableLog compaction could not copy a record, giving up"));
+#endif
+        _target = nullptr;
+        delete _compacted;
+        _compacted = nullptr;
+        return false;
+      }
+    }
+    _compactPos = (count > 0) ? entries[count - 1].offset + entries[count - 1].length : size;
+    if (_compactPos < size) return false;
+  }
+
+  // Every record has been visited, so switch to the compacted segment
+  _segment = _target;
+  _target = nullptr;
+  delete _latest;
+  _latest = _compacted;
+  _compacted = nullptr;
+  _superseded = _compactSuperseded;
+  return true;
+}
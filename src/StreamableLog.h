@@ -0,0 +1,170 @@
+/*
+
+  StreamableLog.h
+
+  Append-only log of DTOs with a latest-record lookup and incremental
+  compaction
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableLog_h
+#define _strdto_StreamableLog_h
+
+
+#include <Arduino.h>
+#include "SeekableStream.h"
+#include "StreamableDTO.h"
+#include "StreamableIndex.h"
+#include "StreamableManager.h"
+
+/*
+ * An append-only log of DTOs, such as an event history on an SD card, where
+ * each record is identified by the value of one key field. Records are
+ * written by StreamableManager::send one after another, and are never
+ * rewritten, so an append only costs as much as the send.
+ *
+ * Records are found the same way as StreamableIndex finds them, so each
+ * record must be typed (starts with a meta line) or the manager must have a
+ * checksum enabled (ends with a trailer).
+ *
+ * open() reads the log once to find the latest record for each key, and
+ * keeps that lookup in memory, so get() is a single seek.
+ *
+ * If a record can't be written in full (say the card is full), append()
+ * truncates the segment back to where the record started, if the segment
+ * supports it (see SeekableStream::truncate). Otherwise the partial record
+ * is left at the end, and isn't found by get() until the log is reopened.
+ *
+ * Appending the same key again leaves the older record in the log. To drop
+ * those superseded records, compaction copies the latest record for each key
+ * to a new segment a few records at a time, so it can be spread over many
+ * calls to loop(). Records appended meanwhile are copied too. Once it's done,
+ * the log switches to the new segment and the old one can be deleted.
+ *
+ *   StreamableLog log(&manager, "id");
+ *   log.open(&segment);
+ *   log.append(&event);
+ *   log.get("42", &event);
+ */
+class StreamableLog {
+
+  public:
+    /*
+     * Records are looked up by keyField's value as sent. The first keyBytes
+     * chars (up to StreamableIndex::MAX_KEY_BYTES) are picked up while
+     * scanning the log, and a record with a longer value is read again to
+     * get the rest, so keyBytes only needs to cover most keys.
+     */
+    StreamableLog(StreamableManager* manager, const char* keyField,
+        uint8_t keyBytes = StreamableIndex::MAX_KEY_BYTES);
+    ~StreamableLog();
+
+    /*
+     * Uses segment for the log, reading what's already in it. Returns the
+     * number of records found.
+     */
+    uint32_t open(SeekableStream* segment);
+
+    /*
+     * Sends the DTO to the end of the log. Returns false if the DTO can't be
+     * framed, the manager skipped an unchanged send, or the record couldn't
+     * be written in full.
+     */
+    bool append(StreamableDTO* dto);
+
+    /*
+     * Loads the latest record with the key into the DTO
+     */
+    bool get(const char* key, StreamableDTO* dto);
+
+    /*
+     * Records that have been replaced by a later record with the same key
+     */
+    uint32_t getSupersededCount() const { return _superseded; };
+
+    /*
+     * Starts compacting into target, which must be empty. Returns false if
+     * a compaction is already in progress.
+     */
+    bool beginCompaction(SeekableStream* target);
+
+    /*
+     * Copies or skips up to maxRecords records. Returns true once compaction
+     * is done and the log is using the target segment. If a record can't be
+     * copied, compaction is abandoned (isCompacting() becomes false) and the
+     * log keeps using the original segment.
+     */
+    bool compactStep(uint8_t maxRecords = 4);
+
+    bool isCompacting() const { return _target != nullptr; };
+
+    // Disable moving and copying
+    StreamableLog(StreamableLog&& other) = delete;
+    StreamableLog& operator=(StreamableLog&& other) = delete;
+    StreamableLog(const StreamableLog&) = delete;
+    StreamableLog& operator=(const StreamableLog&) = delete;
+
+  private:
+    /*
+     * Passes what the manager sends through to the segment, noting whether
+     * every byte was written
+     */
+    class SegmentWriter: public Stream {
+      public:
+        SeekableStream* segment = nullptr;
+        bool failed = false;
+        size_t write(uint8_t b) override {
+          if (segment->write(b) == 1) return 1;
+          failed = true;
+          return 0;
+        };
+        int availableForWrite() override { return segment->availableForWrite(); };
+        void flush() override { segment->flush(); };
+        int available() override { return 0; };
+        int read() override { return -1; };
+        int peek() override { return -1; };
+    };
+
+    static const uint8_t SCAN_BATCH = 4;  // entries collected at a time by open()
+
+    StreamableManager* _manager;
+    const char* _keyField;
+    uint8_t _keyBytes;
+    SeekableStream* _segment = nullptr;
+    SegmentWriter _writer;
+    StreamableDTO* _latest;               // key -> "offset:length" in _segment
+    uint32_t _superseded = 0;
+
+    SeekableStream* _target = nullptr;
+    StreamableDTO* _compacted = nullptr;  // key -> "offset:length" in _target
+    uint32_t _compactPos = 0;
+    uint32_t _compactSuperseded = 0;
+
+    /*
+     * Adds a record to a lookup. Returns false if the key was already there.
+     */
+    static bool putLocation(StreamableDTO* lookup, const char* key, uint32_t offset, uint32_t length);
+    static bool getLocation(StreamableDTO* lookup, const char* key, uint32_t& offset, uint32_t& length);
+
+    /*
+     * Finds the records in length bytes of the segment, starting at offset,
+     * and stores their entries (up to maxEntries) with absolute offsets.
+     * Returns the number stored.
+     */
+    uint32_t scanRecords(uint32_t offset, uint32_t length, StreamableIndex::Entry* entries, uint32_t maxEntries);
+
+    /*
+     * Sets key (size chars, including the terminator) to the record's full
+     * key. Returns false if the record has no key field.
+     */
+    bool recordKey(const StreamableIndex::Entry& entry, char* key, size_t size);
+
+    bool copyRecord(const StreamableIndex::Entry& entry, const char* key);
+
+};
+
+
+#endif
@@ -1,25 +1,182 @@
 #include "StreamableManager.h"
+#include "StreamableScanner.h"
 
-char* StreamableManager::readLine(Stream* s, char terminator = '\n') {
+#if defined(STRDTO_STATS)
+#define IO_STAT(expr) expr
+#define IO_PHASE_START(var) unsigned long var = micros()
+#define IO_PHASE_END(var, field) _ioStats.field += micros() - var
+#else
+#define IO_STAT(expr)
+#define IO_PHASE_START(var)
+#define IO_PHASE_END(var, field)
+#endif
+
+static const char CHECKSUM_KEY[] PROGMEM = "__crc=";
+static const size_t CHECKSUM_KEY_LEN = 6;
+
+static const char META_KEY[] PROGMEM = "__tvid=";
+static const size_t META_KEY_LEN = 7;
+static const char BATCH_KEY[] PROGMEM = "__batch=";
+static const size_t BATCH_KEY_LEN = 8;
+static const char BATCH_SEPARATOR = '|';
+static const char BATCH_ESCAPE = '\\';
+static const char BATCH_ABSENT = '~';
+static const char BATCH_DELTA = '^';
+
+struct StreamableManager::BatchColumn {
+  char* key;
+  bool delta;
+  bool hasPrev;
+  long prev;
+};
+
+/*
+ * True if the value is an integer that fits in a long, written exactly the
+ * way it will be printed again after delta decoding
+ */
+static bool isBatchInteger(const char* value) {
+  if (*value == '\0' || strlen(value) > 11) return false;
+  char* end;
+  long parsed = strtol(value, &end, 10);
+  if (*end != '\0') return false;
+  char canonical[12];
+  static const char format[] PROGMEM = "%ld";
+  snprintf_P(canonical, sizeof(canonical), format, parsed);
+  return strcmp(canonical, value) == 0;
+}
+
+/*
+ * Splits a "key=value" line from toLine in place and returns the value
+ */
+static char* splitBatchLine(char* line) {
+  char* sep = strchr(line, '=');
+  if (!sep) return line + strlen(line);
+  *sep = '\0';
+  return sep + 1;
+}
+
+/*
+ * Points the manager's active checksum at its configured checksum (if any)
+ * for the duration of a send or load, so that every byte written or read is
+ * added to it.
+ */
+class ChecksumScope {
+  public:
+    ChecksumScope(StreamableChecksum*& active, StreamableChecksum& checksum): _active(active) {
+      if (checksum.getType() != StreamableChecksum::NONE) {
+        checksum.reset();
+        _active = &checksum;
+      }
+    };
+    ~ChecksumScope() { _active = nullptr; };
+  private:
+    StreamableChecksum*& _active;
+};
+
+void StreamableManager::setCredits(Stream* link, uint8_t blockBytes = 16, uint8_t windowBlocks = 4,
+    unsigned long timeoutMillis = 1000) {
+  _creditLink = link;
+  _creditBlockBytes = (blockBytes > 0) ? blockBytes : 1;
+  _creditWindowBlocks = windowBlocks;
+  _creditTimeoutMillis = timeoutMillis;
+  _sendCredit = 0;
+  _creditConsumed = 0;
+  _creditsGranted = false;
+}
+
+void StreamableManager::grantCredits() {
+  if (!_creditLink) return;
+  for (uint8_t i = 0; i < _creditWindowBlocks; i++) {
+    _creditLink->write(CREDIT_GRANT);
+  }
+  _creditConsumed = 0;
+  _creditsGranted = true;
+}
+
+bool StreamableManager::takeCredit(Stream* dest) {
+  if (_sendCredit == 0) {
+    IO_PHASE_START(waitStart);
+    unsigned long start = millis();
+    while (_sendCredit == 0) {
+      if (dest->available()) {
+        if (dest->read() == CREDIT_GRANT) _sendCredit += _creditBlockBytes;
+      } else if (millis() - start >= _creditTimeoutMillis) {
+        IO_PHASE_END(waitStart, flowControlWaitMicros);
+        IO_STAT(_ioStats.creditTimeouts++);
+#if defined(DEBUG)
+        Serial.println(F("ERROR: No credit from the receiver, dropping the rest of the message"));
+#endif
+        return false;
+      }
+    }
+    IO_PHASE_END(waitStart, flowControlWaitMicros);
+  }
+  _sendCredit--;
+  return true;
+}
+
+bool StreamableManager::hasMoreInput(Stream* src) {
+  if (src->available()) return true;
+  if (!isCreditLink(src)) return false;
+  if (!_creditsGranted) grantCredits();
+  unsigned long start = millis();
+  while (!src->available()) {
+    if (millis() - start >= _creditTimeoutMillis) return false;
+  }
+  return true;
+}
+
+int StreamableManager::readByte(Stream* src) {
+  if (!isCreditLink(src)) {
+    return src->available() ? src->read() : -1;
+  }
+  if (!_creditsGranted) grantCredits();
+  while (hasMoreInput(src)) {
+    int c = src->read();
+    if (c == CREDIT_GRANT) {
+      // A grant for our own sends over the link
+      _sendCredit += _creditBlockBytes;
+      continue;
+    }
+    if (++_creditConsumed >= _creditBlockBytes) {
+      src->write(CREDIT_GRANT);
+      _creditConsumed = 0;
+    }
+    return c;
+  }
+  return -1;
+}
+
+char* StreamableManager::readLine(Stream* s, char terminator = '\n', bool stopAtArray = false) {
+  IO_PHASE_START(readStart);
   char* buffer = new char[_bufferBytes]();
-  uint8_t i = 0;
-  while (s->available()) {
-    char c = s->read();
+  size_t i = 0;
+  int next;
+  while ((next = readByte(s)) >= 0) {
+    char c = next;
+    IO_STAT(_ioStats.bytesIn++);
+    if (_activeChecksum) _activeChecksum->update(c);
     if (c == terminator || i >= _bufferBytes - 1) {
-#if defined(DEBUG)
       if (i >= _bufferBytes - 1) {
+        IO_STAT(_ioStats.linesTruncated++);
+#if defined(DEBUG)
         Serial.print(F("readLine: line truncated to "));
         Serial.print(_bufferBytes);
         Serial.println(F(" chars"));
-      }
 #endif
+      }
       break;
     }
     buffer[i++] = c;
+    if (stopAtArray && c == '=' && i >= 3 && buffer[i - 2] == ']' && buffer[i - 3] == '[') {
+      break;
+    }
   }
   buffer[i] = '\0';
+  IO_PHASE_END(readStart, readMicros);
 
   // Trim leading and trailing whitespace
+  IO_PHASE_START(trimStart);
   char* start = buffer;
   while (isspace(*start)) start++;
   char* end = start + strlen(start) - 1;
@@ -28,28 +185,74 @@ char* StreamableManager::readLine(Stream* s, char terminator = '\n') {
     // Allocate a new trimmed string
     size_t len = strlen(start);
     char* trimmed = new char[len + 1];
-    strncpy(trimmed, start, len);
+    memcpy(trimmed, start, len);
     trimmed[len] = '\0';
     delete[] buffer;
+    IO_PHASE_END(trimStart, trimMicros);
     return trimmed;
   }
+  IO_PHASE_END(trimStart, trimMicros);
   return buffer;
 }
 
-void StreamableManager::sendWithFlowControl(const char* line, Stream* dest) {
-  for (size_t i = 0; i < strlen(line); i++) {
-    while (dest->availableForWrite() == 0) {} // wait
-    dest->write(line[i]);
+void StreamableManager::waitForWrite(Stream* dest) {
+  if (dest->availableForWrite() != 0) return;
+  // Only a wait that blocks is timed, since micros() itself takes a few microseconds on AVR
+  IO_PHASE_START(waitStart);
+  while (dest->availableForWrite() == 0) {} // wait
+  IO_PHASE_END(waitStart, flowControlWaitMicros);
+}
+
+void StreamableManager::sendWithFlowControl(const char* line, size_t len, Stream* dest) {
+  for (size_t i = 0; i <= len; i++) {
+    waitForWrite(dest);
+    char c = i < len ? line[i] : '\n';
+    dest->write(c);
+    if (_activeChecksum) _activeChecksum->update(c);
   }
-  while (dest->availableForWrite() == 0) {}
-  dest->write('\n');
+  IO_STAT(_ioStats.bytesOut += len + 1);
 }
 
-void StreamableManager::sendWithoutFlowControl(const char* line, Stream* dest) {
-  for (size_t i = 0; i < strlen(line); i++) {
+void StreamableManager::sendWithoutFlowControl(const char* line, size_t len, Stream* dest) {
+  for (size_t i = 0; i < len; i++) {
     dest->write(line[i]);
+    if (_activeChecksum) _activeChecksum->update(line[i]);
   }
   dest->write('\n');
+  if (_activeChecksum) _activeChecksum->update('\n');
+  IO_STAT(_ioStats.bytesOut += len + 1);
+}
+
+void StreamableManager::sendWithCredits(const char* line, size_t len, Stream* dest, bool flowControl) {
+  for (size_t i = 0; i <= len && !_creditStalled; i++) {
+    if (!takeCredit(dest)) {
+      _creditStalled = true;
+      break;
+    }
+    if (flowControl) {
+      waitForWrite(dest);
+    }
+    char c = i < len ? line[i] : '\n';
+    dest->write(c);
+    if (_activeChecksum) _activeChecksum->update(c);
+    IO_STAT(_ioStats.bytesOut++);
+  }
+}
+
+void StreamableManager::sendLine(const char* line, Stream* dest, bool flowControl) {
+  sendLine(line, strlen(line), dest, flowControl);
+}
+
+void StreamableManager::sendLine(const char* line, size_t len, Stream* dest, bool flowControl) {
+  IO_PHASE_START(writeStart);
+  if (isCreditLink(dest)) {
+    sendWithCredits(line, len, dest, flowControl);
+  } else if (flowControl) {
+    sendWithFlowControl(line, len, dest);
+  } else {
+    sendWithoutFlowControl(line, len, dest);
+  }
+  IO_PHASE_END(writeStart, writeMicros);
 }
 
 void StreamableManager::sendMetaLine(StreamableDTO* dto, Stream* dest, bool flowControl = false) {
@@ -62,100 +265,492 @@ void StreamableManager::sendMetaLine(StreamableDTO* dto, Stream* dest, bool flow
   const uint8_t serialVer = dto->getSerialVersion();
   static const char format[] PROGMEM = "%s=%u|%u";
   snprintf_P(metaLine, totalLen, format, key, typeId, serialVer);
-  if (flowControl) {
-    sendWithFlowControl(metaLine, dest);
+  sendLine(metaLine, dest, flowControl);
+}
+
+bool StreamableManager::checkCompatibility(StreamableDTO* dto, const StreamableDTO::MetaInfo& meta) {
+  if (dto->isCompatibleTypeAndVersion(meta)) {
+    return true;
+  }
+#if defined(STRDTO_STATS)
+  if (dto->getTypeId() != meta.typeId) {
+    _ioStats.typeRejects++;
   } else {
-    sendWithoutFlowControl(metaLine, dest);
+    _ioStats.versionRejects++;
   }
+#endif
+  return false;
 }
 
 bool StreamableManager::load(Stream* src, StreamableDTO* dto, uint16_t lineNumStart = 0) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  return loadLines(src, dto, lineNumStart);
+}
+
+bool StreamableManager::loadBuffer(const char* data, size_t length, StreamableDTO* dto,
+      uint16_t lineNumStart = 0, size_t* used = nullptr) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  StreamableScanner::Line line;
+  size_t bodyLength = length;  // the lines to parse, before any trailer
+  size_t consumed = length;    // the message, including the trailer
+  if (_activeChecksum) {
+    // The data is all here, so the trailer is checked before anything is
+    // parsed, and a corrupted message leaves the DTO as it was
+    StreamableScanner scanner(data, length);
+    const char* lineStart = data;
+    bool checksumMatched = false;
+    while (scanner.next(line)) {
+      const char* lineEnd = scanner.position();
+      if (line.length >= CHECKSUM_KEY_LEN && strncmp_P(line.start, CHECKSUM_KEY, CHECKSUM_KEY_LEN) == 0) {
+        // The trailer ends the message, and covers every byte before it
+        char hex[9] = {};
+        size_t hexLen = line.length - CHECKSUM_KEY_LEN;
+        memcpy(hex, line.start + CHECKSUM_KEY_LEN, hexLen < 8 ? hexLen : 8);
+        checksumMatched = (StreamableChecksum::fromHex(hex) == _checksum.value());
+        bodyLength = lineStart - data;
+        consumed = lineEnd - data;
+        break;
+      }
+      for (const char* p = lineStart; p < lineEnd; p++) _activeChecksum->update(*p);
+      lineStart = lineEnd;
+    }
+    if (!checksumMatched) {
+      IO_STAT(_ioStats.bytesIn += consumed);
+      IO_STAT(_ioStats.checksumFailures++);
+#if defined(DEBUG)
+      Serial.println(F("ERROR: Checksum missing or incorrect, discarding the message"));
+#endif
+      if (used) *used = consumed;
+      return false;
+    }
+    IO_STAT(_ioStats.bytesIn += consumed - bodyLength);
+  }
+
+  StreamableScanner scanner(data, bodyLength);
+  const char* lineStart = data;
   uint16_t lineNumber = lineNumStart;
-  while (src->available()) {
-    char* line = readLine(src);
+  bool result = true;
+  while (result && scanner.next(line)) {
+    const char* lineEnd = scanner.position();
+    IO_STAT(_ioStats.bytesIn += lineEnd - lineStart);
+    const char* contentEnd = (lineEnd > lineStart && lineEnd[-1] == '\n') ? lineEnd - 1 : lineEnd;
+    result = loadBufferLine(dto, line, lineStart, contentEnd, lineNumber);
+    lineStart = lineEnd;
+  }
+  if (used) *used = result ? consumed : lineStart - data;
+  return result;
+}
+
+bool StreamableManager::loadBufferLine(StreamableDTO* dto, StreamableScanner::Line& line,
+      const char* lineStart, const char* contentEnd, uint16_t& lineNumber) {
+  if (lineNumber == 0) {
+    IO_PHASE_START(metaStart);
+    char metaLine[line.length + 1];
+    memcpy(metaLine, line.start, line.length);
+    metaLine[line.length] = '\0';
+    StreamableDTO::MetaInfo meta;
+    bool isMeta = StreamableDTO::parseMetaLine(metaLine, meta);
+    bool compatible = !isMeta || checkCompatibility(dto, meta);
+    IO_PHASE_END(metaStart, metaMicros);
+    if (isMeta) {
+      lineNumber++;
+      return compatible;
+    }
+  }
+  IO_PHASE_START(parseStart);
+  const char* sep = line.hasSeparator ? line.value : nullptr;
+  while (sep && *sep != '=') sep--; // back over the whitespace after '='
+  if (sep && sep - line.start >= 2 && sep[-1] == ']' && sep[-2] == '[') {
+    size_t nameLen = sep - 2 - line.start;
+    char name[nameLen + 1];
+    memcpy(name, line.start, nameLen);
+    name[nameLen] = '\0';
+    StreamableArrayBase* array = dto->getArray(name);
+    if (array) {
+      bool parsed = parseArray(array, sep + 1, contentEnd);
+      IO_PHASE_END(parseStart, parseMicros);
+      if (!parsed) return false;
+      IO_STAT(_ioStats.linesParsed++);
+      lineNumber++;
+      return true;
+    }
+  }
+  if (static_cast<size_t>(contentEnd - lineStart) > _bufferBytes - 1) {
+    // Cut short like readLine would, before trimming
+    IO_STAT(_ioStats.linesTruncated++);
+#if defined(DEBUG)
+    Serial.print(F("loadBuffer: line truncated to "));
+    Serial.print(_bufferBytes);
+    Serial.println(F(" chars"));
+#endif
+    StreamableScanner::split(lineStart, _bufferBytes - 1, line);
+  }
+  bool parsed;
+  if (dto->_lazyLoad) {
+    char raw[line.length + 1];
+    memcpy(raw, line.start, line.length);
+    raw[line.length] = '\0';
+    parsed = dto->appendRawLine(lineNumber++, raw);
+  } else {
+    parsed = dto->parseFields(lineNumber++, line.key, line.keyLength, line.value, line.valueLength);
+  }
+  IO_PHASE_END(parseStart, parseMicros);
+  IO_STAT(if (parsed) _ioStats.linesParsed++);
+  return parsed;
+}
+
+bool StreamableManager::parseArray(StreamableArrayBase* array, const char* p, const char* end) {
+  array->clear();
+  char element[StreamableArrayBase::MAX_ELEMENT_CHARS];
+  size_t len = 0;
+  for (; p <= end; p++) {
+    if (p == end || *p == ',') {
+      element[len] = '\0';
+      if (len > 0 && !array->appendText(element)) return false;
+      len = 0;
+    } else if (!isspace(*p) && len < sizeof(element) - 1) {
+      element[len++] = *p;
+    }
+  }
+  return true;
+}
+
+bool StreamableManager::loadLines(Stream* src, StreamableDTO* dto, uint16_t lineNumStart) {
+  if (!_activeChecksum) {
+    return parseLines(src, dto, dto, lineNumStart);
+  }
+
+  // Lines are held back until the trailer checks out, so a corrupted message
+  // leaves the DTO as it was
+  StreamableDTO pending;
+  pending.setLazyLoad(true);
+  bool loaded = parseLines(src, dto, &pending, lineNumStart);
+  if (loaded) {
+    for (uint16_t i = 0; i < pending._rawLineCount && loaded; i++) {
+      if (pending._rawOffsets[i] == StreamableDTO::RAW_CONSUMED) continue;
+      const char* line = pending._rawBuffer + pending._rawOffsets[i];
+      uint16_t lineNumber = pending._rawFirstLineNumber + i;
+      loaded = dto->_lazyLoad ? dto->appendRawLine(lineNumber, line) : dto->parseLine(lineNumber, line);
+    }
+  }
+  StreamableArrayBase* array = pending._arrays;
+  pending._arrays = nullptr;
+  while (array) {
+    StreamableArrayBase* next = array->_next;
+    if (loaded) {
+      // Swap the elements into the DTO's array, so the old ones are freed below
+      StreamableArrayBase* loadedInto = dto->getArray(array->_key);
+      swapArrays(array, loadedInto);
+    }
+    delete array;
+    array = next;
+  }
+  return loaded;
+}
+
+StreamableArrayBase* StreamableManager::pendingArray(StreamableDTO* pending, StreamableArrayBase* array) {
+  StreamableArrayBase* scratch = pending->getArray(array->_key);
+  if (!scratch) {
+    scratch = new StreamableArrayBase(array->_key, array->_elementBytes, array->_kind);
+    pending->addArray(scratch);
+  }
+  return scratch;
+}
+
+void StreamableManager::swapArrays(StreamableArrayBase* a, StreamableArrayBase* b) {
+  uint8_t* data = a->_data;
+  uint16_t size = a->_size;
+  uint16_t capacity = a->_capacity;
+  a->_data = b->_data;
+  a->_size = b->_size;
+  a->_capacity = b->_capacity;
+  b->_data = data;
+  b->_size = size;
+  b->_capacity = capacity;
+}
+
+bool StreamableManager::parseLines(Stream* src, StreamableDTO* dto, StreamableDTO* target, uint16_t lineNumStart) {
+  uint16_t lineNumber = lineNumStart;
+  bool checksumMatched = false;
+  while (hasMoreInput(src)) {
+    uint32_t expected = _checksum.value();
+    char* line = readLine(src, '\n', true);
+    if (isCreditLink(src) && line[0] == '\0') {
+      // The end of a message sent over the credit link
+      delete[] line;
+      break;
+    }
+    if (_activeChecksum && strncmp_P(line, CHECKSUM_KEY, CHECKSUM_KEY_LEN) == 0) {
+      // The trailer ends the message, and covers every byte before it
+      checksumMatched = (StreamableChecksum::fromHex(line + CHECKSUM_KEY_LEN) == expected);
+      delete[] line;
+      break;
+    }
     if (lineNumber == 0) {
-      StreamableDTO::MetaInfo* meta = dto->parseMetaLine(line);
-      if (meta) {
-        if (dto->isCompatibleTypeAndVersion(meta)) {
-          delete meta;
+      IO_PHASE_START(metaStart);
+      StreamableDTO::MetaInfo meta;
+      if (StreamableDTO::parseMetaLine(line, meta)) {
+        if (line) delete[] line;
+        bool compatible = checkCompatibility(dto, meta);
+        IO_PHASE_END(metaStart, metaMicros);
+        if (compatible) {
           lineNumber++;
           continue;
         } else {
-          if (line) delete[] line;
           return false; // incompatible type or version
         }
       }
+      IO_PHASE_END(metaStart, metaMicros);
     }
-    if (!dto->parseLine(lineNumber++, line)) {
+    size_t len = strlen(line);
+    if (len >= 3 && strcmp_P(line + len - 3, PSTR("[]=")) == 0) {
+      line[len - 3] = '\0';
+      StreamableArrayBase* array = dto->getArray(line);
+      if (array && target != dto) array = pendingArray(target, array);
+      if (array) {
+        delete[] line;
+        IO_PHASE_START(parseStart);
+        bool parsed = readArray(src, array);
+        IO_PHASE_END(parseStart, parseMicros);
+        if (!parsed) return false;
+        IO_STAT(_ioStats.linesParsed++);
+        lineNumber++;
+        continue;
+      }
+      // Not an array of this DTO, so the elements are an ordinary value
+      line[len - 3] = '[';
+      char* value = readLine(src);
+      char* joined = new char[_bufferBytes];
+      snprintf_P(joined, _bufferBytes, PSTR("%s%s"), line, value);
+      delete[] line;
+      delete[] value;
+      line = joined;
+    }
+    IO_PHASE_START(parseStart);
+    bool parsed = target->_lazyLoad ? target->appendRawLine(lineNumber++, line)
+                                    : target->parseLine(lineNumber++, line);
+    IO_PHASE_END(parseStart, parseMicros);
+    if (!parsed) {
       if (line) delete[] line;
       return false;
     }
+    IO_STAT(_ioStats.linesParsed++);
     if (line) delete[] line;
   }
+  if (_activeChecksum && !checksumMatched) {
+    IO_STAT(_ioStats.checksumFailures++);
+#if defined(DEBUG)
+    Serial.println(F("ERROR: Checksum missing or incorrect, discarding the message"));
+#endif
+    return false;
+  }
   return true;
 }
 
-StreamableDTO* StreamableManager::load(Stream* src, TypeMapper typeMapper) {
-  char* metaLine;
-  if (src->available()) {
+bool StreamableManager::readMetaLine(Stream* src, StreamableDTO::MetaInfo& meta) {
+  char* metaLine = nullptr;
+  if (hasMoreInput(src)) {
     metaLine = readLine(src);
   }
-  StreamableDTO::MetaInfo* meta = StreamableDTO::parseMetaLine(metaLine);
+  IO_PHASE_START(metaStart);
+  bool found = StreamableDTO::parseMetaLine(metaLine, meta);
+  IO_PHASE_END(metaStart, metaMicros);
   if (metaLine) delete[] metaLine;
-  if (!meta) {
 #if defined(DEBUG)
+  if (!found) {
     Serial.println(F("ERROR: Could not determine type from stream"));
+  }
 #endif
-    return nullptr;        
+  return found;
+}
+
+bool StreamableManager::loadTyped(Stream* src, StreamableDTO* dto, const StreamableDTO::MetaInfo& meta) {
+  if (!checkCompatibility(dto, meta)) {
+    return false; // incorrect type or incompatible version
+  }
+  if (!loadLines(src, dto, 1)) {
+    return false;
   }
-  StreamableDTO* dto = typeMapper(meta->typeId);
+  dto->_deserializedVer = meta.serialVersion;
+  return true;
+}
+
+StreamableDTO* StreamableManager::load(Stream* src, TypeMapper typeMapper) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  StreamableDTO::MetaInfo meta;
+  if (!readMetaLine(src, meta)) {
+    return nullptr;
+  }
+  StreamableDTO* dto = typeMapper(meta.typeId);
   if (!dto) {
 #if defined(DEBUG)
     Serial.print(F("ERROR: Unknown typeId: "));
-    Serial.println(meta->typeId);
+    Serial.println(meta.typeId);
 #endif
-    delete meta;      
     return nullptr;        
   }
-  if (dto->isCompatibleTypeAndVersion(meta)) {
-    load(src, dto, 1);
-    dto->_deserializedVer = meta->serialVersion;
-  } else {
-    // Incorrect type or incompatible version
+  if (!loadTyped(src, dto, meta)) {
     delete dto;
-    delete meta;      
     return nullptr;
   }
-  delete meta;      
   return dto;
 }
 
-void StreamableManager::send(Stream* dest, StreamableDTO* dto, bool flowControl = false) {
+StreamableDTO* StreamableManager::load(Stream* src, StreamableTypeRegistry* registry) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  StreamableDTO::MetaInfo meta;
+  if (!readMetaLine(src, meta)) {
+    return nullptr;
+  }
+  StreamableDTO* dto = registry->acquire(meta.typeId);
+  if (!dto) {
+#if defined(DEBUG)
+    Serial.print(F("ERROR: Unknown typeId: "));
+    Serial.println(meta.typeId);
+#endif
+    return nullptr;        
+  }
+  if (!loadTyped(src, dto, meta)) {
+    registry->release(dto);
+    return nullptr;
+  }
+  return dto;
+}
+
+bool StreamableManager::sentBefore(Stream* dest, int16_t typeId, uint32_t fingerprint) const {
+  for (uint8_t i = 0; i < SENT_SLOTS; i++) {
+    const SentFingerprint& sent = _sent[i];
+    if (sent.dest == dest) {
+      return sent.typeId == typeId && sent.fingerprint == fingerprint;
+    }
+  }
+  return false;
+}
+
+void StreamableManager::recordSend(Stream* dest, int16_t typeId, uint32_t fingerprint) {
+  for (uint8_t i = 0; i < SENT_SLOTS; i++) {
+    SentFingerprint& sent = _sent[i];
+    if (sent.dest != dest) continue;
+    sent.typeId = typeId;
+    sent.fingerprint = fingerprint;
+    return;
+  }
+  _sent[_nextSentSlot] = { dest, typeId, fingerprint };
+  _nextSentSlot = (_nextSentSlot + 1) % SENT_SLOTS;
+}
+
+void StreamableManager::forgetSent(Stream* dest = nullptr) {
+  for (uint8_t i = 0; i < SENT_SLOTS; i++) {
+    if (!dest || _sent[i].dest == dest) {
+      _sent[i].dest = nullptr;
+    }
+  }
+}
+
+bool StreamableManager::send(Stream* dest, StreamableDTO* dto, bool flowControl = false) {
+  uint32_t fingerprint = 0;
+  if (_skipUnchanged) {
+    fingerprint = dto->getFingerprint();
+    if (sentBefore(dest, dto->getTypeId(), fingerprint)) {
+      IO_STAT(_ioStats.sendsSkipped++);
+      return false;
+    }
+  }
+  _creditStalled = false;
+  ChecksumScope scope(_activeChecksum, _checksum);
   if (dto->getTypeId() != -1) {
     sendMetaLine(dto, dest, flowControl);
   }
-  struct Capture {
-    Stream* dest;
-    StreamableDTO* dto;
-    size_t bufferSize;
-    bool flowControl;
-    Capture(Stream* dest, StreamableDTO* dto, size_t bufferSize, bool flowControl):
-        dest(dest), dto(dto), bufferSize(bufferSize), flowControl(flowControl) {};
-  };
-  auto entryProcessor = [](const char* key, const char* value, bool keyPmem, bool valPmem, void* capture) -> bool {
-    Capture* c = static_cast<Capture*>(capture);
-    char line[c->bufferSize];
-    if (c->dto->toLine(key, value, keyPmem, valPmem, line, c->bufferSize)) {
-      if (c->flowControl) {
-        sendWithFlowControl(line, c->dest);
-      } else {
-        sendWithoutFlowControl(line, c->dest);
-      }
+  dto->forEachTableEntry([&](const StreamableDTO::EntryView& e) -> bool {
+    char line[_bufferBytes];
+    size_t len = dto->toLine(e, line, _bufferBytes);
+    if (len) {
+      sendLine(line, len, dest, flowControl);
+    }
+    return true;
+  });
+
+  // Lines of a lazy loaded DTO that were never parsed are re-sent as received
+  dto->forEachRawLine([&](const char* line) -> bool {
+    sendLine(line, dest, flowControl);
+    return true;
+  });
+
+  for (StreamableArrayBase* array = dto->_arrays; array; array = array->_next) {
+    sendArray(array, dest, flowControl);
+  }
+
+  sendTrailer(dest, flowControl);
+  if (_creditStalled) return false;
+  if (_skipUnchanged) recordSend(dest, dto->getTypeId(), fingerprint);
+  return true;
+}
+
+void StreamableManager::sendArray(StreamableArrayBase* array, Stream* dest, bool flowControl) {
+  for (const char* p = array->_key; *p; p++) {
+    sendChar(*p, dest, flowControl);
+  }
+  sendChar('[', dest, flowControl);
+  sendChar(']', dest, flowControl);
+  sendChar('=', dest, flowControl);
+  char element[StreamableArrayBase::MAX_ELEMENT_CHARS];
+  for (uint16_t i = 0; i < array->_size && !_creditStalled; i++) {
+    if (i > 0) sendChar(',', dest, flowControl);
+    array->elementText(i, element);
+    for (const char* p = element; *p; p++) {
+      sendChar(*p, dest, flowControl);
+    }
+  }
+  sendChar('\n', dest, flowControl);
+}
+
+bool StreamableManager::readArray(Stream* src, StreamableArrayBase* array) {
+  array->clear();
+  char element[StreamableArrayBase::MAX_ELEMENT_CHARS];
+  size_t len = 0;
+  int next;
+  while ((next = readByte(src)) >= 0) {
+    char c = next;
+    IO_STAT(_ioStats.bytesIn++);
+    if (_activeChecksum) _activeChecksum->update(c);
+    if (c == ',' || c == '\n') {
+      element[len] = '\0';
+      if (len > 0 && !array->appendText(element)) return false;
+      len = 0;
+      if (c == '\n') return true;
+    } else if (!isspace(c) && len < sizeof(element) - 1) {
+      element[len++] = c;
+    }
+  }
+  element[len] = '\0';
+  return len == 0 || array->appendText(element);
+}
+
+bool StreamableManager::sendScope(Stream* dest, StreamableDTO* dto, const char* scope, bool flowControl = false) {
+  _creditStalled = false;
+  ChecksumScope checksumScope(_activeChecksum, _checksum);
+  dto->forEachInScope(scope, [&](const StreamableDTO::EntryView& e) -> bool {
+    char line[_bufferBytes];
+    size_t len = dto->toLine(e, line, _bufferBytes);
+    if (len) {
+      sendLine(line, len, dest, flowControl);
     }
     return true;
-  };
-  Capture capture(dest, dto, _bufferBytes, flowControl);
-  dto->processEntries(entryProcessor, &capture);
+  });
+  sendTrailer(dest, flowControl);
+  return !_creditStalled;
+}
+
+void StreamableManager::sendTrailer(Stream* dest, bool flowControl) {
+  if (_activeChecksum) {
+    char trailer[CHECKSUM_KEY_LEN + 9];
+    strcpy_P(trailer, CHECKSUM_KEY);
+    StreamableChecksum::toHex(_activeChecksum->value(), trailer + CHECKSUM_KEY_LEN);
+    _activeChecksum = nullptr; // the trailer itself isn't covered
+    sendLine(trailer, dest, flowControl);
+  } else if (isCreditLink(dest)) {
+    sendLine("", dest, flowControl); // so the receiver knows not to wait for more
+  }
 }
 
 void StreamableManager::pipe(Stream* src, Stream* dest, FilterFunction filter = nullptr, bool flowControl = false, void* state = nullptr) {
@@ -165,17 +760,499 @@ void StreamableManager::pipe(Stream* src, Stream* dest, FilterFunction filter =
 #endif    
     return;
   }
-  DestinationStream out(dest);
+  DestinationStream out(dest, this);
   bool stop = false;
-  while (src->available()) {
+  _creditStalled = false;
+  while (!_creditStalled && hasMoreInput(src)) {
     char* line = readLine(src);
+    bool end = isCreditLink(src) && line[0] == '\0'; // the end of a message sent over the credit link
     if (filter == nullptr) {
       out.println(line, flowControl);
     } else {
       stop = !filter(line, &out, state);
     }
     if (line) delete[] line;
-    if (stop) break;
+    if (stop || end) break;
+  }
+}
+
+
+
+void StreamableManager::PipeLine::split(char* line) {
+  StreamableScanner::Line split;
+  StreamableScanner::split(line, strlen(line), split);
+  _line = line;
+  _key = split.key;
+  _keyLen = split.keyLength;
+  _value = split.hasSeparator ? split.value : nullptr;
+  _valueLen = split.valueLength;
+  // Terminate the trimmed key and value in place, and remember what was
+  // there to put the line back together if it's sent unchanged
+  _keyEnd = const_cast<char*>(split.key) + _keyLen;
+  _keyEndChar = *_keyEnd;
+  *_keyEnd = '\0';
+  _valueEnd = const_cast<char*>(split.value) + _valueLen;
+  _valueEndChar = *_valueEnd;
+  *_valueEnd = '\0';
+  _changed = false;
+}
+
+void StreamableManager::sendPipeLine(PipeLine& line, Stream* dest, bool flowControl) {
+  if (!line._changed) {
+    *line._valueEnd = line._valueEndChar;
+    *line._keyEnd = line._keyEndChar;
+    sendLine(line._line, dest, flowControl);
+    return;
+  }
+  char out[_bufferBytes];
+  size_t len = 0;
+  size_t max = _bufferBytes - 1;
+  size_t n = (line._keyLen < max) ? line._keyLen : max;
+  memcpy(out, line._key, n);
+  len += n;
+  if (line._value && len < max) {
+    out[len++] = '=';
+    n = (line._valueLen < max - len) ? line._valueLen : max - len;
+    memcpy(out + len, line._value, n);
+    len += n;
+  }
+  out[len] = '\0';
+  sendLine(out, dest, flowControl);
+}
+
+size_t StreamableManager::drainSinks(PipeSink** sinks, uint8_t sinkCount) {
+  IO_PHASE_START(writeStart);
+  size_t written = 0;
+  for (uint8_t i = 0; i < sinkCount; i++) {
+    written += sinks[i]->drain();
+  }
+  IO_STAT(_ioStats.bytesOut += written);
+  IO_PHASE_END(writeStart, writeMicros);
+  return written;
+}
+
+void StreamableManager::pipe(Stream* src, PipeSink** sinks, uint8_t sinkCount) {
+  if (!src || !sinks) {
+#if (defined(DEBUG))
+    Serial.println(F("ERROR: StreamableManager::pipe src or sinks is nullptr"));
+#endif
+    return;
+  }
+  _creditStalled = false;
+  while (hasMoreInput(src)) {
+    char* line = readLine(src);
+    bool end = isCreditLink(src) && line[0] == '\0'; // the end of a message sent over the credit link
+    size_t len = strlen(line);
+    for (uint8_t i = 0; i < sinkCount; i++) {
+      PipeSink* sink = sinks[i];
+      if (!sink->routes(line)) continue;
+      if (sink->_dropWhenFull && len + 1 > sink->_size - sink->_count) {
+        sink->_dropped++;
+        IO_STAT(_ioStats.linesDropped++);
+      } else if (len + 1 > sink->_size) {
+        // Too long to buffer, so write it directly once the earlier lines are out
+        while (sink->_count > 0) drainSinks(sinks, sinkCount);
+        for (size_t sent = 0; sent <= len; ) {
+          IO_PHASE_START(writeStart);
+          size_t written = sink->drainLine(line, len, sent);
+          IO_STAT(_ioStats.bytesOut += written);
+          IO_PHASE_END(writeStart, writeMicros);
+          sent += written;
+          if (sent <= len) drainSinks(sinks, sinkCount);
+        }
+      } else {
+        // Keep the other sinks going while this one makes room
+        while (!sink->enqueue(line, len)) drainSinks(sinks, sinkCount);
+      }
+    }
+    drainSinks(sinks, sinkCount);
+    delete[] line;
+    if (end) break;
+  }
+  // A sink that drops lines doesn't wait either, and keeps what's left for the next pipe
+  for (uint8_t i = 0; i < sinkCount; i++) {
+    while (!sinks[i]->_dropWhenFull && sinks[i]->_count > 0) drainSinks(sinks, sinkCount);
+  }
+}
+
+void StreamableManager::sendChar(char c, Stream* dest, bool flowControl) {
+  if (isCreditLink(dest) && (_creditStalled || !takeCredit(dest))) {
+    _creditStalled = true;
+    return;
+  }
+  if (flowControl) {
+    waitForWrite(dest);
+  }
+  dest->write(c);
+  if (_activeChecksum) _activeChecksum->update(c);
+  IO_STAT(_ioStats.bytesOut++);
+}
+
+void StreamableManager::sendBatchField(const char* field, Stream* dest, bool flowControl) {
+  if (*field == BATCH_ABSENT || *field == BATCH_DELTA) {
+    sendChar(BATCH_ESCAPE, dest, flowControl);
+  }
+  for (const char* p = field; *p; p++) {
+    if (*p == BATCH_ESCAPE || *p == BATCH_SEPARATOR) {
+      sendChar(BATCH_ESCAPE, dest, flowControl);
+    }
+    sendChar(*p, dest, flowControl);
+  }
+}
+
+int StreamableManager::findBatchColumn(BatchColumn* columns, uint16_t columnCount, const char* key) {
+  for (uint16_t i = 0; i < columnCount; i++) {
+    if (strcmp(columns[i].key, key) == 0) return i;
+  }
+  return -1;
+}
+
+void StreamableManager::freeBatchColumns(BatchColumn* columns, uint16_t columnCount) {
+  for (uint16_t i = 0; i < columnCount; i++) {
+    free(columns[i].key);
+  }
+  free(columns);
+}
+
+bool StreamableManager::sendBatch(Stream* dest, StreamableDTO** dtos, uint16_t count, bool deltaEncode = false, bool flowControl = false) {
+  if (!dest || !dtos || count == 0) return false;
+  _creditStalled = false;
+  ChecksumScope scope(_activeChecksum, _checksum);
+
+  // First pass collects the union of keys, in the order they're first seen.
+  // Entries are serialized with toLine, so custom fields are batched in
+  // their wire form.
+  BatchColumn* columns = nullptr;
+  uint16_t columnCount = 0;
+  bool ok = true;
+  for (uint16_t n = 0; n < count && ok; n++) {
+    StreamableDTO* dto = dtos[n];
+    ok = dto->forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      char line[_bufferBytes];
+      if (!dto->toLine(e, line, _bufferBytes)) return true;
+      char* val = splitBatchLine(line);
+      bool integer = deltaEncode && isBatchInteger(val);
+      int i = findBatchColumn(columns, columnCount, line);
+      if (i >= 0) {
+        if (!integer) columns[i].delta = false;
+        return true;
+      }
+      BatchColumn* grown = static_cast<BatchColumn*>(realloc(columns, (columnCount + 1) * sizeof(BatchColumn)));
+      if (!grown) return false;
+      columns = grown;
+      char* copy = strdup(line);
+      if (!copy) return false;
+      columns[columnCount++] = { copy, integer, false, 0 };
+      return true;
+    });
   }
+  int* offsets = ok ? new int[columnCount + 1] : nullptr; // where each column's value starts in a row, or -1
+  if (!offsets) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: Not enough memory to send the batch"));
+#endif
+    freeBatchColumns(columns, columnCount);
+    return false;
+  }
+
+  if (dtos[0]->getTypeId() != -1) {
+    sendMetaLine(dtos[0], dest, flowControl);
+  }
+  char prefix[BATCH_KEY_LEN + 6];
+  strcpy_P(prefix, BATCH_KEY);
+  static const char countFormat[] PROGMEM = "%u";
+  snprintf_P(prefix + BATCH_KEY_LEN, 6, countFormat, count);
+  for (const char* p = prefix; *p; p++) {
+    sendChar(*p, dest, flowControl);
+  }
+  for (uint16_t i = 0; i < columnCount; i++) {
+    sendChar(BATCH_SEPARATOR, dest, flowControl);
+    if (columns[i].delta) sendChar(BATCH_DELTA, dest, flowControl);
+    sendBatchField(columns[i].key, dest, flowControl);
+  }
+  sendChar('\n', dest, flowControl);
+
+  // Second pass gathers each DTO's values by column, then sends the row
+  char* row = nullptr;      // the current row's values, each null-terminated
+  size_t rowLen = 0;
+  size_t rowCapacity = 0;
+  static const char deltaFormat[] PROGMEM = "%ld";
+  for (uint16_t n = 0; n < count && !_creditStalled; n++) {
+    StreamableDTO* dto = dtos[n];
+    rowLen = 0;
+    for (uint16_t i = 0; i < columnCount; i++) offsets[i] = -1;
+    ok = dto->forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      char line[_bufferBytes];
+      if (!dto->toLine(e, line, _bufferBytes)) return true;
+      char* val = splitBatchLine(line);
+      int i = findBatchColumn(columns, columnCount, line);
+      if (i < 0) return true;
+      size_t valLen = strlen(val) + 1;
+      if (rowLen + valLen > rowCapacity) {
+        size_t capacity = (rowLen + valLen) * 2;
+        char* grown = static_cast<char*>(realloc(row, capacity));
+        if (!grown) return false;
+        row = grown;
+        rowCapacity = capacity;
+      }
+      memcpy(row + rowLen, val, valLen);
+      offsets[i] = rowLen;
+      rowLen += valLen;
+      return true;
+    });
+    if (!ok) {
+      // The row is cut short, so the receiver sees a broken batch rather
+      // than a row with fields missing
+#if defined(DEBUG)
+      Serial.println(F("ERROR: Not enough memory to send the batch"));
+#endif
+      break;
+    }
+    for (uint16_t i = 0; i < columnCount; i++) {
+      if (i > 0) sendChar(BATCH_SEPARATOR, dest, flowControl);
+      BatchColumn& column = columns[i];
+      if (offsets[i] < 0) {
+        sendChar(BATCH_ABSENT, dest, flowControl);
+        continue;
+      }
+      const char* value = row + offsets[i];
+      if (column.delta) {
+        long current = atol(value);
+        char diff[12];
+        // Differences wrap around instead of overflowing, and wrap back when decoded
+        long delta = column.hasPrev ? static_cast<long>(static_cast<unsigned long>(current) - column.prev) : current;
+        snprintf_P(diff, sizeof(diff), deltaFormat, delta);
+        column.prev = current;
+        column.hasPrev = true;
+        sendBatchField(diff, dest, flowControl);
+      } else {
+        sendBatchField(value, dest, flowControl);
+      }
+    }
+    sendChar('\n', dest, flowControl);
+  }
+  delete[] offsets;
+  free(row);
+  freeBatchColumns(columns, columnCount);
+  if (!ok) return false;
+  sendTrailer(dest, flowControl);
+  return !_creditStalled;
+}
+
+int StreamableManager::readBatchField(Stream* src, char* buffer, size_t bufferSize, bool& escapedStart) {
+  size_t i = 0;
+  bool escaped = false;
+  bool truncated = false;
+  int terminator = -1;
+  escapedStart = false;
+  int next;
+  while ((next = readByte(src)) >= 0) {
+    char c = next;
+    IO_STAT(_ioStats.bytesIn++);
+    if (_activeChecksum) _activeChecksum->update(c);
+    if (escaped) {
+      escaped = false;
+    } else if (c == BATCH_ESCAPE) {
+      escaped = true;
+      if (i == 0) escapedStart = true;
+      continue;
+    } else if (c == BATCH_SEPARATOR || c == '\n') {
+      terminator = c;
+      break;
+    } else if (c == '\r') {
+      continue;
+    }
+    if (i < bufferSize - 1) {
+      buffer[i++] = c;
+    } else {
+      truncated = true;
+    }
+  }
+  buffer[i] = '\0';
+  if (truncated) {
+    IO_STAT(_ioStats.linesTruncated++);
+#if defined(DEBUG)
+    Serial.print(F("readBatchField: field truncated to "));
+    Serial.print(bufferSize);
+    Serial.println(F(" chars"));
+#endif
+  }
+  return terminator;
+}
+
+bool StreamableManager::readBatchHeader(Stream* src, StreamableDTO::MetaInfo& meta, uint16_t& rowCount,
+    BatchColumn*& columns, uint16_t& columnCount) {
+  columns = nullptr;
+  columnCount = 0;
+  char field[_bufferBytes];
+  bool escaped;
+  int terminator = readBatchField(src, field, _bufferBytes, escaped);
+  if (terminator == BATCH_SEPARATOR && strncmp_P(field, META_KEY, META_KEY_LEN) == 0) {
+    // The '|' in the meta line was read as a field separator
+    size_t len = strlen(field);
+    field[len++] = '|';
+    readBatchField(src, field + len, _bufferBytes - len, escaped);
+    IO_PHASE_START(metaStart);
+    bool found = StreamableDTO::parseMetaLine(field, meta);
+    IO_PHASE_END(metaStart, metaMicros);
+    if (!found) return false;
+    terminator = readBatchField(src, field, _bufferBytes, escaped);
+  }
+  if (strncmp_P(field, BATCH_KEY, BATCH_KEY_LEN) != 0) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: Missing batch header"));
+#endif
+    return false;
+  }
+  rowCount = strtoul(field + BATCH_KEY_LEN, nullptr, 10);
+  while (terminator == BATCH_SEPARATOR) {
+    terminator = readBatchField(src, field, _bufferBytes, escaped);
+    bool delta = (field[0] == BATCH_DELTA && !escaped);
+    BatchColumn* grown = static_cast<BatchColumn*>(realloc(columns, (columnCount + 1) * sizeof(BatchColumn)));
+    char* key = grown ? strdup(delta ? field + 1 : field) : nullptr;
+    if (grown) columns = grown;
+    if (!key) {
+      freeBatchColumns(columns, columnCount);
+      columns = nullptr;
+      columnCount = 0;
+      return false;
+    }
+    columns[columnCount++] = { key, delta, false, 0 };
+  }
+  return true;
+}
+
+bool StreamableManager::readBatchRow(Stream* src, StreamableDTO* dto, BatchColumn* columns, uint16_t columnCount,
+    uint16_t lineNumStart) {
+  char field[_bufferBytes];
+  bool escaped;
+  if (columnCount == 0) {
+    // Rows of DTOs without any keys are empty lines
+    return readBatchField(src, field, _bufferBytes, escaped) != BATCH_SEPARATOR && field[0] == '\0';
+  }
+  static const char deltaFormat[] PROGMEM = "%ld";
+  for (uint16_t i = 0; i < columnCount; i++) {
+    int terminator = readBatchField(src, field, _bufferBytes, escaped);
+    bool last = (i == columnCount - 1);
+    if (last ? terminator == BATCH_SEPARATOR : terminator != BATCH_SEPARATOR) {
+#if defined(DEBUG)
+      Serial.println(F("ERROR: Batch row has the wrong number of fields"));
+#endif
+      return false;
+    }
+    if (!escaped && field[0] == BATCH_ABSENT && field[1] == '\0') {
+      continue;
+    }
+    BatchColumn& column = columns[i];
+    if (column.delta) {
+      long current = atol(field);
+      if (column.hasPrev) current = static_cast<long>(static_cast<unsigned long>(current) + column.prev);
+      column.prev = current;
+      column.hasPrev = true;
+      snprintf_P(field, _bufferBytes, deltaFormat, current);
+    }
+    if (dto) {
+      IO_PHASE_START(parseStart);
+      dto->parseValue(lineNumStart + i, column.key, field);
+      IO_PHASE_END(parseStart, parseMicros);
+    }
+  }
+  IO_STAT(_ioStats.linesParsed++);
+  return true;
+}
+
+bool StreamableManager::readBatchTrailer(Stream* src) {
+  if (!_activeChecksum) {
+    // The empty line that ends a message sent over the credit link
+    if (isCreditLink(src)) delete[] readLine(src);
+    return true;
+  }
+  uint32_t expected = _checksum.value();
+  char* line = readLine(src);
+  bool matched = strncmp_P(line, CHECKSUM_KEY, CHECKSUM_KEY_LEN) == 0
+      && StreamableChecksum::fromHex(line + CHECKSUM_KEY_LEN) == expected;
+  delete[] line;
+  if (!matched) {
+    IO_STAT(_ioStats.checksumFailures++);
+#if defined(DEBUG)
+    Serial.println(F("ERROR: Batch checksum missing or incorrect"));
+#endif
+  }
+  return matched;
+}
+
+bool StreamableManager::loadBatch(Stream* src, StreamableDTO* dto, BatchVisitor visitor, void* state = nullptr) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  StreamableDTO::MetaInfo meta;
+  uint16_t rowCount;
+  BatchColumn* columns;
+  uint16_t columnCount;
+  if (!readBatchHeader(src, meta, rowCount, columns, columnCount)) {
+    return false;
+  }
+  bool typed = (meta.typeId != -1);
+  if (typed && !checkCompatibility(dto, meta)) {
+    freeBatchColumns(columns, columnCount);
+    return false; // incorrect type or incompatible version
+  }
+  bool ok = true;
+  for (uint16_t row = 0; row < rowCount; row++) {
+    dto->clear();
+    if (!readBatchRow(src, dto, columns, columnCount, typed ? 1 : 0)) {
+      dto->clear();
+      ok = false;
+      break;
+    }
+    if (typed) dto->_deserializedVer = meta.serialVersion;
+    if (!visitor(dto, row, state)) {
+      freeBatchColumns(columns, columnCount);
+      return true;
+    }
+  }
+  freeBatchColumns(columns, columnCount);
+  return ok && readBatchTrailer(src);
 }
 
+uint16_t StreamableManager::loadBatch(Stream* src, StreamableDTO** dtos, uint16_t maxDtos, TypeMapper typeMapper) {
+  ChecksumScope scope(_activeChecksum, _checksum);
+  StreamableDTO::MetaInfo meta;
+  uint16_t rowCount;
+  BatchColumn* columns;
+  uint16_t columnCount;
+  if (!readBatchHeader(src, meta, rowCount, columns, columnCount)) {
+    return 0;
+  }
+  bool typed = (meta.typeId != -1);
+  uint16_t loaded = 0;
+  bool ok = true;
+  for (uint16_t row = 0; row < rowCount && ok; row++) {
+    StreamableDTO* dto = nullptr;
+    if (row < maxDtos) {
+      dto = typeMapper(meta.typeId);
+      if (!dto) {
+#if defined(DEBUG)
+        Serial.print(F("ERROR: Unknown typeId: "));
+        Serial.println(meta.typeId);
+#endif
+        ok = false;
+        break;
+      }
+      dtos[loaded++] = dto;
+      if (typed && !checkCompatibility(dto, meta)) {
+        ok = false;
+        break;
+      }
+    }
+    ok = readBatchRow(src, dto, columns, columnCount, typed ? 1 : 0);
+    if (ok && dto && typed) dto->_deserializedVer = meta.serialVersion;
+  }
+  freeBatchColumns(columns, columnCount);
+  if (ok && readBatchTrailer(src)) {
+    return loaded;
+  }
+  for (uint16_t i = 0; i < loaded; i++) {
+    delete dtos[i];
+    dtos[i] = nullptr;
+  }
+  return 0;
+}
@@ -14,7 +14,12 @@
 
 
 #include <Arduino.h>
+#include "PipeSink.h"
+#include "StreamableArray.h"
+#include "StreamableChecksum.h"
 #include "StreamableDTO.h"
+#include "StreamableScanner.h"
+#include "StreamableTypeRegistry.h"
 
 /*
  * Serializes and deserializes StreamableDTO objects to/from Streams. If using
@@ -27,37 +32,303 @@
  */
 class StreamableManager {
 
+  public:
+    class PipeLine; // see pipeThrough
+
+#if defined(STRDTO_STATS)
+    /*
+     * Cumulative I/O counters and time spent (in micros) in each phase of
+     * load, send and pipe. Only available when compiled with STRDTO_STATS
+     * defined.
+     */
+    struct IoStats {
+      uint32_t bytesIn;
+      uint32_t bytesOut;
+      uint32_t linesParsed;
+      uint32_t linesTruncated;
+      uint32_t typeRejects;           // messages rejected for an unexpected typeId
+      uint32_t versionRejects;        // messages rejected for an incompatible version
+      uint32_t checksumFailures;      // messages discarded for a missing or incorrect checksum
+      uint32_t sendsSkipped;          // sends skipped because the DTO was unchanged
+      uint32_t creditTimeouts;        // sends cut short because the receiver granted no credit
+      uint32_t linesDropped;          // lines a full PipeSink dropped
+      uint32_t flowControlWaitMicros; // blocked on availableForWrite() or credit
+      uint32_t readMicros;            // reading lines from the source
+      uint32_t trimMicros;            // trimming whitespace from lines read
+      uint32_t metaMicros;            // parsing and checking meta lines
+      uint32_t parseMicros;           // parseLine/parseValue (or buffering lazy lines)
+      uint32_t writeMicros;           // writing lines, including flowControlWaitMicros
+    };
+
+    const IoStats& getIoStats() const { return _ioStats; };
+    void resetIoStats() { memset(&_ioStats, 0, sizeof(_ioStats)); };
+#endif
+
+
   private:
     size_t _bufferBytes = 64; // Same as Arduino's default serial buffer size
+#if defined(STRDTO_STATS)
+    IoStats _ioStats = {};
+#endif
+    StreamableChecksum _checksum;
+    StreamableChecksum* _activeChecksum = nullptr; // set while sending or loading with a checksum
+
+    /*
+     * The fingerprint of the last DTO sent to each of the most recently used
+     * destinations (see setSkipUnchanged). Slots are reused round-robin.
+     */
+    static const uint8_t SENT_SLOTS = 4;
+    struct SentFingerprint {
+      Stream* dest;
+      int16_t typeId;
+      uint32_t fingerprint;
+    };
+    SentFingerprint _sent[SENT_SLOTS] = {};
+    uint8_t _nextSentSlot = 0;
+    bool _skipUnchanged = false;
+
+    /*
+     * Credit-based flow control over one link (see setCredits)
+     */
+    static const uint8_t CREDIT_GRANT = 0x11;  // ASCII DC1 (XON)
+    Stream* _creditLink = nullptr;
+    uint8_t _creditBlockBytes = 0;
+    uint8_t _creditWindowBlocks = 0;
+    unsigned long _creditTimeoutMillis = 0;
+    uint16_t _sendCredit = 0;       // bytes that may still be sent over the link
+    uint8_t _creditConsumed = 0;    // bytes read from the link since the last grant
+    bool _creditsGranted = false;   // whether the initial window was granted
+    bool _creditStalled = false;    // the current send ran out of credit
+
+    bool isCreditLink(Stream* s) const { return s != nullptr && s == _creditLink; };
+
+    /*
+     * Waits for a grant if there's no credit left. Returns false if none
+     * came within the timeout.
+     */
+    bool takeCredit(Stream* dest);
+
+    /*
+     * Returns the next byte, or -1 at the end of the stream. On the credit
+     * link, this waits for data (up to the timeout), absorbs grants for our
+     * own sends, and grants a block of credit back for each block read.
+     */
+    int readByte(Stream* src);
+
+    /*
+     * Whether there's more to read. On the credit link, data that is still on
+     * its way is waited for, up to the timeout.
+     */
+    bool hasMoreInput(Stream* src);
+
+    /*
+     * Whether the last DTO sent to dest had the same typeId and fingerprint
+     */
+    bool sentBefore(Stream* dest, int16_t typeId, uint32_t fingerprint) const;
+
+    /*
+     * Remembers the fingerprint as the last one sent to dest. Only called
+     * once a send has completed, so a send that stalls is retried.
+     */
+    void recordSend(Stream* dest, int16_t typeId, uint32_t fingerprint);
 
     /*
      * Reads characters from a Stream until a terminator character or the max
-     * buffer size is reached (a newline is the default terminator).
+     * buffer size is reached (a newline is the default terminator). With
+     * stopAtArray, it also stops after the "key[]=" of an array line, leaving
+     * the elements to readArray.
      */
-    char* readLine(Stream* s, char terminator = '\n');
+    char* readLine(Stream* s, char terminator = '\n', bool stopAtArray = false);
+
+    /*
+     * Arrays (see StreamableArray) are written and read one element at a
+     * time, so they aren't limited by the buffer size. readArray replaces
+     * the array's elements with the rest of the line, and returns false if
+     * out of memory.
+     */
+    void sendArray(StreamableArrayBase* array, Stream* dest, bool flowControl);
+    bool readArray(Stream* src, StreamableArrayBase* array);
 
     /*
      * Sends a string to the destination Stream. A newline character is 
      * sent automatically. This method waits until the destination stream
-     * has space in its buffer before sending the next char.
+     * has space in its buffer before sending the next char. Given a length,
+     * the line is sent as is, including any null bytes in it.
+     */
+    void sendWithFlowControl(const char* line, size_t len, Stream* dest);
+    void sendWithoutFlowControl(const char* line, size_t len, Stream* dest);
+    void sendWithCredits(const char* line, size_t len, Stream* dest, bool flowControl);
+    void sendLine(const char* line, Stream* dest, bool flowControl);
+    void sendLine(const char* line, size_t len, Stream* dest, bool flowControl);
+    void sendMetaLine(StreamableDTO* dto, Stream* dest, bool flowControl = false);
+
+    /*
+     * Waits until dest has room for a byte, counting the time in
+     * flowControlWaitMicros only if it had to wait
+     */
+    void waitForWrite(Stream* dest);
+
+    /*
+     * Ends a send with the checksum trailer if a checksum is active, or an
+     * empty line on the credit link
+     */
+    void sendTrailer(Stream* dest, bool flowControl);
+
+    /*
+     * Same as StreamableDTO::isCompatibleTypeAndVersion, but also counts
+     * rejected messages
+     */
+    bool checkCompatibility(StreamableDTO* dto, const StreamableDTO::MetaInfo& meta);
+
+    /*
+     * Reads the first line of the stream into meta. Returns false if it is
+     * not a meta line.
+     */
+    bool readMetaLine(Stream* src, StreamableDTO::MetaInfo& meta);
+
+    /*
+     * Checks type and version compatibility, then loads the rest of the
+     * stream into the DTO
+     */
+    bool loadTyped(Stream* src, StreamableDTO* dto, const StreamableDTO::MetaInfo& meta);
+
+    /*
+     * Parses lines into the DTO until the end of the stream (or the checksum
+     * trailer, if checksums are enabled, or the empty line that ends each
+     * message on the credit link). With a checksum, the lines are parsed
+     * into a pending DTO first, and only passed on to dto if it matches.
+     */
+    bool loadLines(Stream* src, StreamableDTO* dto, uint16_t lineNumStart);
+
+    /*
+     * Does the reading for loadLines, checking the meta line and finding
+     * arrays with dto, and parsing everything else into target
+     */
+    bool parseLines(Stream* src, StreamableDTO* dto, StreamableDTO* target, uint16_t lineNumStart);
+
+    /*
+     * The pending DTO's stand-in for one of the loaded DTO's arrays, created
+     * the first time the array's line comes in
+     */
+    static StreamableArrayBase* pendingArray(StreamableDTO* pending, StreamableArrayBase* array);
+    static void swapArrays(StreamableArrayBase* a, StreamableArrayBase* b);
+
+    /*
+     * Handles one line for loadBuffer, the way loadLines does: the meta
+     * line, array lines, truncation and lazy loading. lineStart and
+     * contentEnd are the untrimmed line without its newline.
+     */
+    bool loadBufferLine(StreamableDTO* dto, StreamableScanner::Line& line, const char* lineStart,
+        const char* contentEnd, uint16_t& lineNumber);
+    bool parseArray(StreamableArrayBase* array, const char* p, const char* end);
+
+    /*
+     * Batch encoding (see sendBatch). Fields are written and read one char at
+     * a time, so rows may be longer than the buffer size, but each field must
+     * fit in it.
+     */
+    struct BatchColumn;
+    static int findBatchColumn(BatchColumn* columns, uint16_t columnCount, const char* key);
+    void sendChar(char c, Stream* dest, bool flowControl);
+    void sendBatchField(const char* field, Stream* dest, bool flowControl);
+
+    /*
+     * Reads and unescapes one field into buffer. Returns the terminator that
+     * ended it ('|' or '\n'), or -1 at the end of the stream. escapedStart is
+     * set if the first char was escaped, so it can't be a marker.
+     */
+    int readBatchField(Stream* src, char* buffer, size_t bufferSize, bool& escapedStart);
+
+    /*
+     * Reads the optional meta line and the batch header. On success, the
+     * caller must free the columns with freeBatchColumns
+     */
+    bool readBatchHeader(Stream* src, StreamableDTO::MetaInfo& meta, uint16_t& rowCount,
+        BatchColumn*& columns, uint16_t& columnCount);
+    void freeBatchColumns(BatchColumn* columns, uint16_t columnCount);
+
+    /*
+     * Reads one row, passing each field to the DTO's parseValue. A nullptr
+     * DTO discards the row.
      */
-    static void sendWithFlowControl(const char* line, Stream* dest);
-    static void sendWithoutFlowControl(const char* line, Stream* dest);
-    static void sendMetaLine(StreamableDTO* dto, Stream* dest, bool flowControl = false);
+    bool readBatchRow(Stream* src, StreamableDTO* dto, BatchColumn* columns, uint16_t columnCount,
+        uint16_t lineNumStart);
+
+    /*
+     * Reads and verifies the checksum trailer after the last row (if
+     * checksums are enabled), or reads the empty line that ends a batch sent
+     * over the credit link
+     */
+    bool readBatchTrailer(Stream* src);
+
+    /*
+     * Writes out as much of each sink's buffer as its destination takes.
+     * Returns the number of bytes written.
+     */
+    size_t drainSinks(PipeSink** sinks, uint8_t sinkCount);
+
+    /*
+     * Runs a line through the stages of pipeThrough, stopping at the first
+     * one that drops it
+     */
+    template <typename Stage, typename... Rest>
+    static bool runStages(PipeLine& line, Stage& stage, Rest&... rest) {
+      return stage(line) && runStages(line, rest...);
+    };
+    static bool runStages(PipeLine&) { return true; };
+
+    /*
+     * Sends the line as read if no stage changed it, otherwise rebuilds it
+     */
+    void sendPipeLine(PipeLine& line, Stream* dest, bool flowControl);
 
   public:
+
+
     StreamableManager() {};
     StreamableManager(size_t bufferBytes): _bufferBytes(bufferBytes) {};
 
-    const size_t getBufferSize() const { return _bufferBytes; };
+    size_t getBufferSize() const { return _bufferBytes; };
+
+    /*
+     * Enables a CRC over everything sent or loaded. send() updates it as each
+     * byte is written and finishes with a "__crc=<hex>" trailer line. load()
+     * updates it as each byte is read and verifies it against the trailer,
+     * which ends the message. Since that's only known at the end, the lines
+     * are held in memory until then. If the checksum is missing or
+     * incorrect, load fails and the DTO is left as it was (or discarded,
+     * when loading with a TypeMapper or registry), so a corrupted scoped
+     * update doesn't wipe what was already loaded. Both ends must use the
+     * same checksum type.
+     * pipe() passes the trailer through like any other line.
+     */
+    void setChecksum(StreamableChecksum::Type type) { _checksum = StreamableChecksum(type); };
+    StreamableChecksum::Type getChecksum() const { return _checksum.getType(); };
 
     /*
      * Loads the stream data into memory, hydrating the provided DTO and 
      * verifying the sub-type and version for compatibility. If the provided
      * DTO is incompatible with the incoming data, returns false and does
-     * not populate the DTO
+     * not populate the DTO. If the DTO has lazy loading enabled, the lines
+     * are stored as received and parsed on first access.
      */
     bool load(Stream* src, StreamableDTO* dto, uint16_t lineNumStart = 0);
+
+    /*
+     * Same as load, but from length bytes that are already in memory, such
+     * as a log file read in one go on a gateway. Lines are found with
+     * StreamableScanner, many bytes at a time, and the keys and values are
+     * handed to the DTO's parseValue without being copied into a line
+     * buffer first, so a DTO that overrides parseLine should use load.
+     * Lines longer than the buffer size are cut short like in load, and the
+     * rest of the line is skipped.
+     *
+     * Loading stops after the checksum trailer (if checksums are enabled).
+     * If used is given, it is set to the number of bytes consumed, so a
+     * buffer of several checksummed messages can be loaded one by one.
+     */
+    bool loadBuffer(const char* data, size_t length, StreamableDTO* dto, uint16_t lineNumStart = 0,
+        size_t* used = nullptr);
     
     /*
      * Function that returns an instantiation of the StreamableDTO sub-
@@ -76,28 +347,103 @@ class StreamableManager {
      *       for reclaiming the DTO's memory
      */
     StreamableDTO* load(Stream* src, TypeMapper typeMapper);
+
+    /*
+     * Loads the stream data into a cleared DTO obtained from the registry's
+     * pool for the incoming typeId, so no DTO is allocated per message once
+     * the pool is warm.
+     *
+     * NOTE: Only use this if you know the incoming stream starts with type
+     *       and serial version identifiers. When done with the DTO, the caller
+     *       must hand it back with registry->release(dto) instead of deleting it
+     */
+    StreamableDTO* load(Stream* src, StreamableTypeRegistry* registry);
     
     /*
-     * Streams the contents of the provided DTO to a stream
+     * Streams the contents of the provided DTO to a stream. Returns false if
+     * the send was skipped (see setSkipUnchanged) or ran out of credit (see
+     * setCredits).
+     */
+    bool send(Stream* dest, StreamableDTO* dto, bool flowControl = false);
+
+    /*
+     * Streams only the fields under scope (see StreamableDTO::putChild), with
+     * their full keys, so loading them into another DTO updates just that
+     * subtree. There is no meta line, since the lines aren't a whole DTO of
+     * the type, but the checksum trailer is sent as usual. Returns false if
+     * the send ran out of credit.
+     */
+    bool sendScope(Stream* dest, StreamableDTO* dto, const char* scope, bool flowControl = false);
+
+    /*
+     * When enabled, send() skips a DTO with the same typeId and fingerprint
+     * (see StreamableDTO::getFingerprint) as the last one sent to the same
+     * destination. The last fingerprint is remembered for up to 4
+     * destinations. forgetSent() makes the next send go out regardless, for
+     * example after the receiver restarts. Off by default.
      */
-    void send(Stream* dest, StreamableDTO* dto, bool flowControl = false);
+    void setSkipUnchanged(bool skip) { _skipUnchanged = skip; };
+    void forgetSent(Stream* dest = nullptr);
+
+    /*
+     * Sends count DTOs of the same type as one batch. The meta line and a
+     * header with the row count and keys are sent once, followed by one row
+     * of '|'-separated values per DTO:
+     *
+     *   __tvid=1|4
+     *   __batch=3|temp|^ts
+     *   21.5|1700000000
+     *   21.7|60
+     *   ~|60
+     *
+     * Keys that are missing from a DTO are sent as "~", and '\' escapes a
+     * literal '|', '\', or leading '~' or '^'. With deltaEncode, columns whose
+     * values are all integers that fit in a long are marked with '^' and sent as
+     * the difference from the previous row's value.
+     *
+     * Returns false if there isn't enough memory to collect the keys or a
+     * row (the batch is then left unfinished, so the receiver rejects it),
+     * or if it stalled for lack of credit.
+     */
+    bool sendBatch(Stream* dest, StreamableDTO** dtos, uint16_t count, bool deltaEncode = false,
+        bool flowControl = false);
+
+    /*
+     * Called by loadBatch after each row is loaded. Returning false stops
+     * loading, leaving the rest of the batch unread.
+     */
+    typedef bool (*BatchVisitor)(StreamableDTO* dto, uint16_t row, void* state);
+
+    /*
+     * Loads a batch one row at a time into the same DTO, which is cleared
+     * before each row, and passes it to the visitor. Keys are only read once,
+     * from the header, and each value goes straight to the DTO's parseValue.
+     * Returns false if the batch is malformed, incompatible with the DTO, or
+     * fails its checksum (which is only known after every row was visited).
+     */
+    bool loadBatch(Stream* src, StreamableDTO* dto, BatchVisitor visitor, void* state = nullptr);
+
+    /*
+     * Loads up to maxDtos rows of a batch into new DTOs obtained from the
+     * TypeMapper, and returns how many were loaded. Any further rows are
+     * discarded. If loading fails, any DTOs created are deleted and 0 is
+     * returned. Otherwise the caller is responsible for deleting them.
+     */
+    uint16_t loadBatch(Stream* src, StreamableDTO** dtos, uint16_t maxDtos, TypeMapper typeMapper);
 
     // Wraps a raw stream providing null checking and flow control
     class DestinationStream {
       public:
-        DestinationStream(Stream* dest): _dest(dest) {};
+        DestinationStream(Stream* dest, StreamableManager* mgr): _dest(dest), _mgr(mgr) {};
         void println(const char* line, bool flowControl = false) {
           if (_dest != nullptr) {
-            if (flowControl) {
-              StreamableManager::sendWithFlowControl(line, _dest);
-            } else {
-              StreamableManager::sendWithoutFlowControl(line, _dest);
-            }
+            _mgr->sendLine(line, _dest, flowControl);
           }
         };
       private:
         DestinationStream(const DestinationStream &t) = delete;
         Stream* _dest = nullptr;
+        StreamableManager* _mgr;
     };
 
     /*
@@ -114,6 +460,125 @@ class StreamableManager {
      */
     void pipe(Stream* src, Stream* dest, FilterFunction filter = nullptr, bool flowControl = false, void* state = nullptr);
 
+    /*
+     * Reads each line from src once and passes it to every sink whose routing
+     * rules (see PipeSink::setKeys) accept it. Each sink buffers its own lines,
+     * so a slow destination only holds up the pipe once its buffer is full.
+     * Then no more lines are read until it has room, so unless it drops lines
+     * (see PipeSink), every other sink waits too. Returns once src is done
+     * and every buffer has been written out, except for sinks that drop
+     * lines, which keep what didn't go out for the next pipe. Sinks don't use
+     * credits (see setCredits).
+     */
+    void pipe(Stream* src, PipeSink** sinks, uint8_t sinkCount);
+
+    /*
+     * A line passing through pipeThrough(), split once into its key and value
+     * and trimmed the same way as lines that are loaded. Both are
+     * null-terminated views into the line read (the value is nullptr
+     * if the line has no '='), and valid until the next line is read.
+     */
+    class PipeLine {
+      public:
+        const char* key() const { return _key; };
+        size_t keyLength() const { return _keyLen; };
+        const char* value() const { return _value; };
+        size_t valueLength() const { return _valueLen; };
+        bool keyIs(const char* key) const { return strcmp(_key, key) == 0; };
+        bool keyIs_P(const char* key) const { return strcmp_P(_key, key) == 0; };
+
+        /*
+         * Replaces the key or value that's sent. Only len chars are used, so
+         * a view into another string works, but it must last until the line
+         * is sent (after the last stage).
+         */
+        void setKey(const char* key, size_t len) { _key = key; _keyLen = len; _changed = true; };
+        void setKey(const char* key) { setKey(key, strlen(key)); };
+        void setValue(const char* value, size_t len) { _value = value; _valueLen = len; _changed = true; };
+        void setValue(const char* value) { setValue(value, strlen(value)); };
+
+        /*
+         * Ends the pipe after this line
+         */
+        void stop() { _stop = true; };
+
+      private:
+        friend class StreamableManager;
+        char* _line = nullptr;
+        char* _keyEnd = nullptr;
+        char _keyEndChar = '\0';
+        char* _valueEnd = nullptr;
+        char _valueEndChar = '\0';
+        const char* _key = nullptr;
+        size_t _keyLen = 0;
+        const char* _value = nullptr;
+        size_t _valueLen = 0;
+        bool _changed = false;
+        bool _stop = false;
+        void split(char* line);
+    };
+
+    /*
+     * Pipes src to dest through a chain of stages: lambdas (capturing or not),
+     * functors or functions taking a PipeLine& and returning false to drop the
+     * line. Each line is split once, and the stages run in order until one
+     * drops it. Since the stages are template parameters rather than function
+     * pointers, the compiler can inline them.
+     *
+     *   int dropped = 0;
+     *   manager.pipeThrough(&src, &dest, false,
+     *       [&](StreamableManager::PipeLine& l) { return l.keyIs("secret") ? (dropped++, false) : true; },
+     *       [](StreamableManager::PipeLine& l) { if (l.keyIs("temp")) l.setKey("t"); return true; });
+     */
+    template <typename... Stages>
+    void pipeThrough(Stream* src, Stream* dest, bool flowControl, Stages&&... stages) {
+      if (!src) return;
+      _creditStalled = false;
+      PipeLine line;
+      while (!line._stop && !_creditStalled && hasMoreInput(src)) {
+        char* raw = readLine(src);
+        bool end = isCreditLink(src) && raw[0] == '\0'; // the end of a message sent over the credit link
+        line.split(raw);
+        if (runStages(line, stages...) && dest) {
+          sendPipeLine(line, dest, flowControl);
+        }
+        delete[] raw;
+        if (end) break;
+      }
+    }
+
+    /*
+     * Credit-based flow control, so a fast sender can't overrun a slow
+     * receiver's RX buffer (the flowControl flag only waits for the sender's
+     * own TX buffer). Call this on both ends of a link, such as Serial1, with
+     * the same blockBytes.
+     *
+     * The receiver grants windowBlocks blocks of blockBytes bytes up front
+     * (make windowBlocks * blockBytes no more than its RX buffer) by sending
+     * a DC1 (0x11) byte per block back over the link, and another each time
+     * it reads a block. send(), sendBatch() and pipe() stop sending over the
+     * link when they run out of credit until a grant arrives. If none comes
+     * within timeoutMillis, the rest of the message is dropped and send()
+     * returns false. While waiting, load() waits for the rest of a message
+     * the same way, so messages sent without a checksum end with an empty
+     * line.
+     *
+     * While one end is sending a message, the other end must only send
+     * grants (other bytes are discarded).
+     */
+    void setCredits(Stream* link, uint8_t blockBytes = 16, uint8_t windowBlocks = 4,
+        unsigned long timeoutMillis = 1000);
+    void clearCredits() { _creditLink = nullptr; };
+
+    /*
+     * Sends the receiver's initial window. load() does this on its first call,
+     * but the sender can't start until it's done, so call this in setup() if
+     * load() is only called once data is available.
+     */
+    void grantCredits();
+
+    uint16_t getSendCredit() const { return _sendCredit; };
+
     // Disable moving and copying
     StreamableManager(StreamableManager&& other) = delete;
     StreamableManager& operator=(StreamableManager&& other) = delete;
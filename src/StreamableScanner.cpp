@@ -0,0 +1,108 @@
+#include "StreamableScanner.h"
+
+#if !defined(STRDTO_SCALAR_SCAN) && !defined(__AVR__)
+#define STRDTO_WORD_SCAN
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define STRDTO_SSE2_SCAN
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define STRDTO_NEON_SCAN
+#endif
+#endif
+
+bool StreamableScanner::next(Line& line) {
+  if (_pos >= _end) return false;
+  const char* start = _pos;
+  const char* sep = findEither(start, _end, '=', '\n');
+  const char* eol = sep;
+  if (sep < _end && *sep == '=') {
+    eol = findEither(sep + 1, _end, '\n', '\n');
+  } else {
+    sep = nullptr;
+  }
+  _pos = (eol < _end) ? eol + 1 : _end;
+  trim(start, eol, sep, line);
+  return true;
+}
+
+void StreamableScanner::split(const char* line, size_t length, Line& out) {
+  const char* end = line + length;
+  const char* sep = findEither(line, end, '=', '=');
+  trim(line, end, (sep < end) ? sep : nullptr, out);
+}
+
+void StreamableScanner::trim(const char* start, const char* end, const char* sep, Line& out) {
+  while (start < end && isspace(*start)) start++;
+  while (end > start && isspace(end[-1])) end--;
+  out.start = start;
+  out.length = end - start;
+  out.hasSeparator = (sep != nullptr);
+  if (!sep) {
+    out.key = start;
+    out.keyLength = out.length;
+    out.value = end;
+    out.valueLength = 0;
+    return;
+  }
+  // The '=' isn't whitespace, so it's still between start and end
+  const char* keyEnd = sep;
+  while (keyEnd > start && isspace(keyEnd[-1])) keyEnd--;
+  const char* value = sep + 1;
+  while (value < end && isspace(*value)) value++;
+  out.key = start;
+  out.keyLength = keyEnd - start;
+  out.value = value;
+  out.valueLength = end - value;
+}
+
+const char* StreamableScanner::findEither(const char* p, const char* end, char a, char b) {
+#if defined(STRDTO_SSE2_SCAN)
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#elif defined(STRDTO_NEON_SCAN)
+  uint8x16_t va = vdupq_n_u8(a);
+  uint8x16_t vb = vdupq_n_u8(b);
+  for (; end - p >= 16; p += 16) {
+    uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    if (vmaxvq_u8(vorrq_u8(vceqq_u8(chunk, va), vceqq_u8(chunk, vb)))) {
+      return findEitherScalar(p, p + 16, a, b);
+    }
+  }
+#endif
+#if defined(STRDTO_WORD_SCAN)
+  return findEitherWords(p, end, a, b);
+#else
+  return findEitherScalar(p, end, a, b);
+#endif
+}
+
+const char* StreamableScanner::findEitherWords(const char* p, const char* end, char a, char b) {
+  // SWAR: a byte of x ^ (c repeated) is zero where the byte equals c, and
+  // (v - ONES) & ~v & HIGHS is non-zero if any byte of v is zero
+  typedef uintptr_t Word;
+  const Word ONES = ~static_cast<Word>(0) / 0xFF;
+  const Word HIGHS = ONES * 0x80;
+  const Word wa = ONES * static_cast<uint8_t>(a);
+  const Word wb = ONES * static_cast<uint8_t>(b);
+  for (; end - p >= static_cast<ptrdiff_t>(sizeof(Word)); p += sizeof(Word)) {
+    Word w;
+    memcpy(&w, p, sizeof(w)); // unaligned loads are fine, and compile to a single load
+    Word xa = w ^ wa;
+    Word xb = w ^ wb;
+    if (((xa - ONES) & ~xa & HIGHS) | ((xb - ONES) & ~xb & HIGHS)) {
+      return findEitherScalar(p, p + sizeof(Word), a, b);
+    }
+  }
+  return findEitherScalar(p, end, a, b);
+}
+
+const char* StreamableScanner::findEitherScalar(const char* p, const char* end, char a, char b) {
+  while (p < end && *p != a && *p != b) p++;
+  return p;
+}
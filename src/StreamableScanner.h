@@ -0,0 +1,95 @@
+/*
+
+  StreamableScanner.h
+
+  Splits lines of "key=value" text that are already in memory
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableScanner_h
+#define _strdto_StreamableScanner_h
+
+
+#include <Arduino.h>
+
+/*
+ * Walks a buffer of "key=value" lines, such as a log file read into memory
+ * on a gateway, without copying it. Each line is found with a single pass
+ * that looks for the '=' and the newline at the same time. Whitespace only
+ * matters at the ends of the key and value, so it's trimmed by checking
+ * inwards from those boundaries, rather than testing every char.
+ *
+ * The search checks many bytes at a time: 16 with SSE2 or (64-bit) NEON,
+ * otherwise a machine word at a time (8 bytes on 64-bit hosts, 4 on 32-bit
+ * boards). AVR boards, whose words are a single byte, check one char at a
+ * time. Define STRDTO_SCALAR_SCAN to always check one char at a time.
+ *
+ *   StreamableScanner scanner(data, length);
+ *   StreamableScanner::Line line;
+ *   while (scanner.next(line)) { ... }
+ *
+ * StreamableManager::loadBuffer uses this to load a DTO from memory.
+ */
+class StreamableScanner {
+
+  public:
+    /*
+     * One line, trimmed of surrounding whitespace. None of the spans are
+     * null-terminated. Without an '=', the whole line is the key and the
+     * value is empty.
+     */
+    struct Line {
+      const char* start;
+      size_t length;
+      const char* key;
+      size_t keyLength;
+      const char* value;
+      size_t valueLength;
+      bool hasSeparator;
+    };
+
+    StreamableScanner(const char* data, size_t length): _pos(data), _end(data + length) {};
+
+    /*
+     * Finds the next line. Returns false at the end of the buffer.
+     */
+    bool next(Line& line);
+
+    /*
+     * Where the next line starts, just past the newline of the last one
+     */
+    const char* position() const { return _pos; };
+
+    /*
+     * Splits a single line of length chars the same way
+     */
+    static void split(const char* line, size_t length, Line& out);
+
+    /*
+     * Returns the first of a or b in [p, end), or end if there's neither
+     */
+    static const char* findEither(const char* p, const char* end, char a, char b);
+
+  protected:
+    /*
+     * The word-at-a-time and one-char-at-a-time searches behind findEither
+     */
+    static const char* findEitherWords(const char* p, const char* end, char a, char b);
+    static const char* findEitherScalar(const char* p, const char* end, char a, char b);
+
+  private:
+    const char* _pos;
+    const char* _end;
+
+    /*
+     * Sets the trimmed spans, given where the separator is (or nullptr)
+     */
+    static void trim(const char* start, const char* end, const char* sep, Line& out);
+
+};
+
+
+#endif
@@ -0,0 +1,304 @@
+#include "StreamableStore.h"
+
+static const uint8_t MAGIC_0 = 'S';
+static const uint8_t MAGIC_1 = 'D';
+static const uint8_t RECORD_PUT = 'P';
+static const uint8_t RECORD_DELETE = 'D';
+static const uint8_t RECORD_COMMIT = 'C';
+static const uint8_t TERMINATOR = 0xFF;   // same as erased storage
+static const size_t MAX_FIELD_LEN = 255;
+
+StreamableStore::StreamableStore(ByteStorage* storage, size_t bufferBytes = 64):
+    _storage(storage), _bufferBytes(bufferBytes), _crc(StreamableChecksum::CRC16) {
+  _bankSize = storage->size() / 2;
+}
+
+uint32_t StreamableStore::recordSize(uint32_t address, uint32_t bankEnd, uint8_t& type) {
+  if (address >= bankEnd) return 0;
+  type = _storage->read(address);
+  uint32_t size;
+  switch (type) {
+    case RECORD_PUT:
+      if (address + 3 > bankEnd) return 0;
+      size = 3 + _storage->read(address + 1) + _storage->read(address + 2);
+      break;
+    case RECORD_DELETE:
+      if (address + 2 > bankEnd) return 0;
+      size = 2 + _storage->read(address + 1);
+      break;
+    case RECORD_COMMIT:
+      size = COMMIT_BYTES;
+      break;
+    default:
+      return 0;
+  }
+  return (address + size <= bankEnd) ? size : 0;
+}
+
+uint32_t StreamableStore::replay(uint8_t bank, RecordHandler handler, void* state) {
+  uint32_t bankEnd = bankStart(bank) + _bankSize;
+  uint32_t pos = bankStart(bank) + HEADER_BYTES;
+  uint32_t committed = 0;
+  uint8_t generation[2] = { _storage->read(bankStart(bank) + 2), _storage->read(bankStart(bank) + 3) };
+  while (true) {
+    // Only apply a transaction once its commit record is found and its CRC
+    // matches. The CRC starts with the bank's generation, so transactions left
+    // over from an earlier use of the bank never match.
+    StreamableChecksum crc(StreamableChecksum::CRC16);
+    crc.update(generation[0]);
+    crc.update(generation[1]);
+    uint32_t commit = pos;
+    uint8_t type;
+    uint32_t size;
+    while ((size = recordSize(commit, bankEnd, type)) > 0 && type != RECORD_COMMIT) {
+      for (uint32_t i = 0; i < size; i++) {
+        crc.update(_storage->read(commit + i));
+      }
+      commit += size;
+    }
+    if (size == 0) break;
+    uint16_t stored = _storage->read(commit + 1) | (_storage->read(commit + 2) << 8);
+    if (stored != crc.value()) break;
+
+    for (uint32_t record = pos; handler && record < commit; record += size) {
+      size = recordSize(record, bankEnd, type);
+      uint8_t keyLen = _storage->read(record + 1);
+      uint8_t valLen = (type == RECORD_PUT) ? _storage->read(record + 2) : 0;
+      uint32_t data = record + ((type == RECORD_PUT) ? 3 : 2);
+      char buffer[keyLen + 1 + valLen + 1];
+      for (uint8_t i = 0; i < keyLen; i++) buffer[i] = _storage->read(data + i);
+      buffer[keyLen] = '\0';
+      char* value = buffer + keyLen + 1;
+      for (uint8_t i = 0; i < valLen; i++) value[i] = _storage->read(data + keyLen + i);
+      value[valLen] = '\0';
+      handler(buffer, (type == RECORD_PUT) ? value : nullptr, valLen, state);
+    }
+    pos = commit + COMMIT_BYTES;
+    committed = pos;
+  }
+  return committed;
+}
+
+void StreamableStore::mount() {
+  _mounted = true;
+  _bank = -1;
+  bool valid[2];
+  uint16_t generation[2];
+  for (uint8_t b = 0; b < 2; b++) {
+    uint32_t header = bankStart(b);
+    valid[b] = (_storage->read(header) == MAGIC_0 && _storage->read(header + 1) == MAGIC_1);
+    generation[b] = _storage->read(header + 2) | (_storage->read(header + 3) << 8);
+  }
+  // Try the newer bank first. Generations wrap around.
+  uint8_t newer = valid[1] && (!valid[0] || static_cast<int16_t>(generation[1] - generation[0]) > 0) ? 1 : 0;
+  for (uint8_t i = 0; i < 2; i++) {
+    uint8_t b = i ? 1 - newer : newer;
+    if (!valid[b]) continue;
+    uint32_t end = replay(b, nullptr, nullptr);
+    if (end == 0) continue;
+    uint32_t header = bankStart(b);
+    _bank = b;
+    _generation = generation[b];
+    _typeId = static_cast<int16_t>(_storage->read(header + 4) | (_storage->read(header + 5) << 8));
+    _version = _storage->read(header + 6);
+    _writePos = end;
+    return;
+  }
+}
+
+void StreamableStore::snapshot(StreamableDTO* snapshot) {
+  if (_bank < 0) return;
+  auto handler = [](const char* key, const char* value, size_t valueLength, void* state) {
+    StreamableDTO* fields = static_cast<StreamableDTO*>(state);
+    if (value) {
+      fields->putBytes(key, value, valueLength);
+    } else {
+      fields->remove(key);
+    }
+  };
+  replay(_bank, handler, snapshot);
+}
+
+bool StreamableStore::load(StreamableDTO* dto) {
+  if (!_mounted) mount();
+  if (_bank < 0) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: Nothing saved in the store"));
+#endif
+    return false;
+  }
+  if (_typeId != -1 && !dto->isCompatibleTypeAndVersion(StreamableDTO::MetaInfo(_typeId, _version))) {
+    return false;
+  }
+  StreamableDTO fields;
+  snapshot(&fields);
+  uint16_t lineNumber = _typeId != -1 ? 1 : 0;
+  fields.forEach([&](const StreamableDTO::EntryView& e) -> bool {
+    return dto->parseFields(lineNumber++, e.key, strlen(e.key), e.value, e.valueLength);
+  });
+  if (_typeId != -1) {
+    dto->_deserializedVer = _version;
+  }
+  return true;
+}
+
+bool StreamableStore::serialize(StreamableDTO* dto, StreamableDTO* fields) {
+  return dto->forEach([&](const StreamableDTO::EntryView& e) -> bool {
+    char line[_bufferBytes];
+    size_t len = dto->toLine(e, line, _bufferBytes);
+    if (!len) return false;
+    char* sep = static_cast<char*>(memchr(line, '=', len));
+    size_t keyLen = sep ? sep - line : len;
+    const char* val = sep ? sep + 1 : "";
+    size_t valLen = sep ? len - keyLen - 1 : 0;
+    line[keyLen] = '\0';
+    if (keyLen > MAX_FIELD_LEN || valLen > MAX_FIELD_LEN) {
+#if defined(DEBUG)
+      Serial.println(F("ERROR: Field too long for the store"));
+#endif
+      return false;
+    }
+    return fields->putBytes(line, val, valLen);
+  });
+}
+
+void StreamableStore::writeByte(uint32_t address, uint8_t value) {
+  _storage->write(address, value);
+  _bytesWritten++;
+}
+
+void StreamableStore::writeRecord(const char* key, const char* value, size_t valueLength) {
+  uint8_t keyLen = strlen(key);
+  uint8_t header[3] = { value ? RECORD_PUT : RECORD_DELETE, keyLen, static_cast<uint8_t>(valueLength) };
+  for (uint8_t i = 0; i < (value ? 3 : 2); i++) {
+    writeByte(_writePos, header[i]);
+    _crc.update(header[i]);
+    _writePos++;
+  }
+  for (const char* p = key; *p; p++) {
+    writeByte(_writePos++, *p);
+    _crc.update(*p);
+  }
+  for (size_t i = 0; value && i < valueLength; i++) {
+    writeByte(_writePos++, value[i]);
+    _crc.update(value[i]);
+  }
+}
+
+void StreamableStore::writeTerminator(uint32_t address, uint32_t bankEnd) {
+  // Anything after it is left over from an earlier use of the bank
+  if (address < bankEnd && _storage->read(address) != TERMINATOR) {
+    writeByte(address, TERMINATOR);
+  }
+}
+
+void StreamableStore::beginTransaction(uint16_t generation) {
+  _crc.reset();
+  _crc.update(generation & 0xFF);
+  _crc.update(generation >> 8);
+}
+
+void StreamableStore::writeCommit() {
+  uint16_t crc = _crc.value();
+  writeByte(_writePos + 1, crc & 0xFF);
+  writeByte(_writePos + 2, crc >> 8);
+  writeByte(_writePos, RECORD_COMMIT);
+  _writePos += COMMIT_BYTES;
+}
+
+uint32_t StreamableStore::writeChanges(StreamableDTO* fields, StreamableDTO* stored, bool dryRun) {
+  uint32_t bytes = 0;
+  fields->forEach([&](const StreamableDTO::EntryView& e) -> bool {
+    StreamableDTO::EntryView old = stored ? stored->getView(e.key) : StreamableDTO::EntryView();
+    if (!old.value || old.valueLength != e.valueLength || memcmp(old.value, e.value, e.valueLength) != 0) {
+      bytes += 3 + strlen(e.key) + e.valueLength;
+      if (!dryRun) writeRecord(e.key, e.value, e.valueLength);
+    }
+    return true;
+  });
+  if (stored) {
+    stored->forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      if (!fields->exists(e.key)) {
+        bytes += 2 + strlen(e.key);
+        if (!dryRun) writeRecord(e.key, nullptr, 0);
+      }
+      return true;
+    });
+  }
+  return bytes;
+}
+
+bool StreamableStore::compact(StreamableDTO* fields, StreamableDTO* dto) {
+  uint8_t target = (_bank == 0) ? 1 : 0;
+  uint32_t start = bankStart(target);
+  uint32_t bankEnd = start + _bankSize;
+  uint32_t size = writeChanges(fields, nullptr, true);
+  if (HEADER_BYTES + size + COMMIT_BYTES > _bankSize) {
+#if defined(DEBUG)
+    Serial.println(F("ERROR: DTO doesn't fit in the store"));
+#endif
+    return false;
+  }
+  // The header is invalid until the copy is committed, so a power failure
+  // leaves the current bank in use
+  if (_storage->read(start) != 0) writeByte(start, 0);
+  _writePos = start + HEADER_BYTES;
+  uint16_t generation = (_bank >= 0) ? _generation + 1 : 0;
+  writeTerminator(_writePos + size + COMMIT_BYTES, bankEnd);
+  beginTransaction(generation);
+  writeChanges(fields, nullptr, false);
+  writeCommit();
+
+  int16_t typeId = dto->getTypeId();
+  uint8_t version = dto->getSerialVersion();
+  writeByte(start + 2, generation & 0xFF);
+  writeByte(start + 3, generation >> 8);
+  writeByte(start + 4, static_cast<uint16_t>(typeId) & 0xFF);
+  writeByte(start + 5, static_cast<uint16_t>(typeId) >> 8);
+  writeByte(start + 6, version);
+  writeByte(start + 1, MAGIC_1);
+  writeByte(start, MAGIC_0);
+  _bank = target;
+  _generation = generation;
+  _typeId = typeId;
+  _version = version;
+  return true;
+}
+
+bool StreamableStore::save(StreamableDTO* dto) {
+  if (!_mounted) mount();
+  StreamableDTO fields;
+  if (!serialize(dto, &fields)) {
+    return false;
+  }
+  if (_bank >= 0 && dto->getTypeId() == _typeId && dto->getSerialVersion() == _version) {
+    StreamableDTO stored;
+    snapshot(&stored);
+    uint32_t bankEnd = bankStart(_bank) + _bankSize;
+    uint32_t size = writeChanges(&fields, &stored, true);
+    if (size == 0) {
+      return true; // nothing changed
+    }
+    if (_writePos + size + COMMIT_BYTES <= bankEnd) {
+      writeTerminator(_writePos + size + COMMIT_BYTES, bankEnd);
+      beginTransaction(_generation);
+      writeChanges(&fields, &stored, false);
+      writeCommit();
+      _storage->flush();
+      return true;
+    }
+  }
+  // The bank is full, or there's nothing valid to append to
+  bool saved = compact(&fields, dto);
+  _storage->flush();
+  return saved;
+}
+
+void StreamableStore::erase() {
+  for (uint8_t b = 0; b < 2; b++) {
+    if (_storage->read(bankStart(b)) != 0) writeByte(bankStart(b), 0);
+  }
+  _storage->flush();
+  _mounted = true;
+  _bank = -1;
+}
@@ -0,0 +1,145 @@
+/*
+
+  StreamableStore.h
+
+  Persists a StreamableDTO to EEPROM (or any ByteStorage), one changed field
+  at a time
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableStore_h
+#define _strdto_StreamableStore_h
+
+
+#include <Arduino.h>
+#include "ByteStorage.h"
+#include "StreamableChecksum.h"
+#include "StreamableDTO.h"
+
+/*
+ * Saves a DTO to storage such as an EEPROM, rewriting only the fields that
+ * changed since the last save, and loads it back without a text round trip.
+ *
+ * The storage is split into two banks. Each save appends a transaction to
+ * the current bank: a record for each changed field, a tombstone for each
+ * removed field, and a commit record with a CRC-16 of the transaction (and
+ * the bank's generation, so leftovers from an earlier use never match). A
+ * transaction without a valid commit (say, from a power failure in the middle
+ * of a save) is ignored on load, so a save either happens completely or not
+ * at all. When the current bank is full, the whole DTO is written to the other
+ * bank, whose header is written last. Appending and alternating banks spread
+ * the writes over the whole storage instead of wearing out the same bytes.
+ *
+ * Keys and values are stored as they would be sent (see toLine), and loaded
+ * through parseValue, so custom fields work the same as with StreamableManager.
+ * Keys and values can be up to 255 chars each, and each "key=value" line must
+ * fit in bufferBytes.
+ *
+ * Saving and loading briefly hold a copy of the stored fields in a temporary
+ * StreamableDTO.
+ */
+class StreamableStore {
+
+  public:
+    StreamableStore(ByteStorage* storage, size_t bufferBytes = 64);
+
+    /*
+     * Loads the last saved fields into the DTO, checking the stored typeId
+     * and version for compatibility like StreamableManager::load. Returns
+     * false if nothing was saved or the DTO is incompatible.
+     */
+    bool load(StreamableDTO* dto);
+
+    /*
+     * Writes the fields that changed since the last save. Returns false if
+     * the DTO doesn't fit in a bank.
+     */
+    bool save(StreamableDTO* dto);
+
+    /*
+     * Invalidates both banks, so that load() fails until the next save()
+     */
+    void erase();
+
+    /*
+     * Bytes written to the storage since construction, for monitoring wear
+     */
+    uint32_t getBytesWritten() const { return _bytesWritten; };
+
+    // Disable moving and copying
+    StreamableStore(StreamableStore&& other) = delete;
+    StreamableStore& operator=(StreamableStore&& other) = delete;
+    StreamableStore(const StreamableStore&) = delete;
+    StreamableStore& operator=(const StreamableStore&) = delete;
+
+  private:
+    static const uint8_t HEADER_BYTES = 7;  // magic (2), generation (2), typeId (2), version (1)
+    static const uint8_t COMMIT_BYTES = 3;  // type, CRC-16
+
+    ByteStorage* _storage;
+    size_t _bufferBytes;
+    uint32_t _bankSize;
+    bool _mounted = false;
+    int8_t _bank = -1;          // current bank, or -1 if neither is valid
+    uint16_t _generation = 0;
+    int16_t _typeId = -1;
+    uint8_t _version = 0;
+    uint32_t _writePos = 0;     // where the next transaction goes
+    uint32_t _bytesWritten = 0;
+    StreamableChecksum _crc;
+
+    /*
+     * Finds the current bank and the end of its last committed transaction
+     */
+    void mount();
+
+    /*
+     * Passes each record of the bank's committed transactions to the handler
+     * (value is nullptr for a tombstone) and returns the address after the
+     * last commit, or 0 if the bank has no committed transaction. Values may
+     * have null bytes in them, so their length is passed along too.
+     */
+    typedef void (*RecordHandler)(const char* key, const char* value, size_t valueLength, void* state);
+    uint32_t replay(uint8_t bank, RecordHandler handler, void* state);
+
+    /*
+     * Returns the size of the record at address, or 0 if there isn't a valid
+     * one. The record's type is returned in type.
+     */
+    uint32_t recordSize(uint32_t address, uint32_t bankEnd, uint8_t& type);
+
+    /*
+     * Puts the stored fields of the current bank into snapshot
+     */
+    void snapshot(StreamableDTO* snapshot);
+
+    /*
+     * Puts the DTO's fields into fields as they would be sent. Returns false
+     * if a field is too long.
+     */
+    bool serialize(StreamableDTO* dto, StreamableDTO* fields);
+
+    /*
+     * Writes a record for each field in fields that differs from stored, and
+     * a tombstone for each field in stored that isn't in fields. If stored
+     * is nullptr, every field is written. Returns the number of bytes, and
+     * only counts them if dryRun is true.
+     */
+    uint32_t writeChanges(StreamableDTO* fields, StreamableDTO* stored, bool dryRun);
+
+    void writeByte(uint32_t address, uint8_t value);
+    void writeRecord(const char* key, const char* value, size_t valueLength);
+    void writeTerminator(uint32_t address, uint32_t bankEnd);
+    void beginTransaction(uint16_t generation);
+    void writeCommit();
+    bool compact(StreamableDTO* fields, StreamableDTO* dto);
+
+    uint32_t bankStart(uint8_t bank) const { return bank * _bankSize; };
+
+};
+
+
+#endif
@@ -0,0 +1,62 @@
+#include "StreamableTypeRegistry.h"
+
+StreamableTypeRegistry::StreamableTypeRegistry(int16_t maxTypeId, uint8_t poolSize = 2)
+    : _maxTypeId(maxTypeId), _poolSize(poolSize) {
+  _slots = new Slot[_maxTypeId + 2]();
+}
+
+StreamableTypeRegistry::~StreamableTypeRegistry() {
+  for (int i = 0; i < _maxTypeId + 2; i++) {
+    Slot& slot = _slots[i];
+    for (uint8_t j = 0; j < slot.pooled; j++) {
+      delete slot.pool[j];
+    }
+    delete[] slot.pool;
+  }
+  delete[] _slots;
+}
+
+StreamableTypeRegistry::Slot* StreamableTypeRegistry::slotFor(int16_t typeId) {
+  if (typeId < -1 || typeId > _maxTypeId) return nullptr;
+  return &_slots[typeId + 1];
+}
+
+bool StreamableTypeRegistry::registerType(int16_t typeId, Factory factory, uint8_t preallocate = 0) {
+  Slot* slot = slotFor(typeId);
+  if (!slot || slot->factory || !factory) {
+#if defined(DEBUG)
+    Serial.print(F("ERROR: Can't register typeId: "));
+    Serial.println(typeId);
+#endif
+    return false;
+  }
+  slot->pool = new StreamableDTO*[_poolSize]();
+  if (!slot->pool) return false;
+  slot->factory = factory;
+  while (slot->pooled < preallocate && slot->pooled < _poolSize) {
+    StreamableDTO* dto = factory();
+    if (!dto) break;
+    slot->pool[slot->pooled++] = dto;
+  }
+  return true;
+}
+
+StreamableDTO* StreamableTypeRegistry::acquire(int16_t typeId) {
+  Slot* slot = slotFor(typeId);
+  if (!slot || !slot->factory) return nullptr;
+  if (slot->pooled > 0) {
+    return slot->pool[--slot->pooled]; // already cleared by release()
+  }
+  return slot->factory();
+}
+
+void StreamableTypeRegistry::release(StreamableDTO* dto) {
+  if (!dto) return;
+  Slot* slot = slotFor(dto->getTypeId());
+  if (!slot || !slot->factory || slot->pooled >= _poolSize) {
+    delete dto;
+    return;
+  }
+  dto->clear();
+  slot->pool[slot->pooled++] = dto;
+}
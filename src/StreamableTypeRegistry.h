@@ -0,0 +1,90 @@
+/*
+
+  StreamableTypeRegistry.h
+
+  Maps typeIds to pools of reusable StreamableDTO instances
+
+  Copyright (c) 2025, Dan Mowehhuk (danmowehhuk@gmail.com)
+  All rights reserved.
+
+*/
+
+#ifndef _strdto_StreamableTypeRegistry_h
+#define _strdto_StreamableTypeRegistry_h
+
+
+#include <Arduino.h>
+#include "StreamableDTO.h"
+
+/*
+ * A replacement for a switch-based TypeMapper function. Each registered
+ * typeId gets a factory function and a small pool of instances, and typeIds
+ * are looked up by indexing directly into a table, so finding the type of an
+ * incoming message is O(1).
+ *
+ * StreamableManager::load(Stream*, StreamableTypeRegistry*) acquires a cleared
+ * DTO from the pool instead of allocating one per message. The caller hands it
+ * back with release() when done with it. Only when a pool is empty is a new
+ * instance created with the factory.
+ *
+ * TypeIds must be between 0 and maxTypeId. A typeId of -1 can also be
+ * registered for untyped DTOs.
+ */
+class StreamableTypeRegistry {
+
+  public:
+
+    /*
+     * Function that returns a new instance of a StreamableDTO subclass
+     */
+    typedef StreamableDTO* (*Factory)();
+
+    StreamableTypeRegistry(int16_t maxTypeId, uint8_t poolSize = 2);
+    ~StreamableTypeRegistry();
+
+    /*
+     * Registers the factory for a typeId, optionally creating some instances
+     * up front so that no allocation happens later. Returns false if the
+     * typeId is out of range or already registered.
+     */
+    bool registerType(int16_t typeId, Factory factory, uint8_t preallocate = 0);
+
+    /*
+     * Returns a cleared instance for the typeId, or nullptr for an unknown
+     * typeId
+     */
+    StreamableDTO* acquire(int16_t typeId);
+
+    /*
+     * Clears the DTO and returns it to the pool for its typeId. If the pool
+     * is already full (or the type isn't registered), the DTO is deleted.
+     */
+    void release(StreamableDTO* dto);
+
+    // Disable moving and copying
+    StreamableTypeRegistry(StreamableTypeRegistry&& other) = delete;
+    StreamableTypeRegistry& operator=(StreamableTypeRegistry&& other) = delete;
+    StreamableTypeRegistry(const StreamableTypeRegistry&) = delete;
+    StreamableTypeRegistry& operator=(const StreamableTypeRegistry&) = delete;
+
+
+  private:
+    struct Slot {
+      Factory factory = nullptr;
+      StreamableDTO** pool = nullptr;
+      uint8_t pooled = 0;
+    };
+
+    /*
+     * _slots[0] is for typeId -1, and _slots[typeId + 1] for all others
+     */
+    Slot* _slots;
+    int16_t _maxTypeId;
+    uint8_t _poolSize;
+
+    Slot* slotFor(int16_t typeId);
+
+};
+
+
+#endif
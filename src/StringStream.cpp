@@ -23,7 +23,7 @@ StringStream::StringStream(const __FlashStringHelper* fstr) : _pos(0), _outStrea
   _capacity = len;
   _length = len;
   _buffer = new char[len + 1]();
-  strncpy_P(_buffer, progmemStr, len);
+  memcpy_P(_buffer, progmemStr, len);
   _buffer[len] = '\0';
 }
 
@@ -63,18 +63,32 @@ int StringStream::availableForWrite() {
 
 int StringStream::read() {
   if (_outStream || _pos >= _length) return -1;
-  return _buffer[_pos++];
+  return static_cast<uint8_t>(_buffer[_pos++]);
 }
 
 int StringStream::peek() {
   if (_outStream || _pos >= _length) return -1;
-  return _buffer[_pos];
+  return static_cast<uint8_t>(_buffer[_pos]);
 }
 
 void StringStream::flush() {
   _pos = _length;
 }
 
+bool StringStream::seek(uint32_t pos) {
+  if (_outStream || pos > _length) return false;
+  _pos = pos;
+  return true;
+}
+
+uint32_t StringStream::position() {
+  return _outStream ? _length : _pos;
+}
+
+uint32_t StringStream::size() {
+  return _length;
+}
+
 String StringStream::getString() {
   return String(_buffer);
 }
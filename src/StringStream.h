@@ -3,11 +3,13 @@
 
 
 #include <Arduino.h>
+#include "SeekableStream.h"
 
 /*
- * A Stream backed by an in-memory string
+ * A Stream backed by an in-memory string. As an input stream, it can seek
+ * anywhere within the string.
  */
-class StringStream : public Stream {
+class StringStream : public SeekableStream {
   public:
 
     // Construct an input stream (source)
@@ -30,6 +32,9 @@ class StringStream : public Stream {
     int read() override;
     int peek() override;
     void flush() override;
+    bool seek(uint32_t pos) override;
+    uint32_t position() override;
+    uint32_t size() override;
     String getString();
     char* get();
     void reset();
@@ -0,0 +1,699 @@
+/*
+ * Host-native benchmarks for the hashtable, the send/load codec and pipe.
+ *
+ * Reports ns/op, MB/s (where bytes are streamed) and heap allocations per op.
+ * Allocations are counted by interposing malloc & co., which also catches the
+ * strdup's inside StreamableDTO.
+ *
+ * Usage: ./benchmark [name-filter]
+ */
+
+#include <Arduino.h>
+#include <StreamableDTO.h>
+#include <StreamableManager.h>
+#include <StringStream.h>
+#include <StreamableArray.h>
+#include <CompressedStream.h>
+#include <StreamableLog.h>
+#include <StreamableScanner.h>
+#include <time.h>
+
+/*
+ * Allocation counting
+ */
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* ptr, size_t size);
+  void __libc_free(void* ptr);
+}
+
+static uint64_t allocCount = 0;
+
+extern "C" void* malloc(size_t size) {
+  allocCount++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+  allocCount++;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+  allocCount++;
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr) {
+  __libc_free(ptr);
+}
+
+/*
+ * Timing harness
+ */
+static const uint64_t MIN_RUN_NS = 200 * 1000 * 1000UL;
+static const char* nameFilter = nullptr;
+
+static uint64_t nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Runs body repeatedly for at least MIN_RUN_NS. Each call of body performs
+ * opsPerCall operations and streams bytesPerCall bytes (0 if not applicable).
+ */
+template <typename Body>
+static void bench(const char* name, uint32_t opsPerCall, uint32_t bytesPerCall, Body body) {
+  if (nameFilter && !strstr(name, nameFilter)) return;
+  body(); // warm up
+  uint64_t calls = 0;
+  uint64_t allocsBefore = allocCount;
+  uint64_t start = nowNs();
+  uint64_t elapsed = 0;
+  do {
+    body();
+    calls++;
+    elapsed = nowNs() - start;
+  } while (elapsed < MIN_RUN_NS);
+  uint64_t allocs = allocCount - allocsBefore;
+  double ops = static_cast<double>(calls) * opsPerCall;
+  printf("%-36s %10.1f ns/op", name, elapsed / ops);
+  if (bytesPerCall > 0) {
+    printf(" %9.1f MB/s", (static_cast<double>(calls) * bytesPerCall) / (elapsed / 1e9) / 1e6);
+  } else {
+    printf(" %14s", "");
+  }
+  printf(" %8.2f allocs/op\n", allocs / ops);
+}
+
+/*
+ * Test data
+ */
+static const int MAX_KEYS = 512;
+static char keys[MAX_KEYS][12];
+static char missKeys[MAX_KEYS][12];
+static char values[MAX_KEYS][12];
+
+static void initData() {
+  for (int i = 0; i < MAX_KEYS; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+    snprintf(missKeys[i], sizeof(missKeys[i]), "miss%d", i);
+    snprintf(values[i], sizeof(values[i]), "%d", i * 7919);
+  }
+}
+
+static void fill(StreamableDTO& dto, int n, bool keyPmem) {
+  for (int i = 0; i < n; i++) {
+    dto.put(keys[i], values[i], keyPmem);
+  }
+}
+
+static volatile size_t sink;
+
+/*
+ * Exposes processEntries, to compare it with forEach and range-for
+ */
+class IterableDTO: public StreamableDTO {
+  public:
+    using StreamableDTO::processEntries;
+};
+
+static void benchIteration(int size) {
+  char name[64];
+  IterableDTO dto;
+  fill(dto, size, false);
+  size_t total = 0;
+
+  snprintf(name, sizeof(name), "iterate/processEntries/%d", size);
+  bench(name, size, 0, [&]() {
+    auto processor = [](const char*, const char* value, bool, bool, void* capture) -> bool {
+      *static_cast<size_t*>(capture) += value[0];
+      return true;
+    };
+    dto.processEntries(processor, &total);
+  });
+
+  snprintf(name, sizeof(name), "iterate/forEach/%d", size);
+  bench(name, size, 0, [&]() {
+    dto.forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      total += e.value[0];
+      return true;
+    });
+  });
+
+  snprintf(name, sizeof(name), "iterate/range-for/%d", size);
+  bench(name, size, 0, [&]() {
+    for (StreamableDTO::EntryView e : dto) {
+      total += e.value[0];
+    }
+  });
+  sink = total; // keeps the loops from being optimized away
+}
+
+static void benchHashtable() {
+  static const int sizes[] = { 8, 64, 512 };
+  char name[64];
+  for (int size : sizes) {
+    for (int pmem = 0; pmem < 2; pmem++) {
+      const char* mix = pmem ? "pmem" : "ram";
+
+      snprintf(name, sizeof(name), "put/%s/%d", mix, size);
+      bench(name, size, 0, [&]() {
+        StreamableDTO dto;
+        fill(dto, size, pmem);
+      });
+
+      StreamableDTO dto;
+      fill(dto, size, pmem);
+      snprintf(name, sizeof(name), "get-hit/%s/%d", mix, size);
+      bench(name, size, 0, [&]() {
+        for (int i = 0; i < size; i++) {
+          if (!dto.get(keys[i], pmem)) abort();
+        }
+      });
+
+      snprintf(name, sizeof(name), "get-miss/%s/%d", mix, size);
+      bench(name, size, 0, [&]() {
+        for (int i = 0; i < size; i++) {
+          if (dto.get(missKeys[i], pmem)) abort();
+        }
+      });
+
+      snprintf(name, sizeof(name), "put+remove/%s/%d", mix, size);
+      bench(name, size, 0, [&]() {
+        for (int i = 0; i < size; i++) {
+          dto.remove(keys[i], pmem);
+        }
+        fill(dto, size, pmem);
+      });
+    }
+    benchIteration(size);
+  }
+}
+
+static void benchScope() {
+  // A profile of 32 children with 16 fields each
+  StreamableDTO profile;
+  char key[32];
+  for (int g = 0; g < 32; g++) {
+    for (int f = 0; f < 16; f++) {
+      snprintf(key, sizeof(key), "motor.%d.field%d", g, f);
+      profile.put(key, values[f]);
+    }
+  }
+  size_t total = 0;
+
+  bench("scope/full-scan/512", 16, 0, [&]() {
+    static const char prefix[] = "motor.7.";
+    profile.forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      if (strncmp(e.key, prefix, sizeof(prefix) - 1) == 0) total += e.value[0];
+      return true;
+    });
+  });
+
+  bench("scope/indexed/512", 16, 0, [&]() {
+    profile.forEachInScope("motor.7", [&](const StreamableDTO::EntryView& e) -> bool {
+      total += e.value[0];
+      return true;
+    });
+  });
+
+  StreamableDTO child;
+  bench("scope/getChild/512", 16, 0, [&]() {
+    profile.getChild("motor.7", &child);
+  });
+  sink = total; // keeps the loops from being optimized away
+}
+
+static void benchClone() {
+  StreamableDTO status;
+  fill(status, 64, false);
+
+  bench("snapshot/deep-copy/64", 1, 0, [&]() {
+    StreamableDTO copy;
+    status.forEach([&](const StreamableDTO::EntryView& e) -> bool {
+      return copy.put(e.key, e.value, e.keyPmem, e.valPmem);
+    });
+  });
+
+  // The snapshot is dropped before the next change, so nothing is copied
+  bench("snapshot/clone/64", 1, 0, [&]() {
+    StreamableDTO copy;
+    status.cloneInto(&copy);
+  });
+
+  // The writer changes a field while the snapshot is alive, so it copies once
+  int i = 0;
+  bench("snapshot/clone+write/64", 1, 0, [&]() {
+    StreamableDTO copy;
+    status.cloneInto(&copy);
+    status.put(keys[i++ % 64], "1");
+  });
+}
+
+static void benchBulk() {
+  static const int size = 64;
+  StreamableDTO::EntryView entries[size];
+  for (int i = 0; i < size; i++) {
+    entries[i] = StreamableDTO::EntryView(keys[i], values[i], false, false);
+  }
+
+  bench("bulk/put-each/64", size, 0, [&]() {
+    StreamableDTO dto;
+    for (int i = 0; i < size; i++) dto.put(keys[i], values[i]);
+  });
+
+  bench("bulk/putAll/64", size, 0, [&]() {
+    StreamableDTO dto;
+    dto.putAll(entries, size);
+  });
+
+  // A config overlay replacing half of the defaults and adding as many new keys
+  StreamableDTO overlay;
+  for (int i = size / 2; i < size + size / 2; i++) overlay.put(keys[i], "1");
+  bench("bulk/merge-overlay/64", size, 0, [&]() {
+    StreamableDTO dto;
+    dto.putAll(entries, size);
+    dto.merge(overlay);
+  });
+}
+
+static void benchCodec() {
+  static const int fields = 16;
+  StreamableManager mgr;
+  StreamableDTO dto;
+  fill(dto, fields, false);
+
+  StringStream probe(4096);
+  mgr.send(&probe, &dto);
+  String serialized = probe.getString();
+  uint32_t bytes = serialized.length();
+
+  bench("send/16-fields", 1, bytes, [&]() {
+    StringStream out(4096);
+    mgr.send(&out, &dto);
+  });
+
+  StringStream in(serialized);
+  bench("load/16-fields", 1, bytes, [&]() {
+    in.reset();
+    StreamableDTO loaded;
+    mgr.load(&in, &loaded);
+  });
+
+  // Keys are already pooled by the DTO kept alive here, so loads only copy values
+  StreamableDTO cached;
+  cached.setInternKeys(true);
+  in.reset();
+  mgr.load(&in, &cached);
+  bench("load-interned/16-fields", 1, bytes, [&]() {
+    in.reset();
+    StreamableDTO loaded;
+    loaded.setInternKeys(true);
+    mgr.load(&in, &loaded);
+  });
+
+  StreamableDTO lazy;
+  bench("load-lazy+get1/16-fields", 1, bytes, [&]() {
+    in.reset();
+    lazy.clear();
+    lazy.setLazyLoad(true);
+    mgr.load(&in, &lazy);
+    if (!lazy.get(keys[3])) abort();
+  });
+
+  bench("roundtrip/16-fields", 1, bytes, [&]() {
+    StringStream out(4096);
+    mgr.send(&out, &dto);
+    out.toInStream();
+    StreamableDTO loaded;
+    mgr.load(&out, &loaded);
+  });
+
+  bench("roundtrip-compressed/16-fields", 1, bytes, [&]() {
+    StringStream out(4096);
+    CompressedStream<> zout(&out);
+    mgr.send(&zout, &dto);
+    zout.finish();
+    out.toInStream();
+    CompressedStream<> zin(&out);
+    StreamableDTO loaded;
+    mgr.load(&zin, &loaded);
+  });
+}
+
+static void benchValues() {
+  static const int fields = 8;
+  static const int valueBytes = 200;
+  StreamableManager mgr(256);
+  StreamableDTO dto;
+  char value[valueBytes + 1];
+  memset(value, 'v', valueBytes);
+  value[valueBytes] = '\0';
+  for (int i = 0; i < fields; i++) dto.put(keys[i], value);
+  size_t total = 0;
+
+  bench("value/get+strlen/200B", fields, 0, [&]() {
+    for (int i = 0; i < fields; i++) total += strlen(dto.get(keys[i]));
+  });
+
+  bench("value/getView/200B", fields, 0, [&]() {
+    for (int i = 0; i < fields; i++) total += dto.getView(keys[i]).valueLength;
+  });
+  sink = total; // keeps the loops from being optimized away
+
+  StringStream probe(4096);
+  mgr.send(&probe, &dto);
+  uint32_t bytes = probe.getString().length();
+  bench("send/8-fields-200B", 1, bytes, [&]() {
+    StringStream out(4096);
+    mgr.send(&out, &dto);
+  });
+}
+
+/*
+ * Exposes the word-at-a-time and one-char-at-a-time searches, to compare
+ * them with findEither (which uses SSE2 or NEON where available)
+ */
+class ScannerProbe: public StreamableScanner {
+  public:
+    using StreamableScanner::findEitherWords;
+    using StreamableScanner::findEitherScalar;
+};
+
+typedef const char* (*FindEither)(const char* p, const char* end, char a, char b);
+
+/*
+ * Finds the '=' and newline of every line, like StreamableScanner::next
+ */
+static size_t countLines(const char* p, const char* end, FindEither find) {
+  size_t lines = 0;
+  while (p < end) {
+    const char* sep = find(p, end, '=', '\n');
+    if (sep < end && *sep == '=') sep = find(sep + 1, end, '\n', '\n');
+    p = sep + 1;
+    lines++;
+  }
+  return lines;
+}
+
+static void benchScan() {
+  // A gateway log: 4 MB of lines from 64 fields, with values of varied length
+  static const size_t logBytes = 4 * 1024 * 1024;
+  char* log = static_cast<char*>(__libc_malloc(logBytes + 64));
+  size_t len = 0;
+  uint32_t lines = 0;
+  while (len < logBytes) {
+    len += snprintf(log + len, 64, "%s=%s%s\n", keys[lines % 64], values[lines % 512],
+        (lines % 3) ? "" : " (from sensor gateway)");
+    lines++;
+  }
+  size_t total = 0;
+
+  bench("scan/scalar/4MB-log", lines, len, [&]() {
+    total += countLines(log, log + len, ScannerProbe::findEitherScalar);
+  });
+
+  bench("scan/words/4MB-log", lines, len, [&]() {
+    total += countLines(log, log + len, ScannerProbe::findEitherWords);
+  });
+
+  bench("scan/findEither/4MB-log", lines, len, [&]() {
+    total += countLines(log, log + len, StreamableScanner::findEither);
+  });
+
+  bench("scan/next/4MB-log", lines, len, [&]() {
+    StreamableScanner scanner(log, len);
+    StreamableScanner::Line line;
+    while (scanner.next(line)) total += line.valueLength;
+  });
+  sink = total; // keeps the loops from being optimized away
+
+  // Replaying the log into one DTO, whose 64 fields keep being overwritten
+  StreamableManager mgr(128);
+  StringStream in(log);
+  bench("load/4MB-log", lines, len, [&]() {
+    in.reset();
+    StreamableDTO dto;
+    mgr.load(&in, &dto);
+  });
+
+  bench("loadBuffer/4MB-log", lines, len, [&]() {
+    StreamableDTO dto;
+    mgr.loadBuffer(log, len, &dto);
+  });
+  __libc_free(log);
+}
+
+static void benchArray() {
+  static const int elements = 256;
+  StreamableManager mgr(2048);
+
+  // A repeated field, streamed one element at a time
+  StreamableDTO dto;
+  StreamableArray<int16_t> samples("samples");
+  dto.addArray(&samples);
+  for (int i = 0; i < elements; i++) samples.append(i * 97 - 12000);
+  StringStream probe(4096);
+  mgr.send(&probe, &dto);
+  String serialized = probe.getString();
+  uint32_t bytes = serialized.length();
+
+  bench("array/send/256", elements, bytes, [&]() {
+    StringStream out(4096);
+    mgr.send(&out, &dto);
+  });
+
+  StringStream in(serialized);
+  StreamableDTO loaded;
+  StreamableArray<int16_t> loadedSamples("samples");
+  loaded.addArray(&loadedSamples);
+  bench("array/load/256", elements, bytes, [&]() {
+    in.reset();
+    mgr.load(&in, &loaded);
+  });
+
+  // The same elements packed into one delimited value and split by hand
+  StreamableDTO packed;
+  char* packedWire = strdup(serialized.c_str());
+  memmove(packedWire + 7, packedWire + 9, strlen(packedWire + 9) + 1); // "samples[]=" -> "samples="
+  StringStream packedIn(packedWire);
+  free(packedWire);
+  int16_t parsed[elements];
+  bench("delimited/load+split/256", elements, bytes, [&]() {
+    packedIn.reset();
+    mgr.load(&packedIn, &packed);
+    const char* p = packed.get("samples");
+    int n = 0;
+    while (*p && n < elements) {
+      char* end;
+      parsed[n++] = strtol(p, &end, 10);
+      p = (*end == ',') ? end + 1 : end;
+    }
+    sink = parsed[n - 1];
+  });
+}
+
+static void benchBatch() {
+  static const int rows = 100;
+  static const int fields = 8;
+  StreamableManager mgr(256);
+  StreamableDTO dtos[rows];
+  StreamableDTO* batch[rows];
+  for (int r = 0; r < rows; r++) {
+    for (int i = 0; i < fields; i++) {
+      char value[12];
+      snprintf(value, sizeof(value), "%d", 1000 + r * 3 + i);
+      dtos[r].put(keys[i], value);
+    }
+    batch[r] = &dtos[r];
+  }
+
+  StringStream singles(65536);
+  for (int r = 0; r < rows; r++) {
+    mgr.send(&singles, batch[r]);
+  }
+  StringStream columnar(65536);
+  mgr.sendBatch(&columnar, batch, rows, true);
+  if (!nameFilter || strstr("batch-size", nameFilter)) printf("batch-size/%dx%d: %u bytes as single DTOs, %u bytes as a batch\n", rows, fields,
+      singles.getString().length(), columnar.getString().length());
+
+  bench("send-batch/100x8", rows, columnar.getString().length(), [&]() {
+    StringStream out(65536);
+    mgr.sendBatch(&out, batch, rows, true);
+  });
+
+  StringStream in(columnar.getString());
+  StreamableDTO loaded;
+  auto visitor = [](StreamableDTO*, uint16_t, void*) -> bool { return true; };
+  bench("load-batch/100x8", rows, columnar.getString().length(), [&]() {
+    in.reset();
+    mgr.loadBatch(&in, &loaded, visitor);
+  });
+}
+
+static void benchPipe() {
+  static const int fields = 64;
+  StreamableManager mgr;
+  StreamableDTO dto;
+  fill(dto, fields, false);
+  StringStream probe(8192);
+  mgr.send(&probe, &dto);
+  String serialized = probe.getString();
+  uint32_t bytes = serialized.length();
+  StringStream in(serialized);
+
+  bench("pipe/no-filter/64-lines", 1, bytes, [&]() {
+    in.reset();
+    StringStream out(8192);
+    mgr.pipe(&in, &out);
+  });
+
+  auto dropKey7 = [](const char* line, StreamableManager::DestinationStream* dest, void*) -> bool {
+    if (strncmp(line, "key7=", 5) != 0) {
+      dest->println(line);
+    }
+    return true;
+  };
+  bench("pipe/filter/64-lines", 1, bytes, [&]() {
+    in.reset();
+    StringStream out(8192);
+    mgr.pipe(&in, &out, dropKey7);
+  });
+
+  int droppedLines = 0;
+  bench("pipe/stages/64-lines", 1, bytes, [&]() {
+    in.reset();
+    StringStream out(8192);
+    mgr.pipeThrough(&in, &out, false,
+      [&](StreamableManager::PipeLine& line) { return line.keyIs("key7") ? (droppedLines++, false) : true; },
+      [](StreamableManager::PipeLine& line) { if (line.keyIs("key8")) line.setKey("k8"); return true; });
+  });
+
+  bench("pipe/3x-single/64-lines", 1, bytes, [&]() {
+    StringStream out1(8192), out2(8192), out3(8192);
+    in.reset();
+    mgr.pipe(&in, &out1);
+    in.reset();
+    mgr.pipe(&in, &out2);
+    in.reset();
+    mgr.pipe(&in, &out3, dropKey7);
+  });
+
+  const char* key7[] = { "key7" };
+  bench("pipe/fan-out-3/64-lines", 1, bytes, [&]() {
+    in.reset();
+    StringStream out1(8192), out2(8192), out3(8192);
+    PipeSink sink1(&out1), sink2(&out2), sink3(&out3);
+    sink3.setKeys(key7, 1, true);
+    PipeSink* sinks[] = { &sink1, &sink2, &sink3 };
+    mgr.pipe(&in, sinks, 3);
+  });
+}
+
+/*
+ * A local file as a SeekableStream, so the log runs against real file I/O.
+ * Size and position are tracked here, since available() is called per byte.
+ */
+class FileStream: public SeekableStream {
+
+  public:
+    FileStream() { _file = tmpfile(); };
+    ~FileStream() { fclose(_file); };
+
+    bool seek(uint32_t pos) override {
+      if (pos > _size || fseek(_file, pos, SEEK_SET) != 0) return false;
+      _pos = pos;
+      return true;
+    };
+    uint32_t position() override { return _pos; };
+    uint32_t size() override { return _size; };
+    size_t write(uint8_t b) override { return write(&b, 1); };
+    size_t write(const uint8_t* buffer, size_t size) override {
+      size_t n = fwrite(buffer, 1, size, _file);
+      _pos += n;
+      if (_pos > _size) _size = _pos;
+      return n;
+    };
+    int available() override { return _size - _pos; };
+    int read() override {
+      int c = fgetc(_file);
+      if (c != EOF) _pos++;
+      return c;
+    };
+    int peek() override {
+      int c = fgetc(_file);
+      if (c != EOF) ungetc(c, _file);
+      return c;
+    };
+
+  private:
+    FILE* _file;
+    uint32_t _size = 0;  // tmpfile() starts empty
+    uint32_t _pos = 0;
+
+};
+
+static void benchLog() {
+  static const int fields = 8;
+  static const int records = 200;
+  static const int ids = 20;
+  StreamableManager mgr;
+  mgr.setChecksum(StreamableChecksum::CRC16);
+  StreamableDTO dto;
+  fill(dto, fields, false);
+
+  FileStream segment;
+  StreamableLog log(&mgr, "id");
+  log.open(&segment);
+  char id[12];
+  int next = 0;
+  bench("log-append/8-fields", 1, 0, [&]() {
+    snprintf(id, sizeof(id), "%d", next++ % ids);
+    dto.put("id", id);
+    if (!log.append(&dto)) abort();
+  });
+
+  StreamableDTO loaded;
+  bench("log-get/8-fields", 1, 0, [&]() {
+    snprintf(id, sizeof(id), "%d", next++ % ids);
+    if (!log.get(id, &loaded)) abort();
+  });
+
+  bench("log-open+compact/200-records", records, 0, [&]() {
+    FileStream full;
+    StreamableLog history(&mgr, "id");
+    history.open(&full);
+    for (int i = 0; i < records; i++) {
+      snprintf(id, sizeof(id), "%d", i % ids);
+      dto.put("id", id);
+      history.append(&dto);
+    }
+    StreamableLog reopened(&mgr, "id");
+    reopened.open(&full);
+    FileStream compacted;
+    reopened.beginCompaction(&compacted);
+    while (!reopened.compactStep()) {}
+  });
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) nameFilter = argv[1];
+  initData();
+  printf("%-36s %13s %14s %15s\n", "benchmark", "time", "throughput", "allocations");
+  benchHashtable();
+  benchScope();
+  benchClone();
+  benchBulk();
+  benchCodec();
+  benchValues();
+  benchScan();
+  benchArray();
+  benchBatch();
+  benchPipe();
+  benchLog();
+  return 0;
+}
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# Builds and runs the benchmarks natively on the host, using the minimal
+# Arduino core in shim/. Pass a name filter to run a subset, e.g.
+#   ./build.sh get-hit
+# -fpermissive matches the flags used by the Arduino AVR core. It still warns
+# about the default arguments repeated on definitions, as the sketches do.
+
+cd "$(dirname "$0")" && \
+g++ -std=gnu++11 -O2 -fpermissive -Wall -Wextra -I shim -I ../../src \
+  shim/Arduino.cpp ../../src/*.cpp benchmark.cpp -o benchmark && \
+./benchmark "$@"
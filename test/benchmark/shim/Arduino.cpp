@@ -0,0 +1,26 @@
+#include "Arduino.h"
+#include <time.h>
+
+HostSerial Serial;
+
+unsigned long micros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+size_t Print::print(const char* str) {
+  size_t n = 0;
+  while (*str) n += write(*str++);
+  return n;
+}
+
+size_t Print::print(long value) {
+  char buf[21];
+  snprintf(buf, sizeof(buf), "%ld", value);
+  return print(buf);
+}
@@ -0,0 +1,98 @@
+#ifndef _bench_Arduino_h
+#define _bench_Arduino_h
+
+/*
+ * Just enough of the Arduino core to build StreamableDTO on a host machine.
+ * PROGMEM is ordinary memory here, so the _P functions map straight onto
+ * their regular counterparts (the PROGMEM code paths in StreamableDTO are
+ * still exercised, since they are selected by the keyPmem/valPmem flags).
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+
+#define pgm_read_byte(p) (*reinterpret_cast<const uint8_t*>(p))
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strstr_P strstr
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define snprintf_P snprintf
+
+unsigned long micros();
+unsigned long millis();
+
+class String {
+  public:
+    String(const char* str = "") : _str(str ? str : "") {};
+    String(const __FlashStringHelper* str) : _str(reinterpret_cast<const char*>(str)) {};
+    String(int value) : _str(std::to_string(value)) {};
+    const char* c_str() const { return _str.c_str(); };
+    unsigned int length() const { return _str.length(); };
+    String operator+(const String& other) const { return String((_str + other._str).c_str()); };
+    int indexOf(const String& other) const {
+      size_t pos = _str.find(other._str);
+      return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    };
+  private:
+    std::string _str;
+};
+
+class Print {
+  public:
+    virtual ~Print() {};
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size-- && write(*buffer++)) n++;
+      return n;
+    };
+    virtual int availableForWrite() { return 0; };
+    virtual void flush() {};
+    size_t print(const char* str);
+    size_t print(const __FlashStringHelper* str) { return print(reinterpret_cast<const char*>(str)); };
+    size_t print(long value);
+    size_t println(const char* str) { return print(str) + write('\n'); };
+    size_t println(const __FlashStringHelper* str) { return print(str) + write('\n'); };
+    size_t println(long value) { return print(value) + write('\n'); };
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+/*
+ * Serial writes to stdout and never has anything to read
+ */
+class HostSerial : public Stream {
+  public:
+    void begin(unsigned long) {};
+    operator bool() { return true; };
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; };
+    int availableForWrite() override { return 64; };
+    int available() override { return 0; };
+    int read() override { return -1; };
+    int peek() override { return -1; };
+};
+
+extern HostSerial Serial;
+
+
+#endif
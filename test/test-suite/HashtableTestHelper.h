@@ -27,6 +27,15 @@ class HashtableTestHelper {
     int getEntryCount(StreamableDTO* table) {
       return table->_count;
     };
+    int getPendingRawLines(StreamableDTO* table) {
+      return table->_rawPending;
+    };
+    bool sharesTable(StreamableDTO* table, StreamableDTO* other) {
+      return table->_table == other->_table;
+    };
+    bool isRehashing(StreamableDTO* table) {
+      return table->_oldTable != nullptr;
+    };
     bool verifyEntryCount(StreamableDTO* table, int count) {
       int entryCount = 0;
       for (int i = 0; i < table->_tableSize; i++) {
@@ -36,6 +45,13 @@ class HashtableTestHelper {
           entry = entry->next;
         }
       }
+      for (int i = 0; i < table->_oldTableSize; i++) {
+        StreamableDTO::Entry* entry = table->_oldTable[i];
+        while (entry != nullptr) {
+          entryCount++;
+          entry = entry->next;
+        }
+      }
       return (entryCount == count);
     };
 
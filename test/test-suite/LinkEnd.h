@@ -0,0 +1,29 @@
+#ifndef _test_LinkEnd_h
+#define _test_LinkEnd_h
+
+
+#include <StringStream.h>
+
+/*
+ * One end of a serial link: reads what the other end sent (rx), and collects
+ * what this end writes (tx)
+ */
+class LinkEnd: public Stream {
+
+  public:
+    LinkEnd(StringStream* rx, StringStream* tx): _rx(rx), _tx(tx) {};
+
+    size_t write(uint8_t b) override { return _tx->write(b); };
+    int availableForWrite() override { return _tx->availableForWrite(); };
+    int available() override { return _rx->available(); };
+    int read() override { return _rx->read(); };
+    int peek() override { return _rx->peek(); };
+
+  private:
+    StringStream* _rx;
+    StringStream* _tx;
+
+};
+
+
+#endif
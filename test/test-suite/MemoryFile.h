@@ -0,0 +1,55 @@
+#ifndef _test_MemoryFile_h
+#define _test_MemoryFile_h
+
+
+#include <SeekableStream.h>
+
+/*
+ * A fixed-capacity file in RAM that can be read and written at any position,
+ * like an SD card File opened for writing
+ */
+class MemoryFile: public SeekableStream {
+
+  public:
+    MemoryFile(size_t capacity): _capacity(capacity) {
+      _buffer = new uint8_t[capacity];
+    };
+    ~MemoryFile() {
+      delete[] _buffer;
+    };
+
+    bool seek(uint32_t pos) override {
+      if (pos > _size) return false;
+      _pos = pos;
+      return true;
+    };
+    uint32_t position() override { return _pos; };
+    uint32_t size() override { return _size; };
+    bool truncate(uint32_t size) override {
+      if (size > _size) return false;
+      _size = size;
+      if (_pos > _size) _pos = _size;
+      return true;
+    };
+
+    size_t write(uint8_t b) override {
+      if (_pos >= _capacity) return 0;
+      _buffer[_pos++] = b;
+      if (_pos > _size) _size = _pos;
+      return 1;
+    };
+    using Print::write;
+    int available() override { return _size - _pos; };
+    int read() override { return (_pos < _size) ? _buffer[_pos++] : -1; };
+    int peek() override { return (_pos < _size) ? _buffer[_pos] : -1; };
+
+  private:
+    uint8_t* _buffer;
+    size_t _capacity;
+    uint32_t _size = 0;
+    uint32_t _pos = 0;
+
+};
+
+
+#endif
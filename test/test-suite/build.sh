@@ -2,5 +2,5 @@
 
 arduino-cli compile -e -b arduino:avr:mega \
   --libraries ~/Arduino/libraries \
-  --build-property build.extra_flags="-DDEBUG" .
+  --build-property build.extra_flags="-DDEBUG -DSTRDTO_STATS" .
   
\ No newline at end of file
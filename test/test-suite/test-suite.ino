@@ -1,8 +1,18 @@
 #include <StreamableDTO.h>
 #include <StreamableManager.h>
 #include <StringStream.h>
+#include <StaticStreamableDTO.h>
+#include <StreamableArray.h>
+#include <CompressedStream.h>
+#include <StreamableIndex.h>
+#include <StreamableKeyPool.h>
+#include <StreamableStore.h>
+#include <StreamableLog.h>
+#include <StreamableScanner.h>
 #include <TestTool.h>
 #include "HashtableTestHelper.h"
+#include "LinkEnd.h"
+#include "MemoryFile.h"
 #include "MyTypedDTO.h"
 
 StreamableManager streamMgr;
@@ -179,6 +189,60 @@ void testResize(TestInvocation* t) {
       F("Hashtable entry count should be 0"));
 }
 
+void testIncrementalResize(TestInvocation* t) {
+  t->setName(F("Incremental resize, reserve and auto-shrink"));
+  StreamableDTO table(4);
+  table.put("a", "1");
+  table.put("b", "2");
+  table.put("c", "3"); // push it over 70% load
+  t->assert(helper.getTableSize(&table) == 8, F("Table size should have doubled"));
+  t->assert(helper.isRehashing(&table), F("Entries should be moved over incrementally"));
+  t->assertEqual(table.get("a"), F("1"), F("Get during rehash failed"));
+  t->assertEqual(table.get("c"), F("3"), F("Get during rehash failed"));
+  t->assert(!helper.isRehashing(&table), F("Rehash should be done after a few operations"));
+  t->assert(helper.verifyEntryCount(&table, 3), F("Rehashed table should have 3 entries"));
+
+  t->assert(table.reserve(20), F("reserve failed"));
+  t->assert(helper.getTableSize(&table) == 32, F("reserve should size the table for 20 entries"));
+  t->assert(!helper.isRehashing(&table), F("reserve should not leave a rehash in progress"));
+  t->assertEqual(table.get("b"), F("2"), F("Get after reserve failed"));
+
+  table.setAutoShrink(true);
+  table.remove("a");
+  table.remove("b");
+  t->assert(helper.getTableSize(&table) == 16, F("Table should have started shrinking"));
+  t->assertEqual(table.get("c"), F("3"), F("Get during shrink failed"));
+  t->assert(helper.verifyEntryCount(&table, 1), F("Shrunk table should have 1 entry"));
+}
+
+#if defined(STRDTO_STATS)
+void testHashtableStats(TestInvocation* t) {
+  t->setName(F("Hashtable statistics"));
+  StreamableDTO table(4);
+  table.put("abc", "defg");
+  table.put(F("k"), F("v"));
+  table.put(F("x"), "yz");
+  StreamableDTO::HashtableStats stats;
+  table.getStats(stats);
+  t->assert(stats.entryCount == 3, F("Incorrect entry count"));
+  t->assert(stats.bucketCount == 8, F("Incorrect bucket count"));
+  t->assert(stats.resizeCount == 1, F("Incorrect resize count"));
+  t->assert(stats.keyBytes == 4, F("Incorrect key bytes"));
+  t->assert(stats.valueBytes == 8, F("Incorrect value bytes"));
+  t->assert(stats.pmemKeys == 2 && stats.pmemValues == 1, F("Incorrect PROGMEM counts"));
+  uint16_t buckets = 0, entries = 0;
+  for (uint8_t i = 0; i < StreamableDTO::HashtableStats::CHAIN_HISTOGRAM_BINS; i++) {
+    buckets += stats.chainLengths[i];
+    entries += i * stats.chainLengths[i];
+  }
+  t->assert(entries == 3, F("Chain histogram should account for every entry"));
+  t->assert(buckets == (stats.rehashing ? 12 : 8), F("Chain histogram should account for every bucket"));
+  table.resetStats();
+  table.getStats(stats);
+  t->assert(stats.resizeCount == 0, F("resetStats should clear the resize count"));
+}
+#endif
+
 void testLoadUntypedStreamableDTO(TestInvocation* t) {
   t->setName(F("Load untyped StreamableDTO"));
   String data = F("foo=bar\nabc=def\n");
@@ -231,6 +295,491 @@ void testLoadTypedStreamableDTO(TestInvocation* t) {
   delete dto;
 }
 
+void testLazyLoad(TestInvocation* t) {
+  t->setName(F("Lazy load untyped StreamableDTO"));
+  String data = F("foo=bar\nabc = def\nxyz=123\n");
+  StringStream src(data);
+  StreamableDTO dto;
+  dto.setLazyLoad(true);
+  t->assert(streamMgr.load(&src, &dto), F("DTO load failed"));
+  t->assert(helper.getEntryCount(&dto) == 0, F("Nothing should be parsed yet"));
+  t->assert(helper.getPendingRawLines(&dto) == 3, F("Should have 3 raw lines"));
+  t->assertEqual(dto.get("foo"), F("bar"), F("Lazy get returned incorrect value"));
+  t->assert(dto.exists(F("abc")), F("Lazy exists failed"));
+  t->assertEqual(dto.get("abc"), F("def"), F("Lazy value should be trimmed"));
+  t->assert(helper.getEntryCount(&dto) == 2, F("Only touched lines should be parsed"));
+  t->assert(helper.getPendingRawLines(&dto) == 1, F("Should have 1 raw line left"));
+  t->assert(dto.put("foo", "baz"), F("put over parsed key failed"));
+  StringStream dest;
+  streamMgr.send(&dest, &dto);
+  t->assert(dest.getString().indexOf(F("xyz=123")) != -1, F("Untouched line missing from output"));
+  t->assert(dest.getString().indexOf(F("foo=baz")) != -1, F("Updated line missing from output"));
+  t->assert(dest.getString().indexOf(F("bar")) == -1, F("Superseded value should not be sent"));
+  t->assert(dto.remove("xyz"), F("remove of raw line failed"));
+  t->assert(!dto.exists("xyz"), F("Removed raw line should not be found"));
+  t->assert(helper.getPendingRawLines(&dto) == 0, F("No raw lines should be left"));
+
+  String dupes = F("a=1\nb=2\na=3\n");
+  StringStream lazySrc(dupes);
+  StringStream eagerSrc(dupes);
+  StreamableDTO lazy;
+  StreamableDTO eager;
+  lazy.setLazyLoad(true);
+  streamMgr.load(&lazySrc, &lazy);
+  streamMgr.load(&eagerSrc, &eager);
+  t->assert(helper.getPendingRawLines(&lazy) == 2, F("Duplicate raw line should be dropped"));
+  t->assert(lazy.getFingerprint() == eager.getFingerprint(), F("Lazy and eager fingerprints should match"));
+  StringStream lazyOut;
+  streamMgr.send(&lazyOut, &lazy);
+  t->assert(lazyOut.getString().indexOf(F("a=1")) == -1, F("Superseded raw line should not be sent"));
+}
+
+void testIteration(TestInvocation* t) {
+  t->setName(F("Entry iteration"));
+  StreamableDTO dto;
+  dto.setLazyLoad(true);
+  String data = F("foo=bar\nabc = def\nfoo=baz\n");
+  StringStream src(data);
+  t->assert(streamMgr.load(&src, &dto), F("DTO load failed"));
+  dto.put(F("pmem"), F("value"));
+  for (int i = 0; i < 12; i++) dto.put(String(i).c_str(), "x"); // starts a resize
+
+  int visited = 0;
+  bool sawRaw = false;
+  t->assert(dto.forEach([&](const StreamableDTO::EntryView& e) -> bool {
+    visited++;
+    if (!e.keyPmem && strcmp(e.key, "abc") == 0) sawRaw = (strcmp(e.value, "def") == 0);
+    return true;
+  }), F("forEach should return true when not stopped"));
+  t->assert(sawRaw, F("forEach should split unparsed lines"));
+  t->assert(helper.getPendingRawLines(&dto) == 2, F("forEach should not parse raw lines"));
+  int calls = 0;
+  t->assert(!dto.forEach([&](const StreamableDTO::EntryView& e) -> bool { return ++calls < 2; }),
+      F("forEach should return false when stopped"));
+  t->assert(calls == 2, F("forEach should stop at the first false"));
+
+  int count = 0;
+  bool sawPmem = false;
+  for (StreamableDTO::EntryView e : dto) {
+    count++;
+    if (e.keyPmem && strcmp_P("pmem", e.key) == 0) sawPmem = e.valPmem;
+    if (!e.keyPmem && strcmp(e.key, "foo") == 0) t->assertEqual(e.value, F("baz"), F("Last duplicate line should win"));
+  }
+  t->assert(count == 15, F("Iterator should visit every entry once"));
+  t->assert(visited == 15, F("A duplicate raw line should supersede the earlier one"));
+  t->assert(sawPmem, F("Iterator should flag PROGMEM keys and values"));
+  t->assert(helper.getPendingRawLines(&dto) == 0, F("begin() should parse raw lines"));
+}
+
+void testNestedDTOs(TestInvocation* t) {
+  t->setName(F("Nested DTOs"));
+  StreamableDTO motor;
+  motor.put("current", "3.2");
+  motor.put(F("rpm"), F("1200"));
+  StreamableDTO profile;
+  profile.put("motor.10.current", "9.9");
+  profile.put("motor", "top-level");
+  t->assert(profile.putChild("motor.1", &motor), F("putChild failed"));
+  t->assertEqual(profile.get("motor.1.current"), F("3.2"), F("Child field should be scoped"));
+  t->assert(profile.exists("motor.1.rpm"), F("PROGMEM child key should be scoped"));
+  StreamableDTO fan;
+  fan.put("speed", "2");
+  t->assert(profile.putChild("fan", &fan), F("putChild failed"));
+
+  int count = 0;
+  profile.forEachInScope("motor", [&](const StreamableDTO::EntryView& e) -> bool {
+    count++;
+    return true;
+  });
+  t->assert(count == 3, F("Scope should include nested children only"));
+  count = 0;
+  profile.forEachInScope("motor.1", [&](const StreamableDTO::EntryView& e) -> bool {
+    count++;
+    return true;
+  });
+  t->assert(count == 2, F("Scope should not match a longer sibling name"));
+
+  StreamableDTO copy;
+  t->assert(profile.getChild("motor.1", &copy), F("getChild failed"));
+  t->assertEqual(copy.get("current"), F("3.2"), F("getChild should strip the scope"));
+  t->assertEqual(copy.get_P(PSTR("rpm")), F("1200"), F("getChild should keep values"));
+  t->assert(!profile.getChild("pump", &copy), F("getChild of a missing child should fail"));
+
+  StringStream dest;
+  t->assert(streamMgr.sendScope(&dest, &profile, "motor.1"), F("sendScope failed"));
+  t->assert(dest.getString().indexOf(F("motor.1.current=3.2")) != -1, F("Scoped line missing"));
+  t->assert(dest.getString().indexOf(F("fan")) == -1, F("Line outside the scope sent"));
+  t->assert(dest.getString().indexOf(F("9.9")) == -1, F("Sibling scope sent"));
+
+  motor.remove("rpm");
+  t->assert(profile.putChild("motor.1", &motor), F("putChild failed"));
+  t->assert(!profile.exists("motor.1.rpm"), F("putChild should replace the old child"));
+  t->assert(profile.removeChild("motor") == 2, F("removeChild should remove the subtree"));
+  t->assertEqual(profile.get("motor"), F("top-level"), F("removeChild should keep the scope's own key"));
+  t->assert(profile.exists("fan.speed"), F("removeChild should keep other scopes"));
+
+  StaticStreamableDTO<8, 96> fixed;
+  t->assert(fixed.putChild("fan", &fan), F("putChild into a fixed table failed"));
+  fixed.put("fan2", "x");
+  t->assert(fixed.removeChild("fan") == 1, F("removeChild without an index failed"));
+  t->assert(fixed.exists("fan2"), F("removeChild without an index removed too much"));
+}
+
+void testStreamableArray(TestInvocation* t) {
+  t->setName(F("Repeated fields"));
+  StreamableDTO sent;
+  StreamableArray<int16_t> samples("samples");
+  StreamableArray<float> gains("gains");
+  sent.addArray(&samples);
+  sent.addArray(&gains);
+  sent.put("foo", "bar");
+  bool appended = true;
+  for (int16_t i = 0; i < 100; i++) {
+    appended = appended && samples.append(i * 300 - 15000);
+  }
+  t->assert(appended, F("append failed"));
+  static const float values[] = { 1.5, -0.25, 3.2, 1e-6 };
+  t->assert(gains.set(values, 4), F("set failed"));
+  t->assert(samples.size() == 100 && samples[1] == -14700, F("Incorrect element"));
+
+  StringStream dest(1024);
+  t->assert(streamMgr.send(&dest, &sent), F("send failed"));
+  String wire = dest.getString();
+  t->assert(wire.indexOf(F("gains[]=1.5,-0.25,3.2,1e-06")) != -1, F("Incorrect text form"));
+  t->assert(wire.length() > 400, F("Array should not be limited by the buffer size"));
+
+  StreamableDTO loaded;
+  StreamableArray<int16_t> loadedSamples("samples");
+  StreamableArray<float> loadedGains("gains");
+  loaded.addArray(&loadedSamples);
+  loaded.addArray(&loadedGains);
+  loadedSamples.append(1); // replaced by the load
+  StringStream src(wire);
+  t->assert(streamMgr.load(&src, &loaded), F("load failed"));
+  t->assert(loadedSamples.size() == 100 && loadedSamples[0] == -15000 && loadedSamples[99] == 14700,
+      F("Incorrect elements"));
+  t->assert(loadedGains.size() == 4 && loadedGains[2] == values[2] && loadedGains[3] == values[3],
+      F("Floats should round trip exactly"));
+  t->assertEqual(loaded.get("foo"), F("bar"), F("Table fields should load too"));
+  t->assert(loaded.getArray("gains") == &loadedGains, F("getArray failed"));
+
+  StreamableDTO plain;
+  StringStream src2(F("list[]=1,2\n"));
+  t->assert(streamMgr.load(&src2, &plain), F("load without the array failed"));
+  t->assertEqual(plain.get("list[]"), F("1,2"), F("Unknown array should load as a value"));
+
+  MemoryFile file(256);
+  t->assert(samples.writeTo(&file) == 202, F("Incorrect binary size"));
+  file.seek(0);
+  t->assert(loadedSamples.readFrom(&file) && loadedSamples.size() == 100 && loadedSamples[50] == 0,
+      F("Binary round trip failed"));
+  loaded.clear();
+  t->assert(loadedSamples.size() == 0, F("clear() should empty arrays"));
+}
+
+void testKeyInterning(TestInvocation* t) {
+  t->setName(F("Key interning"));
+  StreamableKeyPool& pool = StreamableKeyPool::shared();
+  uint16_t keysBefore = pool.getKeyCount();
+  StreamableDTO* a = new StreamableDTO();
+  StreamableDTO* b = new StreamableDTO();
+  a->setInternKeys(true);
+  b->setInternKeys(true);
+  String data = F("temp=21.5\nhumidity=40\n");
+  StringStream src(data);
+  t->assert(streamMgr.load(&src, a), F("load failed"));
+  b->put("temp", "19.0");
+  b->put(F("pmem"), "x");
+  t->assert(pool.getKeyCount() == keysBefore + 2, F("Equal keys should be pooled once"));
+
+  const char* keyA = nullptr;
+  const char* keyB = nullptr;
+  for (StreamableDTO::EntryView e : *a) if (strcmp(e.key, "temp") == 0) keyA = e.key;
+  for (StreamableDTO::EntryView e : *b) if (!e.keyPmem && strcmp(e.key, "temp") == 0) keyB = e.key;
+  t->assert(keyA && keyA == keyB, F("DTOs should share the interned key"));
+  t->assertEqual(a->get(keyB), F("21.5"), F("Lookup by interned pointer failed"));
+  t->assertEqual(b->get("temp"), F("19.0"), F("Lookup by string failed"));
+
+  a->remove("temp");
+  t->assert(pool.getKeyCount() == keysBefore + 2, F("A key still in use should stay pooled"));
+  delete b;
+  t->assert(pool.getKeyCount() == keysBefore + 1, F("Unused key should be freed"));
+  delete a;
+  t->assert(pool.getKeyCount() == keysBefore, F("Pool should be empty again"));
+
+  StaticStreamableDTO<4, 32> fixed;
+  fixed.setInternKeys(true);
+  t->assert(!fixed.isInternKeys(), F("Fixed-capacity DTOs should not intern"));
+}
+
+static StreamableDTO makeStatus() {
+  StreamableDTO status;
+  status.put("state", "running");
+  status.put(F("mode"), F("auto"));
+  return status;
+}
+
+void testMoveAndClone(TestInvocation* t) {
+  t->setName(F("Move and clone"));
+  StreamableDTO status = makeStatus();
+  t->assertEqual(status.get("state"), F("running"), F("Returned DTO lost its entries"));
+  StreamableDTO moved(static_cast<StreamableDTO&&>(status));
+  t->assert(moved.exists_P(PSTR("mode")) && !status.exists("state"), F("Move constructor failed"));
+  status = static_cast<StreamableDTO&&>(moved);
+  t->assert(status.exists("state") && !moved.exists("state"), F("Move assignment failed"));
+  t->assert(moved.put("foo", "bar"), F("Moved-from DTO should stay usable"));
+  t->assertEqual(moved.get("foo"), F("bar"), F("Moved-from DTO should get what was put"));
+
+  StreamableArray<int16_t> samples("samples");
+  StreamableArray<int16_t> movedSamples("samples");
+  StreamableDTO withArray;
+  StreamableDTO movedTo;
+  withArray.addArray(&samples);
+  movedTo.addArray(&movedSamples);
+  samples.append(1);
+  movedSamples.append(2);
+  withArray.put("a", "1");
+  movedTo = static_cast<StreamableDTO&&>(withArray);
+  t->assert(movedTo.getArray("samples") == &movedSamples, F("Arrays should stay with their DTO"));
+  t->assert(withArray.getArray("samples") == &samples, F("Arrays should stay with their DTO"));
+  t->assert(movedSamples.size() == 1 && movedSamples[0] == 1, F("Matching arrays should get the moved elements"));
+  t->assert(samples.size() == 0, F("Moved-from arrays should be emptied"));
+  t->assertEqual(movedTo.get("a"), F("1"), F("Move assignment with arrays failed"));
+  StreamableArray<float> otherSamples("samples");
+  StreamableDTO mismatched;
+  mismatched.addArray(&otherSamples);
+  otherSamples.append(3.0f);
+  samples.append(4);
+  mismatched = static_cast<StreamableDTO&&>(withArray);
+  t->assert(otherSamples.size() == 0 && samples.size() == 0, F("Arrays that don't match should be emptied"));
+
+  samples.append(5);
+  samples.append(6);
+  StreamableDTO arraySnapshot;
+  StreamableArray<int16_t> snapshotSamples("samples");
+  arraySnapshot.addArray(&snapshotSamples);
+  t->assert(withArray.cloneInto(&arraySnapshot), F("cloneInto with arrays failed"));
+  t->assert(snapshotSamples.size() == 2 && snapshotSamples[1] == 6, F("cloneInto should copy the arrays"));
+  t->assert(arraySnapshot.getFingerprint() == withArray.getFingerprint(), F("Clone with arrays should match"));
+  StreamableDTO noArrays;
+  t->assert(!withArray.cloneInto(&noArrays), F("cloneInto without the same arrays should fail"));
+
+  for (int i = 0; i < 20; i++) status.put(String(i).c_str(), "x");
+  uint32_t fingerprint = status.getFingerprint();
+  StreamableDTO* snapshot = new StreamableDTO();
+  t->assert(status.cloneInto(snapshot), F("cloneInto failed"));
+  t->assert(helper.sharesTable(snapshot, &status), F("Clone should share the table"));
+  t->assert(snapshot->getFingerprint() == fingerprint, F("Clone should have the same content"));
+  StreamableDTO other;
+  t->assert(status.cloneInto(&other), F("Second cloneInto failed"));
+  t->assertEqual(other.get("7"), F("x"), F("Second clone is missing entries"));
+
+  t->assert(status.put("state", "stopped"), F("put into a shared DTO failed"));
+  t->assert(!helper.sharesTable(snapshot, &status), F("Changing should unshare"));
+  t->assertEqual(snapshot->get("state"), F("running"), F("Clone should not see later changes"));
+  t->assertEqual(other.get("state"), F("running"), F("Clone should not see later changes"));
+  t->assert(snapshot->remove("7") && other.exists("7"), F("Removing from a clone should only change it"));
+  delete snapshot;
+  t->assert(other.clear() && status.exists("state"), F("Clearing a clone should only change it"));
+
+  StaticStreamableDTO<4, 32> fixed;
+  t->assert(makeStatus().cloneInto(&fixed), F("Cloning into a fixed table failed"));
+  t->assertEqual(fixed.get("state"), F("running"), F("Fixed table clone should copy"));
+}
+
+void testPutAllAndMerge(TestInvocation* t) {
+  t->setName(F("putAll and merge"));
+  static const char rateKey[] PROGMEM = "rate";
+  const StreamableDTO::EntryView defaults[] = {
+    { "mode", "auto", false, false },
+    { rateKey, "9600", true, false },
+    { "name", "node", false, false }
+  };
+  StreamableDTO config;
+  t->assert(config.putAll(defaults, 3), F("putAll failed"));
+  t->assertEqual(config.get_P(rateKey), F("9600"), F("putAll lost a PROGMEM key"));
+
+  StreamableDTO big;
+  StreamableDTO::EntryView many[40];
+  char keys[40][4];
+  for (int i = 0; i < 40; i++) {
+    sprintf(keys[i], "k%d", i);
+    many[i] = StreamableDTO::EntryView(keys[i], "v", false, false);
+  }
+  t->assert(big.putAll(many, 40) && helper.getEntryCount(&big) == 40, F("putAll of many failed"));
+  t->assert(!helper.isRehashing(&big), F("putAll should size the table up front"));
+
+  StreamableDTO overlay;
+  overlay.put("mode", "manual");
+  overlay.put(F("debug"), F("on"));
+  StreamableDTO kept;
+  t->assert(kept.putAll(defaults, 3), F("putAll failed"));
+  t->assert(kept.merge(overlay, StreamableDTO::KEEP_EXISTING), F("merge failed"));
+  t->assertEqual(kept.get("mode"), F("auto"), F("KEEP_EXISTING should keep the value"));
+  t->assert(config.merge(overlay), F("merge failed"));
+  t->assertEqual(config.get("mode"), F("manual"), F("OVERWRITE should replace the value"));
+  t->assertEqual(config.get("debug"), F("on"), F("merge should add new keys"));
+  t->assert(helper.getTableSize(&config) == 8, F("merge should only make room for new keys"));
+  t->assert(config.merge(config), F("Merging into itself should do nothing"));
+
+#if defined(STRDTO_STATS)
+  StreamableDTO::HashtableStats stats;
+  config.getStats(stats);
+  t->assert(stats.pmemKeys == 2 && stats.pmemValues == 1, F("merge should keep PROGMEM pointers"));
+#endif
+}
+
+// Overrides only the string toLine, which send() must still go through
+class RenamingDTO: public StreamableDTO {
+  protected:
+    bool toLine(const char* key, const char* value, bool keyPmem, bool valPmem, char* buffer, size_t bufferSize) override {
+      if (!keyPmem && strcmp(key, "old") == 0) key = "new";
+      return StreamableDTO::toLine(key, value, keyPmem, valPmem, buffer, bufferSize);
+    }
+};
+
+void testValueViews(TestInvocation* t) {
+  t->setName(F("Value views and embedded null bytes"));
+  StreamableDTO dto;
+  dto.put("name", "node");
+  dto.put(F("mode"), F("auto"));
+  StreamableDTO::EntryView v = dto.getView("name");
+  t->assert(v.value && v.valueLength == 4 && !v.valPmem, F("Wrong view of a RAM value"));
+  v = dto.getView(F("mode"));
+  t->assert(v.value && v.valueLength == 4 && v.valPmem, F("Wrong view of a PROGMEM value"));
+  t->assert(!dto.getView("missing").value, F("Missing key should have a null view"));
+
+  const char frame[] = { 'a', '\0', 'b', '\0', 'c' };
+  t->assert(dto.putBytes("frame", frame, sizeof(frame)), F("putBytes failed"));
+  v = dto.getView("frame");
+  t->assert(v.valueLength == sizeof(frame) && memcmp(v.value, frame, sizeof(frame)) == 0,
+        F("Embedded null bytes were lost"));
+  t->assertEqual(dto.get("frame"), "a", F("get should see a string up to the first null"));
+
+  StreamableDTO other;
+  other.putBytes("frame", frame, sizeof(frame));
+  t->assert(dto.getFingerprint() != other.getFingerprint(), F("Fingerprints should differ"));
+  other.put("name", "node");
+  other.put(F("mode"), F("auto"));
+  t->assert(dto.getFingerprint() == other.getFingerprint(), F("Fingerprint should cover the whole value"));
+
+  StreamableDTO copy;
+  dto.cloneInto(&copy);
+  copy.put("extra", "1"); // takes its own copy of the entries
+  t->assert(copy.getView("frame").valueLength == sizeof(frame), F("Copying should keep the length"));
+
+  StaticStreamableDTO<4, 32> fixed;
+  fixed.putBytes("f", frame, sizeof(frame));
+  for (int i = 0; i < 6; i++) {
+    fixed.put("x", i % 2 ? "0123456789" : "9876543210"); // leaves holes, so the pool compacts
+  }
+  v = fixed.getView("f");
+  t->assert(v.valueLength == sizeof(frame) && memcmp(v.value, frame, sizeof(frame)) == 0,
+        F("Compacting should move the whole value"));
+
+  MemoryFile dest(128);
+  streamMgr.send(&dest, &dto);
+  char sent[128];
+  size_t sentLen = 0;
+  dest.seek(0);
+  for (int c; (c = dest.read()) >= 0; ) sent[sentLen++] = c;
+  const char line[] = "frame=a\0b\0c\n";
+  bool found = false;
+  for (size_t i = 0; i + sizeof(line) - 1 <= sentLen && !found; i++) {
+    found = memcmp(sent + i, line, sizeof(line) - 1) == 0;
+  }
+  t->assert(found, F("Sent value should include its null bytes"));
+  StreamableDTO received;
+  t->assert(streamMgr.loadBuffer(sent, sentLen, &received), F("loadBuffer of a binary value failed"));
+  v = received.getView("frame");
+  t->assert(v.valueLength == sizeof(frame) && memcmp(v.value, frame, sizeof(frame)) == 0,
+        F("loadBuffer should keep the null bytes"));
+
+  MemoryStorage<256> storage;
+  StreamableStore store(&storage);
+  t->assert(store.save(&dto), F("Saving a binary value failed"));
+  StreamableDTO restored;
+  t->assert(store.load(&restored), F("Loading a binary value failed"));
+  v = restored.getView("frame");
+  t->assert(v.valueLength == sizeof(frame) && memcmp(v.value, frame, sizeof(frame)) == 0,
+        F("The store should keep the null bytes"));
+
+  RenamingDTO renaming;
+  renaming.put("old", "1");
+  StringStream renamed(64);
+  streamMgr.send(&renamed, &renaming);
+  t->assertEqual(renamed.get(), F("new=1\n"), F("send should use an override of the string toLine"));
+}
+
+void testLoadBuffer(TestInvocation* t) {
+  t->setName(F("Load from a buffer"));
+  // Every position of the match, across the 16-byte and word boundaries
+  char text[48];
+  bool found = true;
+  for (size_t len = 0; len <= 40; len++) {
+    for (size_t at = 0; at <= len; at++) {
+      memset(text, 'x', sizeof(text));
+      if (at < len) text[at] = (at % 2) ? '=' : '\n';
+      found = found && StreamableScanner::findEither(text, text + len, '=', '\n') == text + at;
+    }
+  }
+  t->assert(found, F("findEither missed a delimiter"));
+
+  const char* lines = "  name = node \r\nflag\nempty=\n = v\nsamples[]=1, 2,3\nlast=a=b";
+  StringStream src(lines);
+  StreamableDTO fromStream;
+  StreamableDTO fromBuffer;
+  StreamableArray<int16_t> streamSamples("samples");
+  StreamableArray<int16_t> bufferSamples("samples");
+  fromStream.addArray(&streamSamples);
+  fromBuffer.addArray(&bufferSamples);
+  t->assert(streamMgr.load(&src, &fromStream), F("load failed"));
+  t->assert(streamMgr.loadBuffer(lines, strlen(lines), &fromBuffer), F("loadBuffer failed"));
+  t->assertEqual(fromBuffer.get("name"), "node", F("Whitespace not trimmed"));
+  t->assertEqual(fromBuffer.get("last"), "a=b", F("Only the first = separates"));
+  t->assert(fromBuffer.getFingerprint() == fromStream.getFingerprint(), F("Should match load"));
+  t->assert(bufferSamples.size() == 3 && bufferSamples[2] == 3, F("Array line not loaded"));
+
+  MyTypedDTO typed;
+  const char* meta = "__tvid=1|2\nfoo=bar\n";
+  t->assert(streamMgr.loadBuffer(meta, strlen(meta), &typed), F("Typed loadBuffer failed"));
+  t->assert(helper.getEntryCount(&typed) == 1, F("Meta line should not be a field"));
+  const char* wrongType = "__tvid=7|1\nfoo=bar\n";
+  t->assert(!streamMgr.loadBuffer(wrongType, strlen(wrongType), &typed), F("Incompatible type accepted"));
+
+  StreamableManager mgr;
+  mgr.setChecksum(StreamableChecksum::CRC16);
+  StreamableDTO one;
+  one.put("id", "1");
+  StringStream dest;
+  mgr.send(&dest, &one);
+  one.put("id", "2");
+  mgr.send(&dest, &one);
+  String both = dest.getString();
+  size_t used = 0;
+  StreamableDTO first;
+  StreamableDTO second;
+  t->assert(mgr.loadBuffer(both.c_str(), both.length(), &first, 0, &used), F("First message failed"));
+  t->assert(mgr.loadBuffer(both.c_str() + used, both.length() - used, &second), F("Second message failed"));
+  t->assertEqual(second.get("id"), "2", F("used should point at the next message"));
+  char* corrupted = strdup(both.c_str());
+  corrupted[1] ^= 0x01;
+  t->assert(!mgr.loadBuffer(corrupted, both.length(), &first), F("Corrupted message accepted"));
+  free(corrupted);
+
+  StreamableManager small(16);
+  StreamableDTO truncated;
+  const char* longLine = "key=0123456789abcdef\nnext=1";
+  small.loadBuffer(longLine, strlen(longLine), &truncated);
+  t->assertEqual(truncated.get("key"), "0123456789a", F("Long line not truncated"));
+  t->assertEqual(truncated.get("next"), "1", F("Line after a truncated one lost"));
+
+  StreamableDTO lazy;
+  lazy.setLazyLoad(true);
+  streamMgr.loadBuffer(lines, strlen(lines), &lazy);
+  t->assertEqual(lazy.get("name"), "node", F("Lazy loadBuffer failed"));
+}
+
 void testSendTypedStreamableDTO(TestInvocation* t) {
   t->setName(F("Send typed StreamableDTO"));
   MyTypedDTO dtoSent;
@@ -248,6 +797,593 @@ void testSendTypedStreamableDTO(TestInvocation* t) {
   delete dtoRcvd;
 }
 
+void testTypeRegistry(TestInvocation* t) {
+  t->setName(F("Load typed StreamableDTO from registry pool"));
+  StreamableTypeRegistry registry(4, 1);
+  auto factory = []() -> StreamableDTO* { return new MyTypedDTO(); };
+  t->assert(registry.registerType(TYPE_ID, factory, 1), F("registerType failed"));
+  t->assert(!registry.registerType(TYPE_ID, factory), F("Duplicate registerType should fail"));
+  t->assert(!registry.registerType(5, factory), F("Out of range registerType should fail"));
+  String data = F("__tvid=1|4\nfoo=bar\n");
+  StringStream ss(data);
+  StreamableDTO* dto = streamMgr.load(&ss, &registry);
+  t->assert(dto, F("Failed to load MyTypedDTO"));
+  t->assertEqual(dto->get("foo"), F("bar"));
+  t->assert(dto->getDeserializedVersion() == 4, F("Incorrect deserialized version"));
+  registry.release(dto);
+  t->assert(!dto->exists("foo"), F("Released DTO should be cleared"));
+  StringStream ss2(F("__tvid=1|3\nabc=def\n"));
+  StreamableDTO* dto2 = streamMgr.load(&ss2, &registry);
+  t->assert(dto2 == dto, F("Second load should reuse the pooled instance"));
+  t->assertEqual(dto2->get("abc"), F("def"));
+  registry.release(dto2);
+  StringStream ss3(F("__tvid=3|0\nabc=def\n"));
+  t->assert(!streamMgr.load(&ss3, &registry), F("Unknown typeId should return nullptr"));
+}
+
+void testChecksum(TestInvocation* t) {
+  t->setName(F("Inline CRC trailer on send and load"));
+  StreamableChecksum crc16(StreamableChecksum::CRC16);
+  StreamableChecksum crc32(StreamableChecksum::CRC32);
+  for (const char* c = "123456789"; *c; c++) {
+    crc16.update(*c);
+    crc32.update(*c);
+  }
+  t->assert(crc16.value() == 0x29B1, F("Incorrect CRC-16 check value"));
+  t->assert(crc32.value() == 0xCBF43926, F("Incorrect CRC-32 check value"));
+
+  StreamableManager mgr;
+  mgr.setChecksum(StreamableChecksum::CRC32);
+  MyTypedDTO dtoSent;
+  dtoSent.put("foo", "bar");
+  dtoSent.put("abc", "def");
+  StringStream dest;
+  mgr.send(&dest, &dtoSent);
+  String sent = dest.getString();
+  t->assert(sent.indexOf(F("__crc=")) != -1, F("Checksum trailer missing"));
+  StringStream src(sent);
+  StreamableDTO* dtoRcvd = mgr.load(&src, typeMapper);
+  t->assert(dtoRcvd, F("Load with correct checksum failed"));
+  t->assert(dtoRcvd && !dtoRcvd->exists("__crc"), F("Trailer should not be loaded as a field"));
+  delete dtoRcvd;
+
+  char* corrupted = strdup(sent.c_str());
+  corrupted[strlen(corrupted) - 20] ^= 0x01; // flip a bit in the body
+  StringStream bad(corrupted);
+  MyTypedDTO dto;
+  StreamableArray<int16_t> samples("samples");
+  dto.addArray(&samples);
+  dto.put("foo", "old");
+  dto.put("keep", "1");
+  samples.append(7);
+  t->assert(!mgr.load(&bad, &dto), F("Load with corrupted data should fail"));
+  t->assertEqual(dto.get("foo"), F("old"), F("Corrupted message should not change the DTO"));
+  t->assert(dto.exists("keep") && !dto.exists("abc"), F("Corrupted message should not clear the DTO"));
+  t->assert(!mgr.loadBuffer(corrupted, strlen(corrupted), &dto), F("loadBuffer with corrupted data should fail"));
+  t->assertEqual(dto.get("foo"), F("old"), F("Corrupted buffer should not change the DTO"));
+  free(corrupted);
+
+  // A good scoped update is merged into what's there
+  MyTypedDTO update;
+  StreamableArray<int16_t> updateSamples("samples");
+  update.addArray(&updateSamples);
+  update.put("foo", "new");
+  updateSamples.append(1);
+  updateSamples.append(2);
+  StringStream updateOut(128);
+  mgr.send(&updateOut, &update);
+  StringStream updateIn(updateOut.getString());
+  t->assert(mgr.load(&updateIn, &dto), F("Load of a good update failed"));
+  t->assertEqual(dto.get("foo"), F("new"), F("Update was not applied"));
+  t->assert(dto.exists("keep"), F("Update should keep other fields"));
+  t->assert(samples.size() == 2 && samples[1] == 2, F("Array should be loaded once the checksum matches"));
+  samples.append(3);
+  char* badUpdate = strdup(updateOut.getString().c_str());
+  strstr(badUpdate, "foo=new")[4] = 'b';
+  StringStream corruptedUpdate(badUpdate);
+  t->assert(!mgr.load(&corruptedUpdate, &dto), F("Corrupted update should fail"));
+  t->assert(samples.size() == 3, F("Corrupted update should not change the arrays"));
+  t->assertEqual(dto.get("foo"), F("new"), F("Corrupted update should not change the fields"));
+  free(badUpdate);
+
+  StringStream missing(F("foo=bar\n"));
+  StreamableDTO untyped;
+  t->assert(!mgr.load(&missing, &untyped), F("Load without trailer should fail"));
+}
+
+void testCompressedStream(TestInvocation* t) {
+  t->setName(F("Send and load through CompressedStream"));
+  StreamableDTO dtoSent;
+  char key[8];
+  for (int i = 0; i < 12; i++) {
+    sprintf(key, "temp%d", i);
+    dtoSent.put(key, "21.5");
+  }
+  StringStream raw(256);
+  streamMgr.send(&raw, &dtoSent);
+  MemoryFile packed(256); // counts every byte, null bytes too
+  CompressedStream<> out(&packed);
+  streamMgr.send(&out, &dtoSent);
+  out.finish();
+  t->assert(packed.size() < raw.getString().length() / 2, F("Data was not compressed"));
+
+  packed.seek(0);
+  CompressedStream<> in(&packed);
+  StreamableDTO dtoRcvd;
+  t->assert(streamMgr.load(&in, &dtoRcvd), F("DTO load failed"));
+  for (int i = 0; i < 12; i++) {
+    sprintf(key, "temp%d", i);
+    t->assertEqual(dtoRcvd.get(key), F("21.5"), F("Incorrect value after decompression"));
+  }
+}
+
+void testBatch(TestInvocation* t) {
+  t->setName(F("Columnar batch send and load"));
+  MyTypedDTO rows[3];
+  rows[0].put("ts", "1700000000");
+  rows[0].put("note", "a|b");
+  rows[1].put("ts", "1700000060");
+  rows[1].put("note", "~");
+  rows[2].put("ts", "1700000120");
+  StreamableDTO* sent[] = { &rows[0], &rows[1], &rows[2] };
+  StreamableManager mgr;
+  mgr.setChecksum(StreamableChecksum::CRC16);
+  StringStream dest(256);
+  t->assert(mgr.sendBatch(&dest, sent, 3, true), F("sendBatch failed"));
+  String data = dest.getString();
+  t->assert(data.startsWith(F("__tvid=1|4\n__batch=3|")), F("Meta line and header should be sent once"));
+  t->assert(data.indexOf(F("|^ts")) != -1, F("ts should be delta-encoded"));
+  t->assert(data.indexOf(F("60")) != -1 && data.indexOf(F("1700000060")) == -1, F("Deltas not sent"));
+
+  StreamableDTO* loaded[2];
+  StringStream src(data);
+  t->assert(mgr.loadBatch(&src, loaded, 2, typeMapper) == 2, F("Should have loaded 2 of 3 DTOs"));
+  t->assertEqual(loaded[0]->get("note"), F("a|b"), F("Escaped separator not restored"));
+  t->assertEqual(loaded[1]->get("note"), F("~"), F("Escaped marker not restored"));
+  t->assertEqual(loaded[1]->get("ts"), F("1700000060"), F("Delta not decoded"));
+  t->assert(loaded[1]->getDeserializedVersion() == SERIAL_VERSION, F("Incorrect deserialized version"));
+  delete loaded[0];
+  delete loaded[1];
+
+  struct Visited {
+    uint16_t rows = 0;
+    bool noteMissing = false;
+  } visited;
+  auto visitor = [](StreamableDTO* dto, uint16_t row, void* state) -> bool {
+    Visited* v = static_cast<Visited*>(state);
+    v->rows++;
+    if (row == 2) {
+      v->noteMissing = !dto->exists("note") && strcmp(dto->get("ts"), "1700000120") == 0;
+    }
+    return true;
+  };
+  MyTypedDTO dto;
+  StringStream src2(data);
+  t->assert(mgr.loadBatch(&src2, &dto, visitor, &visited), F("Batch load with visitor failed"));
+  t->assert(visited.rows == 3, F("Visitor should see every row"));
+  t->assert(visited.noteMissing, F("Missing field should not be loaded"));
+
+  data.setCharAt(data.length() - 12, '9');
+  StringStream bad(data);
+  t->assert(mgr.loadBatch(&bad, loaded, 2, typeMapper) == 0, F("Corrupted batch should fail"));
+}
+
+void testStreamableIndex(TestInvocation* t) {
+  t->setName(F("Offset index for random access"));
+  StringStream data(512);
+  char id[8];
+  for (int i = 1; i <= 5; i++) {
+    MyTypedDTO dto;
+    sprintf(id, "%d", i * 50);
+    dto.put("id", id);
+    dto.put("foo", "bar");
+    streamMgr.send(&data, &dto);
+  }
+  data.toInStream();
+  StringStream indexData(256);
+  t->assert(StreamableIndex::build(&data, &indexData, "id", 4) == 5, F("Should have indexed 5 records"));
+  indexData.toInStream();
+
+  StreamableIndex index(&indexData);
+  t->assert(index.isValid(), F("Index should be valid"));
+  t->assert(index.getRecordCount() == 5, F("Incorrect record count"));
+  StreamableIndex::Entry entry;
+  t->assert(index.getEntry(2, entry), F("getEntry failed"));
+  t->assert(entry.typeId == TYPE_ID, F("Incorrect typeId"));
+  t->assertEqual(entry.key, F("150"), F("Incorrect key"));
+
+  BoundedStream record(&data, entry.offset, entry.length);
+  MyTypedDTO loaded;
+  t->assert(streamMgr.load(&record, &loaded), F("Record load failed"));
+  t->assertEqual(loaded.get("id"), F("150"), F("Loaded the wrong record"));
+  t->assert(!data.available() || data.position() == entry.offset + entry.length, F("Read past the record"));
+
+  t->assert(index.findKey("200", entry) == 3, F("findKey exact match failed"));
+  t->assert(index.findKey("60", entry) == 1, F("findKey should compare numerically"));
+  t->assert(index.findKey("251", entry) == -1, F("findKey past the end should fail"));
+  t->assert(!index.getEntry(5, entry), F("getEntry past the end should fail"));
+}
+
+void testFingerprint(TestInvocation* t) {
+  t->setName(F("Order-independent fingerprint and skipping unchanged sends"));
+  StreamableDTO a;
+  StreamableDTO b(32);
+  t->assert(a.getFingerprint() == b.getFingerprint(), F("Empty DTOs should match"));
+  a.put("foo", "bar");
+  a.put("abc", "def");
+  b.put(F("abc"), F("def"));
+  b.put("foo", "bar");
+  t->assert(a.getFingerprint() == b.getFingerprint(), F("Same content should match"));
+  uint32_t before = a.getFingerprint();
+  a.put("foo", "baz");
+  t->assert(a.getFingerprint() != before, F("Update should change the fingerprint"));
+  a.put("foo", "bar");
+  t->assert(a.getFingerprint() == before, F("Restoring the value should restore the fingerprint"));
+  a.put("x", "1");
+  a.remove("x");
+  t->assert(a.getFingerprint() == before, F("Remove should undo put"));
+
+  StreamableDTO lazy;
+  lazy.setLazyLoad(true);
+  StringStream src(F("foo=bar\nabc = def\n"));
+  streamMgr.load(&src, &lazy);
+  t->assert(lazy.getFingerprint() == before, F("Unparsed lines should be included"));
+  lazy.get("foo");
+  t->assert(lazy.getFingerprint() == before, F("Parsing a line should not change the fingerprint"));
+  lazy.clear();
+  t->assert(lazy.getFingerprint() == 0, F("Cleared DTO should have an empty fingerprint"));
+
+  StreamableManager mgr;
+  mgr.setSkipUnchanged(true);
+  StringStream dest(128);
+  t->assert(mgr.send(&dest, &a), F("First send should go out"));
+  size_t sentLen = dest.getString().length();
+  t->assert(!mgr.send(&dest, &b), F("Unchanged send should be skipped"));
+  t->assert(dest.getString().length() == sentLen, F("Skipped send should not write"));
+  StringStream other(128);
+  t->assert(mgr.send(&other, &b), F("Other destination should get it"));
+  b.put("foo", "baz");
+  t->assert(mgr.send(&dest, &b), F("Changed DTO should be sent"));
+  mgr.forgetSent(&dest);
+  t->assert(mgr.send(&dest, &b), F("Should send after forgetSent"));
+
+  StreamableArray<int16_t> samples("samples");
+  b.addArray(&samples);
+  samples.append(1);
+  t->assert(mgr.send(&dest, &b), F("Appending to an array should change the fingerprint"));
+  samples[0] = 2;
+  t->assert(mgr.send(&dest, &b), F("Changing an element should change the fingerprint"));
+  t->assert(!mgr.send(&dest, &b), F("Unchanged array should be skipped"));
+}
+
+void testStreamableStore(TestInvocation* t) {
+  t->setName(F("Persistent store with field-level writes"));
+  MemoryStorage<256> storage;
+  StreamableStore store(&storage);
+  MyTypedDTO config;
+  t->assert(!store.load(&config), F("Empty storage should not load"));
+  config.put("ssid", "home");
+  config.put("channel", "6");
+  config.put(F("mode"), F("station"));
+  t->assert(store.save(&config), F("First save failed"));
+  uint32_t fullSave = store.getBytesWritten();
+
+  config.put("channel", "11");
+  t->assert(store.save(&config), F("Update failed"));
+  uint32_t updateBytes = store.getBytesWritten() - fullSave;
+  t->assert(updateBytes < fullSave / 2, F("Only the changed field should be written"));
+  uint32_t before = store.getBytesWritten();
+  t->assert(store.save(&config), F("Unchanged save failed"));
+  t->assert(store.getBytesWritten() == before, F("Unchanged save should not write"));
+
+  config.remove("ssid");
+  t->assert(store.save(&config), F("Save with removal failed"));
+  StreamableStore reopened(&storage);
+  MyTypedDTO loaded;
+  t->assert(reopened.load(&loaded), F("Load failed"));
+  t->assertEqual(loaded.get("channel"), F("11"), F("Incorrect updated value"));
+  t->assertEqual(loaded.get("mode"), F("station"), F("Incorrect PROGMEM value"));
+  t->assert(!loaded.exists("ssid"), F("Removed field should stay removed"));
+  t->assert(loaded.getDeserializedVersion() == SERIAL_VERSION, F("Incorrect deserialized version"));
+
+  // A transaction without a valid commit is ignored
+  config.put("channel", "1");
+  store.save(&config);
+  uint32_t newValue = 0;
+  for (uint32_t i = 0; i + 8 <= storage.size(); i++) {
+    bool match = true;
+    for (uint8_t j = 0; j < 8 && match; j++) match = (storage.read(i + j) == "channel1"[j]);
+    if (match) newValue = i + 7;
+  }
+  storage.write(newValue, '2'); // as if power failed halfway through
+  StreamableStore torn(&storage);
+  MyTypedDTO afterTear;
+  t->assert(torn.load(&afterTear), F("Load after torn write failed"));
+  t->assertEqual(afterTear.get("channel"), F("11"), F("Torn transaction should be ignored"));
+
+  // Filling a bank switches to the other one
+  char value[8];
+  for (int i = 0; i < 40; i++) {
+    sprintf(value, "%d", i);
+    config.put("channel", value);
+    t->assert(torn.save(&config), F("Save failed while switching banks"));
+  }
+  StreamableStore last(&storage);
+  MyTypedDTO afterSwitch;
+  t->assert(last.load(&afterSwitch), F("Load after switching banks failed"));
+  t->assertEqual(afterSwitch.get("channel"), F("39"), F("Incorrect value after switching banks"));
+  t->assertEqual(afterSwitch.get("mode"), F("station"), F("Field lost when switching banks"));
+
+  MyTypedDTO tooBig;
+  char big[100];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  StreamableStore bigStore(&storage, 128);
+  tooBig.put("a", big);
+  tooBig.put("b", big);
+  t->assert(!bigStore.save(&tooBig), F("DTO bigger than a bank should fail"));
+}
+
+void testStreamableLog(TestInvocation* t) {
+  t->setName(F("Append-only log with incremental compaction"));
+  MemoryFile segment(1024);
+  StreamableManager mgr;
+  StreamableLog log(&mgr, "id");
+  t->assert(log.open(&segment) == 0, F("New log should be empty"));
+  const char* ids[] = { "1", "2", "3", "2" };
+  const char* vals[] = { "a", "b", "c", "b2" };
+  for (int i = 0; i < 4; i++) {
+    MyTypedDTO dto;
+    dto.put("id", ids[i]);
+    dto.put("val", vals[i]);
+    t->assert(log.append(&dto), F("Append failed"));
+  }
+  StreamableDTO untyped;
+  untyped.put("id", "4");
+  t->assert(!log.append(&untyped), F("Untyped DTO without checksum can't be framed"));
+  t->assert(log.getSupersededCount() == 1, F("Incorrect superseded count"));
+  MyTypedDTO loaded;
+  t->assert(log.get("2", &loaded), F("get failed"));
+  t->assertEqual(loaded.get("val"), F("b2"), F("get should return the latest record"));
+  t->assert(!log.get("9", &loaded), F("get of an unknown key should fail"));
+
+  StreamableLog reopened(&mgr, "id");
+  t->assert(reopened.open(&segment) == 4, F("Reopen should find 4 records"));
+  t->assert(reopened.getSupersededCount() == 1, F("Incorrect superseded count after reopen"));
+  MyTypedDTO reloaded;
+  t->assert(reopened.get("2", &reloaded), F("get after reopen failed"));
+  t->assertEqual(reloaded.get("val"), F("b2"), F("Reopen should find the latest record"));
+
+  MemoryFile compacted(1024);
+  t->assert(log.beginCompaction(&compacted), F("beginCompaction failed"));
+  t->assert(!log.beginCompaction(&compacted), F("Compaction is already in progress"));
+  t->assert(!log.compactStep(1), F("Compaction should take more than one step"));
+  MyTypedDTO update;
+  update.put("id", "3");
+  update.put("val", "c2");
+  t->assert(log.append(&update), F("Append during compaction failed"));
+  int steps = 1;
+  while (!log.compactStep(1) && log.isCompacting() && steps < 10) steps++;
+  t->assert(!log.isCompacting(), F("Compaction should have finished"));
+  t->assert(log.getSupersededCount() == 0, F("Compacted log should have no superseded records"));
+  t->assert(compacted.size() < segment.size(), F("Compacted segment should be smaller"));
+  MyTypedDTO c;
+  t->assert(log.get("3", &c), F("get after compaction failed"));
+  t->assertEqual(c.get("val"), F("c2"), F("Record appended during compaction should be kept"));
+  MyTypedDTO b;
+  t->assert(log.get("2", &b), F("get after compaction failed"));
+  t->assertEqual(b.get("val"), F("b2"), F("Latest record should be kept"));
+  uint32_t before = compacted.size();
+  t->assert(log.append(&update) && compacted.size() > before, F("Appends should go to the compacted segment"));
+
+  // Keys longer than keyBytes that share a prefix are kept apart
+  MemoryFile sensors(512);
+  StreamableLog byName(&mgr, "id", 4);
+  byName.open(&sensors);
+  const char* names[] = { "sensor-kitchen", "sensor-garage", "sensor-kitchen" };
+  const char* temps[] = { "21", "15", "22" };
+  for (int i = 0; i < 3; i++) {
+    MyTypedDTO dto;
+    dto.put("id", names[i]);
+    dto.put("temp", temps[i]);
+    t->assert(byName.append(&dto), F("Append with a long key failed"));
+  }
+  t->assert(byName.getSupersededCount() == 1, F("Only the repeated long key should be superseded"));
+  MyTypedDTO garage;
+  t->assert(byName.get("sensor-garage", &garage), F("get with a long key failed"));
+  t->assertEqual(garage.get("temp"), F("15"), F("Keys sharing a prefix should not collide"));
+  t->assert(!byName.get("sens", &garage), F("get of a key prefix should fail"));
+  StreamableLog reopenedByName(&mgr, "id", 4);
+  t->assert(reopenedByName.open(&sensors) == 3, F("Reopen should find 3 records"));
+  t->assert(reopenedByName.getSupersededCount() == 1, F("Incorrect superseded count for long keys"));
+  MyTypedDTO kitchen;
+  t->assert(reopenedByName.get("sensor-kitchen", &kitchen), F("get with a long key after reopen failed"));
+  t->assertEqual(kitchen.get("temp"), F("22"), F("Reopen should find the latest record for a long key"));
+
+  // A record that only partly fits is cut off again
+  MemoryFile full(40);
+  StreamableLog small(&mgr, "id");
+  small.open(&full);
+  MyTypedDTO fits;
+  fits.put("id", "1");
+  t->assert(small.append(&fits), F("Append that fits failed"));
+  uint32_t fitted = full.size();
+  MyTypedDTO tooBig;
+  tooBig.put("id", "2");
+  tooBig.put("val", "0123456789012345678901234567890123456789");
+  t->assert(!small.append(&tooBig), F("Append that doesn't fit should fail"));
+  t->assert(full.size() == fitted, F("Partial record should be truncated"));
+  t->assert(!small.get("2", &loaded), F("Partial record should not be found"));
+  t->assert(small.get("1", &loaded), F("Earlier record should still load"));
+}
+
+void testCredits(TestInvocation* t) {
+  t->setName(F("Credit-based flow control"));
+  MyTypedDTO dto;
+  dto.put("message", "the quick brown fox");
+  dto.put("detail", "jumps over the lazy dog");
+  dto.put("count", "12345");
+
+  // Only the initial window of 4 x 16 bytes is granted
+  StringStream window(F("\x11\x11\x11\x11"));
+  StringStream stalled(256);
+  LinkEnd stalledEnd(&window, &stalled);
+  StreamableManager tx;
+  tx.setCredits(&stalledEnd, 16, 4, 5);
+  t->assert(!tx.send(&stalledEnd, &dto), F("Send should stop without more credit"));
+  t->assert(stalled.getString().length() == 64, F("Should have sent exactly the credit granted"));
+  t->assert(tx.getSendCredit() == 0, F("Credit should be used up"));
+
+  String grants;
+  for (int i = 0; i < 16; i++) grants += '\x11';
+  StringStream plenty(grants);
+  StringStream sent(256);
+  LinkEnd sentEnd(&plenty, &sent);
+  tx.setCredits(&sentEnd, 16, 4, 5);
+  t->assert(tx.send(&sentEnd, &dto), F("Send with enough credit failed"));
+  String msg = sent.getString();
+  t->assert(msg.endsWith("\n\n"), F("Message should end with an empty line"));
+  t->assert(tx.getSendCredit() == (16 - msg.length() % 16) % 16, F("Grants should only be read as needed"));
+
+  // A stalled send isn't remembered as sent, so it's retried
+  StringStream retryGrants(grants);
+  retryGrants.seek(12);
+  StringStream retried(256);
+  LinkEnd retryEnd(&retryGrants, &retried);
+  StreamableManager retry;
+  retry.setSkipUnchanged(true);
+  retry.setCredits(&retryEnd, 16, 4, 5);
+  t->assert(!retry.send(&retryEnd, &dto), F("Send should stall with only 4 grants"));
+  retryGrants.seek(0);
+  t->assert(retry.send(&retryEnd, &dto), F("Stalled send should not be skipped"));
+  t->assert(!retry.send(&retryEnd, &dto), F("Completed send should be skipped"));
+
+  // Two messages arrive back to back, and are loaded one at a time
+  StringStream arriving(msg + msg);
+  StringStream granted(128);
+  LinkEnd rxEnd(&arriving, &granted);
+  StreamableManager rx;
+  rx.setCredits(&rxEnd, 16, 4, 5);
+  MyTypedDTO loaded;
+  t->assert(rx.load(&rxEnd, &loaded), F("First load failed"));
+  t->assertEqual(loaded.get("detail"), F("jumps over the lazy dog"), F("Incorrect value loaded"));
+  t->assert(rxEnd.available(), F("Load should stop at the end of the first message"));
+  t->assert(granted.getString().length() == 4 + msg.length() / 16,
+      F("Should grant the window, then a block per block read"));
+  MyTypedDTO second;
+  t->assert(rx.load(&rxEnd, &second), F("Second load failed"));
+  t->assertEqual(second.get("count"), F("12345"), F("Incorrect value in second message"));
+
+  // A batch ends with an empty line too, so a message after it loads
+  StringStream batchGrants(grants);
+  StringStream batchSent(256);
+  LinkEnd batchTxEnd(&batchGrants, &batchSent);
+  StreamableManager batchTx;
+  batchTx.setCredits(&batchTxEnd, 16, 4, 5);
+  StreamableDTO* rows[] = { &dto, &second };
+  t->assert(batchTx.sendBatch(&batchTxEnd, rows, 2), F("Batch send with enough credit failed"));
+  String batch = batchSent.getString();
+  t->assert(batch.endsWith("\n\n"), F("Batch should end with an empty line"));
+  StringStream batchArriving(batch + msg);
+  StringStream batchGranted(128);
+  LinkEnd batchRxEnd(&batchArriving, &batchGranted);
+  StreamableManager batchRx;
+  batchRx.setCredits(&batchRxEnd, 16, 4, 5);
+  StringStream oneGrant(F("\x11"));
+  StringStream batchStalled(256);
+  LinkEnd stalledBatchEnd(&oneGrant, &batchStalled);
+  StreamableManager stalledTx;
+  stalledTx.setCredits(&stalledBatchEnd, 16, 4, 5);
+  t->assert(!stalledTx.sendBatch(&stalledBatchEnd, rows, 2), F("Stalled batch should report it"));
+  MyTypedDTO row;
+  auto visitor = [](StreamableDTO*, uint16_t, void*) -> bool { return true; };
+  t->assert(batchRx.loadBatch(&batchRxEnd, &row, visitor), F("Batch load over the credit link failed"));
+  MyTypedDTO afterBatch;
+  t->assert(batchRx.load(&batchRxEnd, &afterBatch), F("Load after a batch failed"));
+  t->assertEqual(afterBatch.get("detail"), F("jumps over the lazy dog"), F("Incorrect value after a batch"));
+}
+
+void testPipeFanOut(TestInvocation* t) {
+  t->setName(F("Pipe to several sinks with routing"));
+  const char* data = "__tvid=1|4\ntemp=21\nhum=40\nnote=hello world\ntemp=22\n";
+  StringStream src(data);
+  StringStream logger(256);
+  StringStream radio(256);
+  StringStream quiet(256);
+  StringStream slow(16);
+  PipeSink loggerSink(&logger);
+  PipeSink radioSink(&radio, 16);
+  const char* radioKeys[] = { "temp" };
+  radioSink.setKeys(radioKeys, 1);
+  PipeSink quietSink(&quiet);
+  const char* quietKeys[] = { "note" };
+  quietSink.setKeys(quietKeys, 1, true);
+  PipeSink slowSink(&slow, 8, true, true);
+  StringStream small(256);
+  PipeSink smallSink(&small, 8); // most lines are written directly
+  PipeSink* sinks[] = { &loggerSink, &radioSink, &quietSink, &slowSink, &smallSink };
+  streamMgr.pipe(&src, sinks, 5);
+  t->assertEqual(logger.get(), data, F("Logger should get every line"));
+  t->assertEqual(small.get(), data, F("Lines longer than the buffer should be written whole"));
+  t->assertEqual(radio.get(), F("__tvid=1|4\ntemp=21\ntemp=22\n"), F("Radio should only get temp lines"));
+  t->assertEqual(quiet.get(), F("__tvid=1|4\ntemp=21\nhum=40\ntemp=22\n"), F("Excluded key should be left out"));
+  t->assert(slowSink.getDropped() > 0, F("Full sink should drop lines"));
+  t->assert(slowSink.getBuffered() == 0 || slow.availableForWrite() == 0, F("Slow sink should be drained as far as it can"));
+}
+
+struct UpperCaseValues {
+  char buffer[16];
+  bool operator()(StreamableManager::PipeLine& line) {
+    size_t len = line.valueLength() < sizeof(buffer) ? line.valueLength() : sizeof(buffer) - 1;
+    for (size_t i = 0; i < len; i++) buffer[i] = toupper(line.value()[i]);
+    line.setValue(buffer, len);
+    return true;
+  }
+};
+
+void testPipeStages(TestInvocation* t) {
+  t->setName(F("Pipe through chained stages"));
+  StringStream src(F("__tvid=1|4\ntemp=21\nsecret=xyz\nname=bob\nnote\nlast=1\nafter=2\n"));
+  StringStream dest(256);
+  int seen = 0;
+  int dropped = 0;
+  UpperCaseValues upper;
+  streamMgr.pipeThrough(&src, &dest, false,
+    [&](StreamableManager::PipeLine& line) {
+      seen++;
+      if (line.keyIs("secret")) {
+        dropped++;
+        return false;
+      }
+      if (line.keyIs("last")) line.stop();
+      return true;
+    },
+    [](StreamableManager::PipeLine& line) {
+      if (line.keyIs("temp")) line.setKey("t");
+      return true;
+    },
+    [&](StreamableManager::PipeLine& line) {
+      return line.keyIs("name") ? upper(line) : true;
+    });
+  t->assertEqual(dest.get(), F("__tvid=1|4\nt=21\nname=BOB\nnote\nlast=1\n"), F("Incorrect piped output"));
+  t->assert(seen == 6 && dropped == 1, F("Capturing stage should have counted the lines"));
+  t->assert(src.available(), F("stop() should have ended the pipe"));
+
+  StringStream spaced(F("abc = def\nname = bob\n"));
+  StringStream spacedDest(64);
+  bool matched = false;
+  streamMgr.pipeThrough(&spaced, &spacedDest, false,
+    [&](StreamableManager::PipeLine& line) {
+      if (line.keyIs("abc")) matched = strcmp(line.value(), "def") == 0 && line.keyLength() == 3;
+      return true;
+    },
+    [&](StreamableManager::PipeLine& line) {
+      return line.keyIs("name") ? upper(line) : true;
+    });
+  t->assert(matched, F("Key and value should be trimmed around the '='"));
+  t->assertEqual(spacedDest.get(), F("abc = def\nname=BOB\n"), F("Unchanged lines should be sent as read"));
+}
+
 void testLoadIncorrectType(TestInvocation* t) {
   t->setName(F("Load incorrect type"));
   String data = F("__tvid=2|0\nfoo=bar\nabc=def\n");
@@ -266,6 +1402,73 @@ void testLoadIncompatibleVersion(TestInvocation* t) {
   delete dto;
 }
 
+void testStaticStreamableDTO(TestInvocation* t) {
+  t->setName(F("Fixed-capacity StaticStreamableDTO"));
+  StaticStreamableDTO<3, 24> dto;
+  t->assert(dto.put("a", "12345"), F("put a failed"));
+  t->assert(dto.put("b", "67890"), F("put b failed"));
+  t->assert(dto.put(F("c"), F("pmem")), F("put PROGMEM c failed"));
+  t->assert(!dto.put("d", "1"), F("put beyond MaxEntries should fail"));
+  t->assert(dto.getPoolBytesUsed() == 16, F("PROGMEM entry should not use the pool"));
+  t->assert(dto.remove("a"), F("remove a failed"));
+  t->assert(dto.put("d", "abcdefghijklm"), F("put d should fit after compaction"));
+  t->assertEqual(dto.get("b"), F("67890"), F("b should survive compaction"));
+  t->assertEqual(dto.get("d"), F("abcdefghijklm"), F("d has incorrect value"));
+  t->assert(!dto.put("b", "this will not fit"), F("put beyond PoolBytes should fail"));
+  t->assertEqual(dto.get("b"), F("67890"), F("failed update should keep old value"));
+  t->assert(helper.getTableSize(&dto) == 3, F("Fixed table should never resize"));
+
+  StaticStreamableDTO<4, 32> loaded;
+  String data = F("foo=bar\nabc=def\n");
+  StringStream src(data);
+  t->assert(streamMgr.load(&src, &loaded), F("DTO load failed"));
+  t->assertEqual(loaded.get("foo"), F("bar"));
+  t->assertEqual(loaded.get("abc"), F("def"));
+
+  StaticStreamableDTO<4, 24> aliased;
+  aliased.put("k1", "aaaaaa");
+  aliased.put("k2", "bbbbbb");
+  aliased.remove("k1"); // leaves a hole, so the next put compacts
+  t->assert(aliased.put("k3abc", aliased.get("k2")), F("put of a pooled value failed"));
+  t->assertEqual(aliased.get("k3abc"), F("bbbbbb"), F("Pooled value moved while being copied"));
+  StreamableDTO expected;
+  expected.put("k2", "bbbbbb");
+  expected.put("k3abc", "bbbbbb");
+  t->assert(aliased.getFingerprint() == expected.getFingerprint(), F("Fingerprint used a moved string"));
+
+  StaticStreamableDTO<2, 32> bytes;
+  const char frame[] = { 'a', '\0', 'b', 'c' };
+  bytes.putBytes("f", frame, sizeof(frame));
+  bytes.remove("f");
+  t->assert(bytes.getPoolBytesUsed() == 2, F("Value with null bytes should be reclaimed"));
+}
+
+#if defined(STRDTO_STATS)
+void testIoStats(TestInvocation* t) {
+  t->setName(F("StreamableManager I/O statistics"));
+  StreamableManager mgr;
+  mgr.resetIoStats();
+  String data = F("__tvid=1|4\nfoo=bar\nabc=this is a long line this is a long line this is a long line this is\n");
+  StringStream src(data);
+  MyTypedDTO dto;
+  t->assert(mgr.load(&src, &dto), F("DTO load failed"));
+  const StreamableManager::IoStats& stats = mgr.getIoStats();
+  t->assert(stats.bytesIn == data.length(), F("Incorrect bytes in"));
+  t->assert(stats.linesParsed == 3, F("Incorrect lines parsed")); // 3rd line is split by truncation
+  t->assert(stats.linesTruncated == 1, F("Incorrect lines truncated"));
+  StringStream dest(256);
+  mgr.send(&dest, &dto);
+  t->assert(stats.bytesOut == dest.getString().length(), F("Incorrect bytes out"));
+  StringStream old(F("__tvid=1|1\nfoo=bar\n"));
+  t->assert(!mgr.load(&old, &dto), F("Incompatible version should be rejected"));
+  StringStream other(F("__tvid=2|4\nfoo=bar\n"));
+  t->assert(!mgr.load(&other, &dto), F("Incorrect type should be rejected"));
+  t->assert(stats.versionRejects == 1 && stats.typeRejects == 1, F("Incorrect reject counts"));
+  mgr.resetIoStats();
+  t->assert(mgr.getIoStats().bytesIn == 0, F("resetIoStats should clear the counters"));
+}
+#endif
+
 void testMemoryBehavior(TestInvocation* t) {
   t->setName(F("StreamableDTO Memory Behavior"));
   StreamableDTO dto;
@@ -326,13 +1529,41 @@ void setup() {
     testRemove,
     testClear,
     testResize,
+    testIncrementalResize,
+#if defined(STRDTO_STATS)
+    testHashtableStats,
+#endif
     testLoadUntypedStreamableDTO,
     testLoadLongLine,
     testSendUntypedStreamableDTO,
+    testLazyLoad,
+    testIteration,
+    testNestedDTOs,
+    testStreamableArray,
+    testKeyInterning,
+    testMoveAndClone,
+    testPutAllAndMerge,
+    testValueViews,
+    testLoadBuffer,
     testLoadTypedStreamableDTO,
     testSendTypedStreamableDTO,
+    testTypeRegistry,
+    testChecksum,
+    testCompressedStream,
+    testBatch,
+    testStreamableIndex,
+    testFingerprint,
+    testStreamableStore,
+    testStreamableLog,
+    testCredits,
+    testPipeFanOut,
+    testPipeStages,
     testLoadIncorrectType,
     testLoadIncompatibleVersion,
+    testStaticStreamableDTO,
+#if defined(STRDTO_STATS)
+    testIoStats,
+#endif
     testMemoryBehavior,
     testDestructionSafety    
   };